@@ -9,6 +9,9 @@ public class Gth.Application : Adw.Application {
 	public GenericArray<MetadataProvider> metadata_providers;
 	public HashTable<string, Gth.LoadFunc> loaders;
 	public HashTable<string, Gth.LoadFileFunc> external_loaders;
+	public HashTable<string, Gth.LoadRegionFunc> region_loaders;
+	public HashTable<string, Gth.LoadFunc> preview_loaders;
+	public HashTable<string, Gth.LoadStreamFunc> stream_loaders;
 	public HashTable<string, Gth.SaveFunc> savers;
 	public HashTable<string, GLib.Type> saver_preferences;
 	public HashTable<string, string> saver_extensions;
@@ -19,6 +22,7 @@ public class Gth.Application : Adw.Application {
 	public Gth.JobQueue jobs;
 	public ImageLoader image_loader;
 	public ThumbLoader thumb_loader;
+	public ThumbnailCache thumbnail_cache;
 	public ImageSaver image_saver;
 	public ColorManager color_manager;
 	public MetadataReader metadata_reader;
@@ -31,7 +35,7 @@ public class Gth.Application : Adw.Application {
 	public Scripts scripts;
 	public ImageEditor image_editor;
 	public Shortcuts shortcuts;
-	public Work.Factory io_factory;
+	public Work.Factory factory;
 	public FileActions tools;
 	public Selections selections;
 
@@ -44,13 +48,10 @@ public class Gth.Application : Adw.Application {
 	}
 
 	public void release_resources () {
-		if (io_factory != null) {
-			io_factory.release_resources ();
-			io_factory = null;
-		}
-		if (image_editor != null) {
-			image_editor.release_resources ();
-			image_editor = null;
+		image_editor = null;
+		if (factory != null) {
+			factory.release_resources ();
+			factory = null;
 		}
 	}
 
@@ -60,19 +61,20 @@ public class Gth.Application : Adw.Application {
 		restart = false;
 		quitting = false;
 		jobs = new Gth.JobQueue ();
-		io_factory = new Work.Factory (Util.get_workers (MAX_IO_WORKERS));
-		image_loader = new ImageLoader (io_factory);
-		thumb_loader = new ThumbLoader (io_factory);
-		image_saver = new ImageSaver (io_factory);
-		metadata_reader = new MetadataReader (io_factory);
-		metadata_writer = new MetadataWriter (io_factory);
+		factory = new Work.Factory (Util.get_workers ());
+		image_loader = new ImageLoader (factory);
+		thumb_loader = new ThumbLoader (factory);
+		thumbnail_cache = new ThumbnailCache ();
+		image_saver = new ImageSaver (factory);
+		metadata_reader = new MetadataReader (factory);
+		metadata_writer = new MetadataWriter (factory);
 		color_manager = new ColorManager ();
 		roots = new GenericList<FileData>();
 		devices = new Devices ();
 		events = new Events ();
 		bookmarks = new Bookmarks ();
 		migration = new Migration ();
-		image_editor = new ImageEditor ();
+		image_editor = new ImageEditor (factory);
 		filters = new Filters ();
 		scripts = new Scripts ();
 		tools = new FileActions ();
@@ -217,6 +219,30 @@ public class Gth.Application : Adw.Application {
 		register_image_loader ("image/x-olympus-orf", load_raw);
 #endif
 
+		region_loaders = new HashTable<string, Gth.LoadRegionFunc>(str_hash, str_equal);
+		register_region_loader ("image/jpeg", load_jpeg_region);
+
+		// Loaders that decode a reduced size image much faster than the
+		// full image: DCT scaling, reduced resolution directories and
+		// embedded previews.
+		preview_loaders = new HashTable<string, Gth.LoadFunc>(str_hash, str_equal);
+		register_preview_loader ("image/jpeg", load_jpeg);
+#if HAVE_LIBTIFF
+		register_preview_loader ("image/tiff", load_tiff_preview);
+#endif
+#if HAVE_LIBRAW
+		register_preview_loader ("image/x-dcraw", load_raw);
+		register_preview_loader ("image/x-canon-cr2", load_raw);
+		register_preview_loader ("image/x-canon-crw", load_raw);
+		register_preview_loader ("image/x-fuji-raf", load_raw);
+		register_preview_loader ("image/x-olympus-orf", load_raw);
+#endif
+
+		// Loaders that decode while reading, used when the file cannot be
+		// mapped in memory.
+		stream_loaders = new HashTable<string, Gth.LoadStreamFunc>(str_hash, str_equal);
+		register_stream_loader ("image/jpeg", load_jpeg_stream);
+
 		external_loaders = new HashTable<string, Gth.LoadFileFunc>(str_hash, str_equal);
 		register_external_loader ("video/*", load_video_thumbnail, typeof (VideoViewer));
 		register_external_loader ("audio/*", load_video_thumbnail, typeof (VideoViewer));
@@ -468,6 +494,30 @@ public class Gth.Application : Adw.Application {
 		return loaders.get (content_type);
 	}
 
+	public void register_region_loader (string content_type, LoadRegionFunc func) {
+		region_loaders.set (content_type, func);
+	}
+
+	public LoadRegionFunc? get_load_region_func (string content_type) {
+		return region_loaders.get (content_type);
+	}
+
+	public void register_preview_loader (string content_type, LoadFunc func) {
+		preview_loaders.set (content_type, func);
+	}
+
+	public LoadFunc? get_preview_load_func (string content_type) {
+		return preview_loaders.get (content_type);
+	}
+
+	public void register_stream_loader (string content_type, LoadStreamFunc func) {
+		stream_loaders.set (content_type, func);
+	}
+
+	public LoadStreamFunc? get_stream_load_func (string content_type) {
+		return stream_loaders.get (content_type);
+	}
+
 	public void register_external_loader (string content_type, LoadFileFunc func, GLib.Type viewer_type) {
 		external_loaders.set (content_type, func);
 		if (viewer_type != 0) {
@@ -819,8 +869,6 @@ public class Gth.Application : Adw.Application {
 		typeof (Gth.FolderRow).ensure ();
 		typeof (Gth.SwipeableView).ensure ();
 	}
-
-	const int MAX_IO_WORKERS = 4;
 }
 
 public delegate void Gth.MainWindowFunc (Gth.MainWindow win);
@@ -146,6 +146,9 @@ public class Gth.Browser : Gtk.Box {
 			freeze_thumbnail_list ();
 			folder_tree.list_attributes = get_list_attributes (true);
 			yield folder_tree.load_folder (location, load_action, job);
+			// Check the cached thumbnails before the thumbnailer starts.
+			var cancellable = (job != null) ? job.cancellable : new Cancellable ();
+			yield file_grid.thumbnailer.validate_cache (folder_tree.current_children, cancellable);
 		}
 		catch (Error error) {
 			throw error;
@@ -1,12 +1,26 @@
 public class Gth.CurveOperation : ImageOperation {
 	public Points points;
 
+	// Subclasses can override this to add more point operations, they are
+	// all applied to the image in a single pass.
+	public virtual void add_pixel_ops (PixelOps ops) {
+		if (points != null) {
+			ops.add_curve (points);
+		}
+	}
+
 	public override Gth.Image? execute (Image input, Cancellable cancellable, bool for_preview = false) {
-		if ((input != null) && (points != null)) {
-			var output = input.dup ();
-			if (output.apply_curve (points, cancellable)) {
-				return output;
-			}
+		if (input == null) {
+			return null;
+		}
+		var ops = new PixelOps ();
+		add_pixel_ops (ops);
+		if (ops.is_empty ()) {
+			return null;
+		}
+		var output = input.dup ();
+		if (output.apply_pixel_ops (ops, cancellable)) {
+			return output;
 		}
 		return null;
 	}
@@ -4,18 +4,27 @@ public class Gth.ImageMetadataProvider : Gth.MetadataProvider {
 	}
 
 	public override bool read (File? file, Bytes? buffer, FileInfo info, Cancellable cancellable) {
-		int width = 0, height = 0;
+		Gth.ImageInfo image_info;
 		if (buffer != null) {
-			if (!load_image_info_from_bytes (buffer, out width, out height, cancellable)) {
+			if (!load_image_header_from_bytes (buffer, out image_info, cancellable)) {
 				return false;
 			}
 		}
 		else if (file != null) {
-			if (!load_image_info (file, out width, out height, cancellable)) {
+			if (!load_image_header (file, out image_info, cancellable)) {
 				return false;
 			}
 		}
+		else {
+			return false;
+		}
+		int width, height;
+		image_info.get_oriented_size (out width, out height);
 		Lib.set_frame_size (info, width, height);
+		if (image_info.frames > 1) {
+			var metadata = new Metadata.for_string ("%d".printf (image_info.frames));
+			info.set_attribute_object ("Animation::Frames", metadata);
+		}
 		return true;
 	}
 
@@ -25,6 +34,7 @@ public class Gth.ImageMetadataProvider : Gth.MetadataProvider {
 			"Frame::Pixels",
 			"Frame::Width",
 			"Frame::Height",
+			"Animation::Frames",
 		};
 		cachable = true;
 	}
@@ -6,31 +6,114 @@ public class Gth.ImageView : Gtk.Widget, Gtk.Scrollable {
 	public Gth.Image image {
 		get { return _image; }
 		set {
-			if (value == _image) {
-				return;
-			}
-			before_changing_image ();
-			if (_default_zoom_type == ZoomType.KEEP_PREVIOUS) {
-				if (_image == null) {
-					_zoom_type = ZoomType.MAXIMIZE_IF_LARGER;
-				}
-			}
-			else {
-				_zoom_type = _default_zoom_type;
+			change_image (value, false);
+		}
+	}
+
+	// Shows a reduced version of an image while the image is loading.  The
+	// preview is drawn with the original image size, this way the zoom and
+	// the layout don't change when the full image replaces it.
+	public void set_preview (Gth.Image preview) {
+		change_image (preview, true);
+	}
+
+	void change_image (Gth.Image? value, bool is_preview) {
+		if (value == _image) {
+			return;
+		}
+		before_changing_image ();
+		if (_default_zoom_type == ZoomType.KEEP_PREVIOUS) {
+			if (_image == null) {
+				_zoom_type = ZoomType.MAXIMIZE_IF_LARGER;
 			}
-			_image = value;
-			switch (_zoom_type) {
-			case ZoomType.NATURAL_SIZE:
-				set_zoom_and_update_scroll_offset (1f);
-				break;
-			case ZoomType.KEEP_PREVIOUS:
-				set_zoom_and_update_scroll_offset (_zoom);
-				break;
-			default:
-				break;
+		}
+		else {
+			_zoom_type = _default_zoom_type;
+		}
+		_image = value;
+		if (is_preview && (_image != null)) {
+			uint original_width, original_height;
+			if (_image.get_original_image_size (out original_width, out original_height)
+				&& (original_width > _image.width))
+			{
+				// Drawn as a rendered image, scaled at draw time.
+				preview_width = original_width;
+				preview_height = original_height;
+				rendered_image = _image;
+				rendered_zoom = (float) _image.width / original_width;
 			}
-			queue_resize ();
-			start_animation ();
+		}
+		switch (_zoom_type) {
+		case ZoomType.NATURAL_SIZE:
+			set_zoom_and_update_scroll_offset (1f);
+			break;
+		case ZoomType.KEEP_PREVIOUS:
+			set_zoom_and_update_scroll_offset (_zoom);
+			break;
+		default:
+			break;
+		}
+		queue_resize ();
+		start_animation ();
+	}
+
+	// Returns the visible part of the preview in original image coordinates
+	// and the reduction that matches the zoom, if the preview has not
+	// enough detail for the current zoom.
+	public bool get_preview_region (out Gth.ImageRegion region) {
+		region = { 0, 0, 0, 0, 1 };
+		if ((preview_width == 0)
+			|| (_zoom <= rendered_zoom)
+			|| (image_box.size.width == 0)
+			|| (image_box.size.height == 0))
+		{
+			return false;
+		}
+		var scale_denom = 1;
+		while ((scale_denom < 8) && (_zoom * scale_denom * 2 <= 1f)) {
+			scale_denom *= 2;
+		}
+		// Aligned to the reduction, this way the first decoded pixel is at
+		// the region origin.
+		var x = ((int) image_box.origin.x / scale_denom) * scale_denom;
+		var y = ((int) image_box.origin.y / scale_denom) * scale_denom;
+		region = {
+			x,
+			y,
+			(int) Math.ceilf (image_box.origin.x + image_box.size.width) - x,
+			(int) Math.ceilf (image_box.origin.y + image_box.size.height) - y,
+			scale_denom
+		};
+		return true;
+	}
+
+	// Draws region_image over the preview until the full image replaces
+	// it.  region is the one returned by get_preview_region.
+	public void set_preview_region (Gth.Image preview, Gth.Image region_image, Gth.ImageRegion region) {
+		if ((preview != _image) || (preview_width == 0)) {
+			return;
+		}
+		preview_region = region_image;
+		preview_region_box = {
+			{ region.x, region.y },
+			{ region_image.width * region.scale_denom, region_image.height * region.scale_denom }
+		};
+		queue_draw ();
+	}
+
+	// The size of the image at 100% zoom, for a preview this is the size of
+	// the original image.
+	public void get_natural_size (out uint width, out uint height) {
+		if (preview_width > 0) {
+			width = preview_width;
+			height = preview_height;
+		}
+		else if (_image != null) {
+			_image.get_natural_size (out width, out height);
+		}
+		else {
+			width = 0;
+			height = 0;
 		}
 	}
 
@@ -290,7 +373,7 @@ public class Gth.ImageView : Gtk.Widget, Gtk.Scrollable {
 		}
 		if (_image != null) {
 			uint natural_width, natural_height;
-			_image.get_natural_size (out natural_width, out natural_height);
+			get_natural_size (out natural_width, out natural_height);
 			if (_zoom_type == ZoomType.KEEP_PREVIOUS) {
 				float zoomed_width, zoomed_height;
 				get_zoomed_size_for_zoom (_zoom, out zoomed_width, out zoomed_height);
@@ -299,7 +382,7 @@ public class Gth.ImageView : Gtk.Widget, Gtk.Scrollable {
 			}
 			else if (_zoom_type != ZoomType.NATURAL_SIZE) {
 				if (for_size > 0) {
-					_image.get_natural_size (out natural_width, out natural_height);
+					get_natural_size (out natural_width, out natural_height);
 					var new_zoom = Util.get_zoom_to_fit_surface (natural_width, natural_height, for_size, for_size);
 					natural_width = (uint) (new_zoom * natural_width);
 					natural_height = (uint) (new_zoom * natural_height);
@@ -492,6 +575,24 @@ public class Gth.ImageView : Gtk.Widget, Gtk.Scrollable {
 					texture_box);
 			}
 		}
+		if (preview_region != null) {
+			// Same mapping from image to widget coordinates of the preview.
+			Graphene.Rect region_box = {
+				{
+					texture_box.origin.x + (preview_region_box.origin.x - image_box.origin.x) * _zoom,
+					texture_box.origin.y + (preview_region_box.origin.y - image_box.origin.y) * _zoom
+				},
+				{
+					preview_region_box.size.width * _zoom,
+					preview_region_box.size.height * _zoom
+				}
+			};
+			snapshot.push_clip (texture_box);
+			snapshot.append_scaled_texture (preview_region.get_texture (),
+				(_zoom > MAX_FILTERED_ZOOM) ? Gsk.ScalingFilter.NEAREST : Gsk.ScalingFilter.LINEAR,
+				region_box);
+			snapshot.pop ();
+		}
 		snapshot.restore ();
 	}
 
@@ -605,7 +706,7 @@ public class Gth.ImageView : Gtk.Widget, Gtk.Scrollable {
 		}
 		float new_zoom = _zoom;
 		uint natural_width, natural_height;
-		_image.get_natural_size (out natural_width, out natural_height);
+		get_natural_size (out natural_width, out natural_height);
 		switch (type) {
 		case ZoomType.MAXIMIZE:
 			new_zoom = Util.get_zoom_to_fit_surface (natural_width, natural_height, width, height);
@@ -771,7 +872,7 @@ public class Gth.ImageView : Gtk.Widget, Gtk.Scrollable {
 		}
 
 		uint natural_width, natural_height;
-		_image.get_natural_size (out natural_width, out natural_height);
+		get_natural_size (out natural_width, out natural_height);
 
 		float image_x, image_width;
 		if (texture_box.origin.x > 0) {
@@ -810,7 +911,7 @@ public class Gth.ImageView : Gtk.Widget, Gtk.Scrollable {
 	void get_zoomed_size_for_zoom (float zoom_level, out float width, out float height) {
 		if (_image != null) {
 			uint natural_width, natural_height;
-			_image.get_natural_size (out natural_width, out natural_height);
+			get_natural_size (out natural_width, out natural_height);
 			width = zoom_level * natural_width;
 			height = zoom_level * natural_height;
 		}
@@ -1092,6 +1193,9 @@ public class Gth.ImageView : Gtk.Widget, Gtk.Scrollable {
 		_image = null;
 		rendered_image = null;
 		filtered_texture = null;
+		preview_width = 0;
+		preview_height = 0;
+		preview_region = null;
 	}
 
 	void invalidate_filtered_texture () {
@@ -1337,6 +1441,9 @@ public class Gth.ImageView : Gtk.Widget, Gtk.Scrollable {
 		rendered_image = null;
 		render_cancellable = null;
 		render_id = 0;
+		preview_width = 0;
+		preview_height = 0;
+		preview_region = null;
 
 		var zoom_controller = new Gtk.GestureZoom ();
 		zoom_controller.begin.connect ((controller, seq) => {
@@ -1382,6 +1489,10 @@ public class Gth.ImageView : Gtk.Widget, Gtk.Scrollable {
 	ImageOperation _filter_operation;
 	Gth.Image rendered_image;
 	float rendered_zoom;
+	uint preview_width;
+	uint preview_height;
+	Gth.Image preview_region;
+	Graphene.Rect preview_region_box;
 	Cancellable render_cancellable;
 	uint render_id;
 	bool scroll_on_drag;
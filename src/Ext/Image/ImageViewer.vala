@@ -66,6 +66,38 @@ public class Gth.ImageViewer : Object, Gth.FileViewer {
 		image_view.image = image;
 	}
 
+	void view_preview (Gth.Image preview, File file, Cancellable cancellable) {
+		// Keep the previous zoom type.
+		image_view.default_zoom_type = image_view.zoom_type;
+		image_view.set_preview (preview);
+		load_preview_region.begin (preview, file, cancellable);
+	}
+
+	// When the zoom requires more detail than the preview has, decode only
+	// the visible region at the matching reduction, the full image will
+	// replace both.
+	async void load_preview_region (Gth.Image preview, File file, Cancellable cancellable) {
+		// Wait for the zoom of the preview to be computed.
+		Util.after_next_rearrange (() => load_preview_region.callback ());
+		yield;
+		if (cancellable.is_cancelled ()) {
+			return;
+		}
+		Gth.ImageRegion region;
+		if (!image_view.get_preview_region (out region)) {
+			return;
+		}
+		try {
+			var region_image = yield app.image_loader.load_region (window.monitor_profile, file, region, cancellable);
+			if (region_image != null) {
+				image_view.set_preview_region (preview, region_image, region);
+			}
+		}
+		catch (Error error) {
+			// Not supported for this format or cancelled, keep the preview.
+		}
+	}
+
 	public async bool load (FileData file_data, Job job) throws Error {
 		var success = false;
 		try {
@@ -80,7 +112,9 @@ public class Gth.ImageViewer : Object, Gth.FileViewer {
 			var image = preloader.cache[file_data.file];
 			if (image == null) {
 				// stdout.printf ("> LOAD: %s\n", file_data.get_display_name ());
-				image = yield app.image_loader.load_file (window.monitor_profile, file_data.file, flags, job.cancellable);
+				image = yield app.image_loader.load_file (window.monitor_profile, file_data.file, flags, job.cancellable,
+					0, Work.Priority.INTERACTIVE,
+					(preview) => view_preview (preview, file_data.file, job.cancellable));
 			}
 			else {
 				// stdout.printf ("> FROM CACHE: %s\n", file_data.get_display_name ());
@@ -207,7 +241,7 @@ public class Gth.ImageViewer : Object, Gth.FileViewer {
 			height = 0;
 			return false;
 		}
-		image_view.image.get_natural_size (out width, out height);
+		image_view.get_natural_size (out width, out height);
 		return true;
 	}
 
@@ -9,7 +9,7 @@ public class Gth.MetadataReader {
 		job.file_data = file_data;
 		job.metadata_attributes_v = metadata_attributes_v;
 		job.cancellable = cancellable;
-		factory.add_job (job);
+		factory.add_job (job, Work.Priority.VISIBLE);
 		yield;
 		if (job.error != null) {
 			throw job.error;
@@ -19,7 +19,6 @@ public class Gth.MetadataReader {
 	class Job : Work.Job {
 		public FileData file_data;
 		public string[] metadata_attributes_v;
-		public Cancellable cancellable;
 
 		public override void run (uint worker, Bytes tmp_buffer) throws Error {
 			foreach (unowned var provider in app.metadata_providers) {
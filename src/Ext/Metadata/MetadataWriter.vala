@@ -13,7 +13,7 @@ public class Gth.MetadataWriter {
 		job.file_data = file_data;
 		job.flags = flags;
 		job.cancellable = cancellable;
-		factory.add_job (job);
+		factory.add_job (job, Work.Priority.BACKGROUND);
 		yield;
 		if (job.error != null) {
 			throw job.error;
@@ -24,7 +24,6 @@ public class Gth.MetadataWriter {
 	class Job : Work.Job {
 		public FileData file_data;
 		public Flags flags;
-		public Cancellable cancellable;
 
 		public override void run (uint worker, Bytes tmp_buffer) throws Error {
 			var saved = false;
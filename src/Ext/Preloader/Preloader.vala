@@ -16,7 +16,8 @@ public class Gth.Preloader {
 			while (!queue.is_empty ()) {
 				var file = queue.pop_head ();
 				var image = yield app.image_loader.load_file (monitor_profile, file,
-					LoadFlags.NO_BIG_IMAGES, job.cancellable, requested_size);
+					LoadFlags.NO_BIG_IMAGES, job.cancellable, requested_size,
+					Work.Priority.PREFETCH);
 				cache.add (file, image);
 			}
 		}
@@ -1,6 +1,6 @@
 public class Gth.ClearMetadata : Gth.FileOperation {
 	public ClearMetadata () {
-		factory = app.io_factory;
+		factory = app.factory;
 	}
 
 	public override async void execute (Gth.MainWindow window, File file, Gth.Job cancellable_job) throws Error {
@@ -8,7 +8,7 @@ public class Gth.ClearMetadata : Gth.FileOperation {
 		job.callback = execute.callback;
 		job.file = file;
 		job.cancellable = cancellable_job.cancellable;
-		factory.add_job (job);
+		factory.add_job (job, Work.Priority.BACKGROUND);
 		yield;
 		if (job.error != null) {
 			throw job.error;
@@ -18,7 +18,6 @@ public class Gth.ClearMetadata : Gth.FileOperation {
 
 	class Job : Work.Job {
 		public File file;
-		public Cancellable cancellable;
 
 		public override void run (uint worker, Bytes tmp_buffer) throws Error {
 			// Delete the embedded metadata.
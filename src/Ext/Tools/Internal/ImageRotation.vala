@@ -2,7 +2,7 @@ public class Gth.ImageRotation : Gth.FileOperation {
 	public ImageRotation (Transform _transform, TransformFlags _flags = TransformFlags.DEFAULT) {
 		transform = _transform;
 		flags = _flags;
-		factory = app.io_factory;
+		factory = app.factory;
 	}
 
 	public override async void execute (Gth.MainWindow window, File file, Gth.Job cancellable_job) throws Error {
@@ -12,7 +12,7 @@ public class Gth.ImageRotation : Gth.FileOperation {
 		job.transform = transform;
 		job.flags = flags;
 		job.cancellable = cancellable_job.cancellable;
-		factory.add_job (job);
+		factory.add_job (job, Work.Priority.BACKGROUND);
 		yield;
 		if (job.error != null) {
 			throw job.error;
@@ -24,7 +24,6 @@ public class Gth.ImageRotation : Gth.FileOperation {
 		public File file;
 		public Transform transform;
 		public TransformFlags flags;
-		public Cancellable cancellable;
 
 		public override void run (uint worker, Bytes tmp_buffer) throws Error {
 			// Read the file
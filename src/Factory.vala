@@ -1,8 +1,19 @@
+// Scheduling classes, jobs with a higher priority (lower value) are
+// executed first, jobs with the same priority in the order they were added.
+public enum Work.Priority {
+	INTERACTIVE,
+	VISIBLE,
+	PREFETCH,
+	BACKGROUND,
+}
+
+// The workers shared by the whole application.
 public class Work.Factory {
 	public uint n_workers;
 
 	public Factory (uint _n_workers) {
 		jobs = new AsyncQueue<Work.Job>();
+		next_sequence = 0;
 		n_workers = _n_workers;
 		workers = new Queue<Thread<void>>();
 		for (uint i = 0; i < n_workers; i++) {
@@ -14,6 +25,11 @@ public class Work.Factory {
 					if (job.action == Job.Action.EXIT) {
 						break;
 					}
+					job.disconnect_cancellable ();
+					if (job.is_cancelled ()) {
+						job.drop ();
+						continue;
+					}
 					job.try_run (worker_idx, buffer);
 				}
 			};
@@ -24,7 +40,7 @@ public class Work.Factory {
 	public void release_resources () {
 		// Exit the threads.
 		for (var i = 0; i < workers.length; i++) {
-			jobs.push (new Work.Job.exit ());
+			add_job (new Work.Job.exit (), Priority.BACKGROUND);
 		}
 		while (workers.length > 0) {
 			var thread = workers.pop_head ();
@@ -32,18 +48,85 @@ public class Work.Factory {
 		}
 	}
 
-	public void add_job (Work.Job job) {
-		jobs.push (job);
+	public void add_job (Work.Job job, Priority priority = Priority.INTERACTIVE) {
+		if (job.is_cancelled ()) {
+			job.drop ();
+			return;
+		}
+		job.priority = priority;
+		if (job.cancellable != null) {
+			unowned var priority_data = job.cancellable.get_data<PriorityData> (PRIORITY_KEY);
+			if (priority_data != null) {
+				job.priority = priority_data.priority;
+			}
+			// Remove the job from the queue as soon as it's cancelled.
+			job.cancelled_id = job.cancellable.connect (() => {
+				if (jobs.remove (job)) {
+					job.drop ();
+				}
+			});
+		}
+		job.sequence = AtomicUint.add (ref next_sequence, 1);
+		jobs.push_sorted (job, compare_jobs);
+	}
+
+	// Changes the priority of the queued jobs that use the given
+	// cancellable, and of the jobs that will be added with it.
+	public void set_priority (Cancellable cancellable, Priority priority) {
+		unowned var priority_data = cancellable.get_data<PriorityData> (PRIORITY_KEY);
+		if ((priority_data != null) && (priority_data.priority == priority)) {
+			return;
+		}
+		cancellable.set_data<PriorityData> (PRIORITY_KEY, new PriorityData (priority));
+
+		// The queue cannot be iterated, take all the jobs out and put
+		// them back in order.
+		jobs.@lock ();
+		var queued_jobs = new GenericArray<Work.Job>();
+		var changed = false;
+		Work.Job? job;
+		while ((job = jobs.try_pop_unlocked ()) != null) {
+			if (job.cancellable == cancellable) {
+				job.priority = priority;
+				changed = true;
+			}
+			queued_jobs.add (job);
+		}
+		foreach (var queued_job in queued_jobs) {
+			jobs.push_unlocked (queued_job);
+		}
+		if (changed) {
+			jobs.sort_unlocked (compare_jobs);
+		}
+		jobs.unlock ();
+	}
+
+	static int compare_jobs (Work.Job a, Work.Job b) {
+		if (a.priority != b.priority) {
+			return (a.priority < b.priority) ? -1 : 1;
+		}
+		// Compare the difference to handle the sequence overflow.
+		return (int) (a.sequence - b.sequence);
 	}
 
 	~Factory() {
 		release_resources ();
 	}
 
+	class PriorityData {
+		public Priority priority;
+
+		public PriorityData (Priority _priority) {
+			priority = _priority;
+		}
+	}
+
 	AsyncQueue<Work.Job> jobs;
 	Queue<Thread<void>> workers;
+	uint next_sequence;
 
 	const int BUFFER_SIZE = 256 * 1024;
+	const string PRIORITY_KEY = "work-factory-priority";
 }
 
 
@@ -56,16 +139,46 @@ public class Work.Job {
 	public Action action;
 	public SourceFunc callback;
 	public Error error;
+	public Cancellable cancellable;
+	public Priority priority;
+	public uint sequence;
+	public ulong cancelled_id;
 
 	public Job () {
 		action = Action.RUN;
 		error = null;
+		cancellable = null;
+		cancelled_id = 0;
 	}
 
 	public Job.exit () {
 		action = Action.EXIT;
 		callback = null;
 		error = null;
+		cancellable = null;
+		cancelled_id = 0;
+	}
+
+	public bool is_cancelled () {
+		return (cancellable != null) && cancellable.is_cancelled ();
+	}
+
+	public void disconnect_cancellable () {
+		if (cancelled_id != 0) {
+			cancellable.disconnect (cancelled_id);
+			cancelled_id = 0;
+		}
+	}
+
+	// Completes the job without running it.
+	public void drop () {
+		error = new IOError.CANCELLED ("Cancelled");
+		Idle.add (() => {
+			// Cannot be done in the cancelled handler.
+			disconnect_cancellable ();
+			callback ();
+			return Source.REMOVE;
+		});
 	}
 
 	public void try_run (uint worker, Bytes buffer) {
@@ -306,10 +306,13 @@ public class Gth.FileData : Object {
 
 	public uint thumbnail_size { get; set; default = 0; }
 
-	public void set_thumbnail (Gth.Image image, uint cache_size) {
+	// Size of the cached thumbnail known to be up to date, 0 if unknown.
+	public uint fresh_thumbnail_size = 0;
+
+	public void set_thumbnail (Gth.Image image, uint cache_size, Gdk.Texture? texture = null) {
 		thumbnail_image = image;
 		thumbnail_size = cache_size;
-		thumbnail_texture = thumbnail_image.get_texture ();
+		thumbnail_texture = (texture != null) ? texture : thumbnail_image.get_texture ();
 		thumbnail_state = ThumbnailState.LOADED;
 	}
 
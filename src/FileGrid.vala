@@ -9,6 +9,7 @@ public class Gth.FileGrid : Gtk.Box {
 		set {
 			_thumbnailer = value;
 			_thumbnailer.get_next_file_func = get_next_file_for_thumbnailer;
+			_thumbnailer.get_position_func = get_file_view_position;
 		}
 		get {
 			return _thumbnailer;
@@ -252,60 +253,131 @@ public class Gth.FileGrid : Gtk.Box {
 		return (_thumbnailer != null) ? _thumbnailer.cache_size : Thumbnailer.Size.NORMAL;
 	}
 
-	Gth.FileData? get_next_file_for_thumbnailer () {
-		// stdout.printf ("\n>>>> get_next_file_for_thumbnailer\n\n");
-		// First visible item.
-		var top = 0;
-		var bottom = view.vadjustment.get_page_size ();
+	// Returns the visible files first, then the files in the next screen
+	// in the scroll direction, then the files in the previous screen, then
+	// the other binded files.  The next screen is larger when scrolling
+	// fast.
+	Gth.FileData? get_next_file_for_thumbnailer (bool only_fresh) {
+		var page_size = view.vadjustment.get_page_size ();
+		var lookahead = page_size + (get_scroll_speed () * SCROLL_PREDICTION_TIME);
+		Gth.FileData next_file = null;
+		var next_rank = int.MAX;
+		var next_distance = double.MAX;
 		foreach (unowned Gtk.ListItem item in binded_grid_items) {
-			if (!item.child.get_mapped ()) {
+			var file_data = item.item as FileData;
+			if (file_data.has_thumbnail ()) {
 				continue;
 			}
-			Graphene.Rect bounds;
-			if (item.child.compute_bounds (view, out bounds)) {
-				if (bounds.origin.x < 0) {
-					continue;
-				}
-
-				var file_data = item.item as FileData;
-				if (file_data.has_thumbnail ()) {
-					continue;
-				}
-				if (_thumbnailer.already_added (file_data)) {
-					continue;
-				}
-
-				//stdout.printf ("> (%f,%f)[%f,%f] (state: %s) <=> [%f,%f]\n",
-				//	bounds.origin.x, bounds.origin.y,
-				//	bounds.size.width, bounds.size.height,
-				//	file_data.thumbnail_state.to_string (),
-				//	top, bottom);
-
-				if ((bounds.origin.y < top - bounds.size.height) || (bounds.origin.y > bottom)) {
-					continue;
-				}
-
-				//stdout.printf ("> y: %f, height %f (%s) <=> [%f,%f]\n",
-				//	bounds.origin.y,
-				//	bounds.size.height,
-				//	file_data.file.get_basename (),
-				//	top, bottom);
-
-				return file_data;
+			if (_thumbnailer.already_added (file_data)) {
+				continue;
+			}
+			if (only_fresh && !_thumbnailer.has_fresh_thumbnail (file_data)) {
+				continue;
+			}
+			int rank;
+			double distance;
+			if (!get_view_distance (item, page_size, out distance)) {
+				rank = 3;
+				distance = double.MAX;
+			}
+			else if (distance == 0) {
+				// Start from the side the user is scrolling to, the files on
+				// the other side will be scrolled out of view first.
+				rank = 0;
+				Graphene.Rect bounds;
+				item.child.compute_bounds (view, out bounds);
+				distance = (scroll_direction >= 0) ? page_size - bounds.origin.y : bounds.origin.y;
+			}
+			else if ((distance * scroll_direction > 0) && (distance.abs () <= lookahead)) {
+				rank = 1;
+			}
+			else if (distance.abs () <= page_size) {
+				rank = 2;
+			}
+			else {
+				rank = 3;
+			}
+			distance = distance.abs ();
+			if ((rank < next_rank) || ((rank == next_rank) && (distance < next_distance))) {
+				next_file = file_data;
+				next_rank = rank;
+				next_distance = distance;
 			}
 		}
-		// First binded item.
+		return next_file;
+	}
+
+	Gth.ViewPosition get_file_view_position (Gth.FileData file_data) {
+		var page_size = view.vadjustment.get_page_size ();
 		foreach (unowned Gtk.ListItem item in binded_grid_items) {
-			var file_data = item.item as FileData;
-			if (file_data.has_thumbnail ()) {
+			if (item.item != file_data) {
 				continue;
 			}
-			if (_thumbnailer.already_added (file_data)) {
-				continue;
+			double distance;
+			if (!get_view_distance (item, page_size, out distance)) {
+				return ViewPosition.FAR;
+			}
+			if (distance == 0) {
+				return ViewPosition.VISIBLE;
 			}
-			return file_data;
+			var lookahead = page_size + (get_scroll_speed () * SCROLL_PREDICTION_TIME);
+			if ((distance * scroll_direction > 0) && (distance.abs () <= lookahead)) {
+				return ViewPosition.NEAR;
+			}
+			return (distance.abs () <= FAR_DISTANCE_IN_PAGES * page_size) ? ViewPosition.NEAR : ViewPosition.FAR;
 		}
-		return null;
+		return ViewPosition.FAR;
+	}
+
+	// Distance in pixels of the item from the visible area: 0 if visible,
+	// negative if above, positive if below.  Returns false if the item is
+	// not placed in the view.
+	bool get_view_distance (Gtk.ListItem item, double page_size, out double distance) {
+		distance = 0;
+		if (!item.child.get_mapped ()) {
+			return false;
+		}
+		Graphene.Rect bounds;
+		if (!item.child.compute_bounds (view, out bounds)) {
+			return false;
+		}
+		if (bounds.origin.x < 0) {
+			return false;
+		}
+		if (bounds.origin.y + bounds.size.height < 0) {
+			distance = bounds.origin.y + bounds.size.height;
+		}
+		else if (bounds.origin.y > page_size) {
+			distance = bounds.origin.y - page_size;
+		}
+		return true;
+	}
+
+	void update_scroll_velocity () {
+		var now = GLib.get_monotonic_time ();
+		var value = view.vadjustment.get_value ();
+		if (value != last_scroll_value) {
+			scroll_direction = (value > last_scroll_value) ? 1 : -1;
+		}
+		var elapsed = (double) (now - last_scroll_time) / TimeSpan.SECOND;
+		if ((last_scroll_time > 0) && (elapsed > 0)) {
+			var velocity = (value - last_scroll_value) / elapsed;
+			if (elapsed > SCROLL_PAUSE) {
+				scroll_velocity = velocity;
+			}
+			else {
+				// Smooth the velocity between the events.
+				scroll_velocity = (scroll_velocity + velocity) / 2;
+			}
+		}
+		last_scroll_time = now;
+		last_scroll_value = value;
+	}
+
+	// Pixels per second, 0 if the view is not scrolling.
+	double get_scroll_speed () {
+		var elapsed = (double) (GLib.get_monotonic_time () - last_scroll_time) / TimeSpan.SECOND;
+		return (elapsed > SCROLL_PAUSE) ? 0 : scroll_velocity.abs ();
 	}
 
 	void init_thumbnailer () {
@@ -315,6 +387,7 @@ public class Gth.FileGrid : Gtk.Box {
 	}
 
 	void vadjustment_changed () {
+		update_scroll_velocity ();
 		if (_thumbnailer != null) {
 			_thumbnailer.queue_load_next ();
 		}
@@ -329,6 +402,10 @@ public class Gth.FileGrid : Gtk.Box {
 		_thumbnail_size = DEFAULT_THUMBNAIL_SIZE;
 		visible_files = null;
 		binded_grid_items = new GenericArray<Gtk.ListItem> ();
+		scroll_direction = 1;
+		scroll_velocity = 0;
+		last_scroll_value = 0;
+		last_scroll_time = 0;
 		realize.connect (() => init_thumbnailer ());
 
 		var factory = new Gtk.SignalListItemFactory ();
@@ -382,6 +459,16 @@ public class Gth.FileGrid : Gtk.Box {
 	GenericArray<Gtk.ListItem> binded_grid_items;
 	Gth.Thumbnailer _thumbnailer;
 	uint _thumbnail_size;
+	int scroll_direction;
+	double scroll_velocity;
+	double last_scroll_value;
+	int64 last_scroll_time;
 
 	const uint DEFAULT_THUMBNAIL_SIZE = 256;
+	// Seconds of scrolling to predict.
+	const double SCROLL_PREDICTION_TIME = 0.5;
+	// Seconds without scroll events after which the view is still.
+	const double SCROLL_PAUSE = 0.2;
+	// Thumbnails of files farther than this number of pages are cancelled.
+	const double FAR_DISTANCE_IN_PAGES = 2;
 }
@@ -106,7 +106,9 @@ public class Gth.Files {
 	const uint8[] ZERO = {0};
 
 	public static Bytes read_all_with_buffer (InputStream stream, Cancellable? cancellable, Bytes buffer, bool add_zero = false) throws Error {
-		var result = new ByteArray ();
+		// Reserve the space for the whole file to avoid growing the array
+		// while reading.
+		var result = new ByteArray.sized (get_remaining_size (stream, cancellable) + (add_zero ? 1 : 0));
 		while (true) {
 			var buffer_data = buffer.get_data ();
 			var size = stream.read (buffer_data, cancellable);
@@ -121,6 +123,91 @@ public class Gth.Files {
 		return ByteArray.free_to_bytes (result);
 	}
 
+	static uint get_remaining_size (InputStream stream, Cancellable? cancellable) {
+		var file_stream = stream as FileInputStream;
+		if (file_stream == null) {
+			return 0;
+		}
+		try {
+			var info = file_stream.query_info (FileAttribute.STANDARD_SIZE, cancellable);
+			var remaining = info.get_size () - file_stream.tell ();
+			return (remaining > 0) ? (uint) int64.min (remaining, uint.MAX - 1) : 0;
+		}
+		catch (Error error) {
+			return 0;
+		}
+	}
+
+	const int64 MIN_MAPPED_SIZE = 1024 * 1024;
+
+	const string MAPPED_FILE_ATTRIBUTES =
+		FileAttribute.STANDARD_TYPE + "," +
+		FileAttribute.STANDARD_SIZE + "," +
+		FileAttribute.TIME_MODIFIED + "," +
+		FileAttribute.TIME_MODIFIED_USEC;
+
+	// Returns the content of a local regular file as a read-only memory
+	// mapping, or null if the file is small, remote, not a regular file,
+	// or it changed after info was queried.  Use read_all in that case.
+	//
+	// Accessing the mapping after the file has been truncated by another
+	// process kills the application with SIGBUS, and a change that keeps
+	// the size is not noticed at all: callers must use the data as briefly
+	// as possible and check mapped_file_changed afterwards, reading the
+	// file again if it returns true.  For the same reason the loaders copy
+	// the data they use after returning, like the frames of animations.
+	public static Bytes? map_file (File file, FileInfo? info, Cancellable? cancellable = null) {
+		var path = file.get_path ();
+		if ((path == null) || (info == null)
+			|| !info.has_attribute (FileAttribute.STANDARD_SIZE)
+			|| !info.has_attribute (FileAttribute.TIME_MODIFIED)
+			|| (info.get_file_type () != FileType.REGULAR))
+		{
+			return null;
+		}
+		var expected_size = info.get_size ();
+		if (expected_size < MIN_MAPPED_SIZE) {
+			return null;
+		}
+		try {
+			var fs_info = file.query_filesystem_info (FileAttribute.FILESYSTEM_REMOTE, cancellable);
+			if (fs_info.get_attribute_boolean (FileAttribute.FILESYSTEM_REMOTE)) {
+				return null;
+			}
+			if (mapped_file_changed (file, info, cancellable)) {
+				return null;
+			}
+			var mapped_file = new MappedFile (path, false);
+			if ((int64) mapped_file.get_length () != expected_size) {
+				return null;
+			}
+			// The bytes keep a reference to the mapping.
+			return mapped_file.get_bytes ();
+		}
+		catch (Error error) {
+			return null;
+		}
+	}
+
+	// Returns true if the type, size or modification time of file differ
+	// from info, or the file cannot be queried anymore.
+	public static bool mapped_file_changed (File file, FileInfo info, Cancellable? cancellable = null) {
+		try {
+			var current = file.query_info (MAPPED_FILE_ATTRIBUTES, FileQueryInfoFlags.NONE, cancellable);
+			if ((current.get_file_type () != info.get_file_type ())
+				|| (current.get_size () != info.get_size ()))
+			{
+				return true;
+			}
+			var mtime = current.get_modification_date_time ();
+			var expected_mtime = info.get_modification_date_time ();
+			return (mtime == null) || (expected_mtime == null) || (mtime.compare (expected_mtime) != 0);
+		}
+		catch (Error error) {
+			return true;
+		}
+	}
+
 	public static async Bytes read_all_async (InputStream stream, Cancellable? cancellable = null, bool add_zero = false) throws Error {
 		var result = new ByteArray ();
 		var buffer = new uint8[BUFFER_SIZE];
@@ -1,17 +1,6 @@
 public class Gth.ImageEditor {
-	public ImageEditor () {
-		factory = new Work.Factory (Util.get_workers ());
-	}
-
-	~ImageEditor () {
-		release_resources ();
-	}
-
-	public void release_resources () {
-		if (factory != null) {
-			factory.release_resources ();
-			factory = null;
-		}
+	public ImageEditor (Work.Factory _factory) {
+		factory = _factory;
 	}
 
 	public async Image? exec_operation (Image input, ImageOperation operation, Cancellable cancellable) throws Error {
@@ -20,7 +9,7 @@ public class Gth.ImageEditor {
 		job.input = input;
 		job.operation = operation;
 		job.cancellable = cancellable;
-		factory.add_job (job);
+		factory.add_job (job, Work.Priority.INTERACTIVE);
 		yield;
 		if (cancellable.is_cancelled () || (job.output == null)) {
 			throw new IOError.CANCELLED ("Cancelled");
@@ -31,7 +20,6 @@ public class Gth.ImageEditor {
 	class Job : Work.Job {
 		public Image input;
 		public ImageOperation operation;
-		public Cancellable cancellable;
 		public Image output;
 
 		public override void run (uint worker, Bytes tmp_buffer) {
@@ -39,5 +27,5 @@ public class Gth.ImageEditor {
 		}
 	}
 
-	Work.Factory factory;
+	weak Work.Factory factory;
 }
@@ -8,22 +8,28 @@ public class Gth.ImageLoader {
 	const string REQUIRED_ATTRIBUTES = STANDARD_ATTRIBUTES_WITH_FAST_CONTENT_TYPE + "," +
 			 FileAttribute.ETAG_VALUE;
 
+	// If preview_func is not null and the format can be decoded quickly at
+	// a reduced size, a low resolution preview of large images is passed to
+	// preview_func before the full image is ready.
 	public async Image? load_file (Gth.MonitorProfile? monitor_profile, File file,
 		LoadFlags flags, Cancellable cancellable,
-		uint requested_size = 0) throws Error
+		uint requested_size = 0,
+		Work.Priority priority = Work.Priority.INTERACTIVE,
+		owned ImagePreviewFunc? preview_func = null) throws Error
 	{
 		var info = yield file.query_info_async (REQUIRED_ATTRIBUTES,
 			FileQueryInfoFlags.NONE, Priority.DEFAULT,
 			cancellable);
 		var stream = yield file.read_async (Priority.DEFAULT, cancellable);
 		var image = yield load_stream (monitor_profile, stream, file, info, flags,
-			cancellable, requested_size);
+			cancellable, requested_size, priority, (owned) preview_func);
 		return image;
 	}
 
 	public async Image? load_bytes (Gth.MonitorProfile? monitor_profile,
 		Bytes bytes, FileInfo? info, LoadFlags flags, Cancellable cancellable,
-		uint requested_size = 0) throws Error
+		uint requested_size = 0,
+		Work.Priority priority = Work.Priority.INTERACTIVE) throws Error
 	{
 		var job = new LoadBytes ();
 		job.callback = load_bytes.callback;
@@ -32,21 +38,50 @@ public class Gth.ImageLoader {
 		job.flags = flags;
 		job.cancellable = cancellable;
 		job.requested_size = requested_size;
-		factory.add_job (job);
+		factory.add_job (job, priority);
 		yield;
 		if (job.error != null) {
 			throw job.error;
 		}
 		var result = job.image;
 		if (monitor_profile != null) {
-			yield monitor_profile.apply_color_profile (result, info, cancellable, !(LoadFlags.NO_ICC_PROFILE in flags));
+			yield monitor_profile.apply_color_profile (result, info, cancellable, !(LoadFlags.NO_ICC_PROFILE in flags), priority);
+		}
+		return result;
+	}
+
+	// Decodes only the given region, for formats that support it, throws
+	// IOError.NOT_SUPPORTED otherwise.
+	public async Image? load_region (Gth.MonitorProfile? monitor_profile, File file,
+		ImageRegion region, Cancellable cancellable,
+		Work.Priority priority = Work.Priority.INTERACTIVE) throws Error
+	{
+		var info = yield file.query_info_async (REQUIRED_ATTRIBUTES,
+			FileQueryInfoFlags.NONE, Priority.DEFAULT,
+			cancellable);
+		var job = new LoadRegion ();
+		job.callback = load_region.callback;
+		job.file = file;
+		job.info = info;
+		job.region = region;
+		job.cancellable = cancellable;
+		factory.add_job (job, priority);
+		yield;
+		if (job.error != null) {
+			throw job.error;
+		}
+		var result = job.image;
+		if (monitor_profile != null) {
+			yield monitor_profile.apply_color_profile (result, info, cancellable, true, priority);
 		}
 		return result;
 	}
 
 	async Image? load_stream (Gth.MonitorProfile? monitor_profile, InputStream stream, File? file,
 		FileInfo info, LoadFlags flags, Cancellable cancellable,
-		uint requested_size = 0) throws Error
+		uint requested_size,
+		Work.Priority priority,
+		owned ImagePreviewFunc? preview_func) throws Error
 	{
 		var job = new LoadStream ();
 		job.callback = load_stream.callback;
@@ -56,14 +91,40 @@ public class Gth.ImageLoader {
 		job.flags = flags;
 		job.cancellable = cancellable;
 		job.requested_size = requested_size;
-		factory.add_job (job);
+		var completed = false;
+		if (preview_func != null) {
+			job.preview_callback = () => {
+				var preview = job.preview;
+				if (completed || cancellable.is_cancelled ()) {
+					return Source.REMOVE;
+				}
+				if (monitor_profile == null) {
+					preview_func (preview);
+					return Source.REMOVE;
+				}
+				monitor_profile.apply_color_profile.begin (preview, info, cancellable, !(LoadFlags.NO_ICC_PROFILE in flags), priority, (_obj, res) => {
+					try {
+						monitor_profile.apply_color_profile.end (res);
+						if (!completed) {
+							preview_func (preview);
+						}
+					}
+					catch (Error error) {
+					}
+				});
+				return Source.REMOVE;
+			};
+		}
+		factory.add_job (job, priority);
 		yield;
+		completed = true;
+		job.preview_callback = null; // The callback references the job.
 		if (job.error != null) {
 			throw job.error;
 		}
 		var result = job.image;
 		if (monitor_profile != null) {
-			yield monitor_profile.apply_color_profile (result, info, cancellable, !(LoadFlags.NO_ICC_PROFILE in flags));
+			yield monitor_profile.apply_color_profile (result, info, cancellable, !(LoadFlags.NO_ICC_PROFILE in flags), priority);
 		}
 		return result;
 	}
@@ -90,12 +151,15 @@ public class Gth.ImageLoader {
 		public File? file;
 		public FileInfo info;
 		public LoadFlags flags;
-		public Cancellable cancellable;
 		public uint requested_size;
 		public Image image;
+		public Image preview;
+		public SourceFunc? preview_callback;
 
 		public LoadStream () {
 			image = null;
+			preview = null;
+			preview_callback = null;
 		}
 
 		public override void run (uint worker, Bytes tmp_buffer) throws Error {
@@ -118,12 +182,30 @@ public class Gth.ImageLoader {
 			}
 
 			Bytes bytes = null;
+			var mapped = false;
 
 			var load_func = app.get_load_func (content_type);
 			if (load_func != null) {
-				seekable.seek (0, SeekType.SET, cancellable);
-				bytes = Files.read_all_with_buffer (stream, cancellable, tmp_buffer);
-				image = load_func (bytes, requested_size, cancellable);
+				if (file != null) {
+					bytes = Files.map_file (file, info, cancellable);
+				}
+				mapped = (bytes != null);
+				// Local files are read at once, streaming is only useful
+				// for the slow remote or virtual locations.
+				var remote = (file == null) || !file.is_native ();
+				if ((bytes == null) && remote && ((preview_callback == null) || (requested_size > 0))) {
+					image = load_from_stream (content_type, tmp_buffer, out bytes);
+				}
+				if ((bytes == null) && (image == null)) {
+					seekable.seek (0, SeekType.SET, cancellable);
+					bytes = Files.read_all_with_buffer (stream, cancellable, tmp_buffer);
+				}
+				if ((preview_callback != null) && (requested_size == 0)) {
+					image = load_preview (content_type, bytes);
+				}
+				if (image == null) {
+					image = load_func (bytes, requested_size, cancellable);
+				}
 			}
 			else {
 				var load_file_func = app.get_load_file_func (content_type);
@@ -140,6 +222,138 @@ public class Gth.ImageLoader {
 			}
 
 			ImageLoader.load_info (image, info, content_type, file, bytes, flags, cancellable);
+
+			// The loaders don't keep the data, check the mapped file
+			// once it isn't used anymore.
+			if (mapped && Files.mapped_file_changed (file, info, cancellable)) {
+				// The decoder may have seen a mix of the old and new
+				// content, load the current content again.
+				seekable.seek (0, SeekType.SET, cancellable);
+				bytes = Files.read_all_with_buffer (stream, cancellable, tmp_buffer);
+				image = load_func (bytes, requested_size, cancellable);
+				ImageLoader.load_info (image, info, content_type, file, bytes, flags, cancellable);
+			}
+		}
+
+		// Decodes the image while reading the stream, if the format
+		// supports it.  bytes is set to the file content if the metadata
+		// is required.
+		Image? load_from_stream (string content_type, Bytes tmp_buffer, out Bytes? bytes) throws Error {
+			bytes = null;
+			var stream_func = app.get_stream_load_func (content_type);
+			if (stream_func == null) {
+				return null;
+			}
+			var seekable = stream as Seekable;
+			seekable.seek (0, SeekType.SET, cancellable);
+			if (LoadFlags.NO_METADATA in flags) {
+				return stream_func (stream, requested_size, cancellable);
+			}
+			// Keep a copy of the data for the metadata providers.
+			var copy_stream = new CopyInputStream (stream);
+			var image = stream_func (copy_stream, requested_size, cancellable);
+			bytes = copy_stream.read_to_end (cancellable, tmp_buffer);
+			return image;
+		}
+
+		// Decodes a reduced size version of large images and passes it to
+		// preview_callback.  Returns the image if it turned out to be full
+		// size, null otherwise.
+		Image? load_preview (string content_type, Bytes bytes) throws Error {
+			var preview_func = app.get_preview_load_func (content_type);
+			if (preview_func == null) {
+				return null;
+			}
+			Gth.ImageInfo image_info;
+			if (!load_image_header_for_content_type (bytes, content_type, out image_info, cancellable)
+				|| ((int64) image_info.width * image_info.height < MIN_PIXELS_FOR_PREVIEW))
+			{
+				return null;
+			}
+			preview = preview_func (bytes, PREVIEW_SIZE, cancellable);
+			if (preview == null) {
+				return null;
+			}
+			if ((int64) preview.width * preview.height >= (int64) image_info.width * image_info.height) {
+				// No reduced version available, the full image was loaded.
+				var result = preview;
+				preview = null;
+				return result;
+			}
+			// The viewer draws the preview with the size of the final image,
+			// this way the zoom and the layout don't change when the final
+			// image replaces it.  The largest side is used because the
+			// preview may already be rotated.
+			var scale = (double) int.max (image_info.width, image_info.height) / uint.max (preview.width, preview.height);
+			preview.set_original_image_size ((uint) Math.round (preview.width * scale), (uint) Math.round (preview.height * scale));
+			Idle.add (() => {
+				if (preview_callback != null) {
+					preview_callback ();
+				}
+				return Source.REMOVE;
+			});
+			return null;
+		}
+
+		const uint PREVIEW_SIZE = 1024;
+		const int64 MIN_PIXELS_FOR_PREVIEW = 12000000;
+	}
+
+	// Keeps a copy of the data read from the base stream.
+	class CopyInputStream : FilterInputStream {
+		ByteArray data;
+
+		public CopyInputStream (InputStream base_stream) {
+			Object (base_stream: base_stream, close_base_stream: false);
+			data = new ByteArray ();
+		}
+
+		public override ssize_t read (uint8[] buffer, Cancellable? cancellable = null) throws IOError {
+			var size = base_stream.read (buffer, cancellable);
+			if (size > 0) {
+				unowned var valid_bytes = buffer[0:size];
+				data.append (valid_bytes);
+			}
+			return size;
+		}
+
+		// Reads the rest of the stream and returns all the data read.
+		public Bytes read_to_end (Cancellable? cancellable, Bytes buffer) throws Error {
+			while (read (buffer.get_data (), cancellable) > 0) {
+			}
+			return ByteArray.free_to_bytes ((owned) data);
+		}
+	}
+
+	class LoadRegion : Work.Job {
+		public File file;
+		public FileInfo info;
+		public ImageRegion region;
+		public Image image;
+
+		public LoadRegion () {
+			image = null;
+		}
+
+		public override void run (uint worker, Bytes tmp_buffer) throws Error {
+			var bytes = Files.map_file (file, info, cancellable);
+			var mapped = (bytes != null);
+			if (!mapped) {
+				bytes = Files.load_file (file, cancellable);
+			}
+			var content_type = guess_content_type (bytes.get_data ());
+			var load_func = (content_type != null) ? app.get_load_region_func (content_type) : null;
+			if (load_func == null) {
+				throw new IOError.NOT_SUPPORTED (_("No suitable loader available for this file type"));
+			}
+			image = load_func (bytes, region, cancellable);
+			if (mapped && Files.mapped_file_changed (file, info, cancellable)) {
+				bytes = Files.load_file (file, cancellable);
+				image = load_func (bytes, region, cancellable);
+			}
+			if (cancellable.is_cancelled ()) {
+				throw new IOError.CANCELLED ("Cancelled");
+			}
 		}
 	}
 
@@ -147,7 +361,6 @@ public class Gth.ImageLoader {
 		public Bytes bytes;
 		public FileInfo info;
 		public LoadFlags flags;
-		public Cancellable cancellable;
 		public uint requested_size;
 		public Image image;
 
@@ -182,6 +395,14 @@ public class Gth.ImageLoader {
 [CCode (has_target = false)]
 public delegate Gth.Image? Gth.LoadFunc (Bytes bytes, uint requested_size, Cancellable cancellable) throws Error;
 
+public delegate void Gth.ImagePreviewFunc (Gth.Image preview);
+
+[CCode (has_target = false)]
+public delegate Gth.Image? Gth.LoadStreamFunc (InputStream stream, uint requested_size, Cancellable cancellable) throws Error;
+
+[CCode (has_target = false)]
+public delegate Gth.Image? Gth.LoadRegionFunc (Bytes bytes, Gth.ImageRegion region, Cancellable cancellable) throws Error;
+
 [CCode (has_target = false)]
 public delegate Gth.Image? Gth.LoadFileFunc (File file, uint requested_size, Cancellable cancellable) throws Error;
 
@@ -54,7 +54,6 @@ public class Gth.ImageSaver {
 		public FileData file_data;
 		public Image image;
 		public SaveFlags flags;
-		public Cancellable cancellable;
 
 		public Job () {
 			image = null;
@@ -18,6 +18,12 @@ public class Gth.MonitorProfile {
 		return color_profile;
 	}
 
+	// Returns null until the profile has been resolved by get_color_profile
+	// or apply_color_profile.
+	public unowned string? get_color_profile_id () {
+		return (color_profile != null) ? color_profile.get_id () : null;
+	}
+
 	async void update_color_profile (Cancellable cancellable) throws Error {
 		try {
 			unowned var display = window.get_display ();
@@ -38,7 +44,7 @@ public class Gth.MonitorProfile {
 		}
 	}
 
-	public async void apply_color_profile (Gth.Image image, FileInfo? info, Cancellable cancellable, bool apply_icc_profile = true) throws Error {
+	public async void apply_color_profile (Gth.Image image, FileInfo? info, Cancellable cancellable, bool apply_icc_profile = true, Work.Priority priority = Work.Priority.INTERACTIVE) throws Error {
 		try {
 			if (color_profile == null) {
 				yield update_color_profile (cancellable);
@@ -51,7 +57,16 @@ public class Gth.MonitorProfile {
 			}
 			if (image.has_icc_profile ()) {
 				if (apply_icc_profile) {
-					yield image.apply_icc_profile_async (app.color_manager, color_profile, cancellable);
+					var job = new ApplyProfileJob ();
+					job.callback = apply_color_profile.callback;
+					job.image = image;
+					job.color_profile = color_profile;
+					job.cancellable = cancellable;
+					app.factory.add_job (job, priority);
+					yield;
+					if (cancellable.is_cancelled ()) {
+						throw new IOError.CANCELLED ("Cancelled");
+					}
 					if (info != null) {
 						unowned var profile_name = image.get_attribute ("Private::ColorProfile");
 						if (profile_name != null) {
@@ -73,6 +88,15 @@ public class Gth.MonitorProfile {
 		}
 	}
 
+	class ApplyProfileJob : Work.Job {
+		public Gth.Image image;
+		public IccProfile color_profile;
+
+		public override void run (uint worker, Bytes tmp_buffer) {
+			image.apply_icc_profile (app.color_manager, color_profile, cancellable);
+		}
+	}
+
 	weak Gtk.Window window;
 	IccProfile color_profile;
 }
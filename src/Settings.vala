@@ -32,6 +32,8 @@ const string PREF_BROWSER_GENERAL_FILTER = "general-filter";
 const string PREF_BROWSER_SHOW_HIDDEN_FILES = "show-hidden-files";
 const string PREF_BROWSER_THUMBNAIL_SIZE = "thumbnail-size";
 const string PREF_BROWSER_THUMBNAIL_CAPTION = "thumbnail-caption";
+const string PREF_BROWSER_PACKED_THUMBNAIL_CACHE = "packed-thumbnail-cache";
+const string PREF_BROWSER_GENERATE_ALL_THUMBNAIL_SIZES = "generate-all-thumbnail-sizes";
 const string PREF_BROWSER_SORT_TYPE = "sort-type";
 const string PREF_BROWSER_SORT_INVERSE = "sort-inverse";
 const string PREF_BROWSER_WINDOW_WIDTH = "window-width";
@@ -0,0 +1,52 @@
+// Measures the time needed to apply a color profile to a large image, with
+// a single thread and with all the available threads.
+
+const uint IMAGE_WIDTH = 4000;
+const uint IMAGE_HEIGHT = 3000;
+const int N_RUNS = 5;
+
+int main (string[] args) {
+	Pixel.init_tables ();
+
+	var color_manager = new Gth.ColorManager ();
+	var image_profile = new Gth.IccProfile.AdobeRGB ();
+	var monitor_profile = new Gth.IccProfile.sRGB ();
+	var image = new_random_image (IMAGE_WIDTH, IMAGE_HEIGHT);
+
+	var sequential_time = run_benchmark (image, color_manager, image_profile, monitor_profile, 1);
+	var parallel_time = run_benchmark (image, color_manager, image_profile, monitor_profile, 0);
+
+	print ("image: %ux%u\n", IMAGE_WIDTH, IMAGE_HEIGHT);
+	print ("threads: %u\n", Lib.get_n_threads ());
+	print ("sequential: %.1f ms\n", sequential_time * 1000);
+	print ("parallel: %.1f ms\n", parallel_time * 1000);
+	print ("speed-up: %.2fx\n", sequential_time / parallel_time);
+	return 0;
+}
+
+Gth.Image new_random_image (uint width, uint height) {
+	var stride = (int) width * 4;
+	var data = new uint8[stride * height];
+	for (var i = 0; i < data.length; i++) {
+		data[i] = (uint8) Random.int_range (0, 256);
+	}
+	var image = new Gth.Image (width, height);
+	image.copy_from_rgba_big_endian (data, true, stride);
+	return image;
+}
+
+// Returns the best time of N_RUNS runs, in seconds.
+double run_benchmark (Gth.Image image, Gth.ColorManager color_manager, Gth.IccProfile image_profile, Gth.IccProfile monitor_profile, uint max_threads) {
+	Lib.set_max_threads (max_threads);
+	var cancellable = new Cancellable ();
+	var best_time = double.MAX;
+	for (var i = 0; i < N_RUNS; i++) {
+		var copy = image.dup ();
+		copy.set_icc_profile (image_profile);
+		var timer = new Timer ();
+		copy.apply_icc_profile (color_manager, monitor_profile, cancellable);
+		best_time = double.min (best_time, timer.elapsed ());
+	}
+	Lib.set_max_threads (0);
+	return best_time;
+}
@@ -0,0 +1,119 @@
+static int n_tests = 0;
+static int n_errors = 0;
+
+int main (string[] args) {
+	Pixel.init_tables ();
+
+	Bytes bytes;
+	try {
+		bytes = save_jpeg (new_gradient_image (IMAGE_WIDTH, IMAGE_HEIGHT), null, new Cancellable ());
+	}
+	catch (Error error) {
+		stderr.printf ("> save_jpeg: %s\n", error.message);
+		return 1;
+	}
+
+	int[] scales = { 1, 2, 4, 8 };
+	foreach (var scale_denom in scales) {
+		test_region (bytes, { 96, 64, 320, 200, scale_denom });
+		test_region (bytes, { 517, 333, 250, 170, scale_denom });
+		test_region (bytes, { 0, 0, IMAGE_WIDTH, 100, scale_denom });
+		test_region (bytes, { 900, 700, 124, 68, scale_denom });
+	}
+
+	print ("\n");
+	print ("tests: %d\n", n_tests);
+	print ("errors: %d\n", n_errors);
+	return (n_errors == 0) ? 0 : 1;
+}
+
+// A smooth image, with details at different frequencies, this way the
+// JPEG compression doesn't hide the errors in the decoded regions.
+Gth.Image new_gradient_image (uint width, uint height) {
+	var stride = (int) width * 4;
+	var data = new uint8[stride * height];
+	for (var y = 0; y < height; y++) {
+		for (var x = 0; x < width; x++) {
+			var i = y * stride + x * 4;
+			data[i] = (uint8) (x * 255 / width);
+			data[i + 1] = (uint8) (y * 255 / height);
+			data[i + 2] = (uint8) (127.5 + 127.5 * Math.sin (x / 7.0) * Math.cos (y / 11.0));
+			data[i + 3] = 255;
+		}
+	}
+	var image = new Gth.Image (width, height);
+	image.copy_from_rgba_big_endian (data, true, stride);
+	return image;
+}
+
+// The region decoded with crop and skip must be equal to the same area of
+// the whole image decoded at the same scale.  A border of BORDER pixels
+// is not compared because the chroma upsampling has no context beyond the
+// cropped columns.
+void test_region (Bytes bytes, Gth.ImageRegion region) {
+	n_tests++;
+	var cancellable = new Cancellable ();
+	Gth.Image full;
+	Gth.Image cropped;
+	try {
+		// With a requested size, load_jpeg uses the largest reduction that
+		// keeps the image larger than the requested size.
+		var requested_size = (region.scale_denom > 1) ? IMAGE_HEIGHT / region.scale_denom : 0;
+		full = load_jpeg (bytes, requested_size, cancellable);
+		cropped = load_jpeg_region (bytes, region, cancellable);
+	}
+	catch (Error error) {
+		stderr.printf ("> region (%d, %d, %d, %d) 1/%d: %s\n",
+			region.x, region.y, region.width, region.height, region.scale_denom,
+			error.message);
+		n_errors++;
+		return;
+	}
+
+	if ((int) full.width != IMAGE_WIDTH / region.scale_denom) {
+		stderr.printf ("> full image 1/%d  expecting width %d  got: %u\n",
+			region.scale_denom, IMAGE_WIDTH / region.scale_denom, full.width);
+		n_errors++;
+		return;
+	}
+
+	var x0 = region.x / region.scale_denom;
+	var y0 = region.y / region.scale_denom;
+	var width = region.width / region.scale_denom;
+	var height = region.height / region.scale_denom;
+	if (((int) cropped.width < width) || ((int) cropped.height < height)
+		|| (x0 + (int) cropped.width > (int) full.width) || (y0 + (int) cropped.height > (int) full.height))
+	{
+		stderr.printf ("> region (%d, %d, %d, %d) 1/%d  expecting size %dx%d  got: %ux%u\n",
+			region.x, region.y, region.width, region.height, region.scale_denom,
+			width, height, cropped.width, cropped.height);
+		n_errors++;
+		return;
+	}
+
+	unowned var full_pixels = full.get_pixels ();
+	unowned var cropped_pixels = cropped.get_pixels ();
+	var full_stride = (int) full.get_row_stride ();
+	var cropped_stride = (int) cropped.get_row_stride ();
+	var max_difference = 0;
+	for (var y = BORDER; y < height - BORDER; y++) {
+		for (var x = BORDER; x < width - BORDER; x++) {
+			for (var c = 0; c < 4; c++) {
+				var expected = full_pixels[(y0 + y) * full_stride + (x0 + x) * 4 + c];
+				var result = cropped_pixels[y * cropped_stride + x * 4 + c];
+				var difference = ((int) expected - (int) result).abs ();
+				max_difference = int.max (max_difference, difference);
+			}
+		}
+	}
+	if (max_difference > 1) {
+		stderr.printf ("> region (%d, %d, %d, %d) 1/%d  expecting difference <= 1  got: %d\n",
+			region.x, region.y, region.width, region.height, region.scale_denom,
+			max_difference);
+		n_errors++;
+	}
+}
+
+const int IMAGE_WIDTH = 1024;
+const int IMAGE_HEIGHT = 768;
+const int BORDER = 2;
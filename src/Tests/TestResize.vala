@@ -0,0 +1,77 @@
+static int n_tests = 0;
+static int n_errors = 0;
+
+int main (string[] args) {
+	Pixel.init_tables ();
+
+	var image = new_random_image (733, 517);
+	Gth.ScaleFilter[] filters = {
+		Gth.ScaleFilter.POINT,
+		Gth.ScaleFilter.BOX,
+		Gth.ScaleFilter.TRIANGLE,
+		Gth.ScaleFilter.CUBIC,
+		Gth.ScaleFilter.LANCZOS2,
+		Gth.ScaleFilter.LANCZOS3,
+		Gth.ScaleFilter.CATMULL_ROM,
+		Gth.ScaleFilter.MITCHELL_NETRAVALI,
+	};
+	foreach (var filter in filters) {
+		test_vector_resize (image, 256, 175, filter);
+		test_vector_resize (image, 100, 300, filter);
+		test_vector_resize (image, 1500, 900, filter);
+		test_vector_resize (image, 37, 5, filter);
+		test_vector_resize (image, 1, 1, filter);
+	}
+
+	print ("\n");
+	print ("cpu features: %u\n", (uint) Lib.get_cpu_features ());
+	print ("tests: %d\n", n_tests);
+	print ("errors: %d\n", n_errors);
+	return (n_errors == 0) ? 0 : 1;
+}
+
+Gth.Image new_random_image (uint width, uint height) {
+	var stride = (int) width * 4;
+	var data = new uint8[stride * height];
+	for (var i = 0; i < data.length; i++) {
+		data[i] = (uint8) Random.int_range (0, 256);
+	}
+	var image = new Gth.Image (width, height);
+	image.copy_from_rgba_big_endian (data, true, stride);
+	return image;
+}
+
+// The vector kernels must give the same result of the scalar code,
+// within 1 level.  Each kernel is tested separately, because the best
+// available one hides the others.
+void test_vector_resize (Gth.Image image, uint width, uint height, Gth.ScaleFilter filter) {
+	Lib.set_cpu_features_mask (Lib.CpuFeatures.NONE);
+	var expected = image.resize_to (width, height, filter);
+	Lib.CpuFeatures[] masks = {
+		Lib.CpuFeatures.SSE4_1,
+		Lib.CpuFeatures.ALL,
+	};
+	foreach (var mask in masks) {
+		Lib.set_cpu_features_mask (mask);
+		var result = image.resize_to (width, height, filter);
+		var max_difference = get_max_difference (expected, result);
+		if (max_difference > 1) {
+			stderr.printf ("> resize_to (%u, %u, %d) [mask: %u]  expecting difference <= 1  got: %d\n",
+				width, height, filter, (uint) mask, max_difference);
+			n_errors++;
+		}
+		n_tests++;
+	}
+	Lib.set_cpu_features_mask (Lib.CpuFeatures.ALL);
+}
+
+int get_max_difference (Gth.Image expected, Gth.Image result) {
+	unowned var expected_pixels = expected.get_pixels ();
+	unowned var result_pixels = result.get_pixels ();
+	var max_difference = 0;
+	for (var i = 0; i < expected_pixels.length; i++) {
+		var difference = ((int) expected_pixels[i] - (int) result_pixels[i]).abs ();
+		max_difference = int.max (max_difference, difference);
+	}
+	return max_difference;
+}
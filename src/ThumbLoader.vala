@@ -3,32 +3,132 @@ public class Gth.ThumbLoader {
 
 	public ThumbLoader (Work.Factory _factory) {
 		factory = _factory;
+		stores = new ThumbnailStore[Thumbnailer.Size.XXLARGE + 1];
 	}
 
-	public async Image? load_if_valid (Gth.MonitorProfile? monitor_profile, File thumb_file, FileData file_data, Cancellable cancellable) throws Error {
+	// Returns the packed cache for the given thumbnail size.
+	public ThumbnailStore? get_store (Thumbnailer.Size size) {
+		if (stores[size] == null) {
+			var dir = Files.build_directory (FileIntent.WRITE,
+				File.new_for_path (Environment.get_user_cache_dir ()),
+				"gthumb", "thumbnails");
+			if (dir == null) {
+				return null;
+			}
+			var max_data_size = MAX_STORE_SIZE / stores.length;
+			stores[size] = new ThumbnailStore (dir.get_child (size.get_subdir ()).get_path (), max_data_size);
+		}
+		return stores[size];
+	}
+
+	// If store is not null the loaded thumbnail is added to the store.
+	public async Image? load_if_valid (Gth.MonitorProfile? monitor_profile, File thumb_file, FileData file_data, Cancellable cancellable, ThumbnailStore? store = null) throws Error {
 		var job = new Job ();
 		job.callback = load_if_valid.callback;
 		job.thumb_file = thumb_file;
 		job.file_data = file_data;
+		job.store = store;
 		job.cancellable = cancellable;
-		factory.add_job (job);
+		factory.add_job (job, Work.Priority.VISIBLE);
 		yield;
 		if (job.error != null) {
 			throw job.error;
 		}
 		if (monitor_profile != null) {
-			yield monitor_profile.apply_color_profile (job.image, null, cancellable);
+			yield monitor_profile.apply_color_profile (job.image, null, cancellable, true, Work.Priority.VISIBLE);
+		}
+		return job.image;
+	}
+
+	// Returns null if the store doesn't contain a valid thumbnail.
+	public async Image? load_from_store (Gth.MonitorProfile? monitor_profile, ThumbnailStore store, FileData file_data, Cancellable cancellable) throws Error {
+		var job = new StoreJob ();
+		job.callback = load_from_store.callback;
+		job.store = store;
+		job.file_data = file_data;
+		job.cancellable = cancellable;
+		factory.add_job (job, Work.Priority.VISIBLE);
+		yield;
+		if (job.error != null) {
+			throw job.error;
+		}
+		if ((job.image != null) && (monitor_profile != null)) {
+			yield monitor_profile.apply_color_profile (job.image, null, cancellable, true, Work.Priority.VISIBLE);
+		}
+		return job.image;
+	}
+
+	public async void add_to_store (ThumbnailStore store, FileData file_data, Image thumbnail, Cancellable cancellable) throws Error {
+		var job = new StoreJob ();
+		job.callback = add_to_store.callback;
+		job.store = store;
+		job.file_data = file_data;
+		job.image = thumbnail;
+		job.cancellable = cancellable;
+		factory.add_job (job, Work.Priority.PREFETCH);
+		yield;
+		if (job.error != null) {
+			throw job.error;
+		}
+	}
+
+	// Checks in a single job which files have an up to date thumbnail of
+	// the given size, without loading the thumbnails.  If store is null
+	// the modification time of the thumbnail files is used.
+	public async bool[] validate (GenericArray<FileData> files, Thumbnailer.Size size, ThumbnailStore? store, Cancellable cancellable) throws Error {
+		var job = new ValidateJob ();
+		job.callback = validate.callback;
+		job.files = files;
+		job.size = size;
+		job.store = store;
+		job.cancellable = cancellable;
+		factory.add_job (job, Work.Priority.VISIBLE);
+		yield;
+		if (job.error != null) {
+			throw job.error;
+		}
+		return job.valid;
+	}
+
+	// Resizes the image in the factory, the job uses the priority of the
+	// cancellable if set.
+	public async Image resize (Image image, uint size, Cancellable cancellable, Work.Priority priority = Work.Priority.VISIBLE) throws Error {
+		var job = new ScaleJob ();
+		job.callback = resize.callback;
+		job.image = image;
+		job.size = size;
+		job.cancellable = cancellable;
+		factory.add_job (job, priority);
+		yield;
+		if (job.error != null) {
+			throw job.error;
 		}
 		return job.image;
 	}
 
+	// Returns the thumbnails of all the sizes, indexed by size, each one
+	// scaled from the next larger one.
+	public async Image[] resize_to_all_sizes (Image image, Cancellable cancellable, Work.Priority priority = Work.Priority.VISIBLE) throws Error {
+		var job = new ResizeJob ();
+		job.callback = resize_to_all_sizes.callback;
+		job.image = image;
+		job.cancellable = cancellable;
+		factory.add_job (job, priority);
+		yield;
+		if (job.error != null) {
+			throw job.error;
+		}
+		return job.thumbnails;
+	}
+
 	class Job : Work.Job {
 		public File thumb_file;
 		public FileData file_data;
-		public Cancellable cancellable;
+		public ThumbnailStore store;
 		public Image image;
 
 		public Job () {
+			store = null;
 			image = null;
 		}
 
@@ -39,6 +139,125 @@ public class Gth.ThumbLoader {
 				throw new IOError.FAILED ("Invalid thumbnail");
 			}
 			image = load_png (bytes, 0, cancellable);
+			int64 mtime;
+			if ((store != null) && Thumbnailer.get_file_mtime (file_data, out mtime)) {
+				store.add (file_data.file.get_uri (), mtime, image);
+			}
+		}
+	}
+
+	// Reads the thumbnail from the store if image is null, adds image to
+	// the store otherwise.
+	class StoreJob : Work.Job {
+		public ThumbnailStore store;
+		public FileData file_data;
+		public Image image;
+
+		public StoreJob () {
+			image = null;
+		}
+
+		public override void run (uint worker, Bytes tmp_buffer) throws Error {
+			int64 mtime;
+			if (!Thumbnailer.get_file_mtime (file_data, out mtime)) {
+				return;
+			}
+			if (image == null) {
+				image = store.lookup (file_data.file.get_uri (), mtime);
+			}
+			else {
+				store.add (file_data.file.get_uri (), mtime, image);
+			}
 		}
 	}
+
+	class ResizeJob : Work.Job {
+		public Image image;
+		public Image[] thumbnails;
+
+		public override void run (uint worker, Bytes tmp_buffer) throws Error {
+			thumbnails = new Image[Thumbnailer.Size.XXLARGE + 1];
+			var source = image;
+			for (var i = thumbnails.length - 1; i >= 0; i--) {
+				var size = (Thumbnailer.Size) i;
+				var thumbnail = source.resize (size.to_pixels (), ResizeFlags.DEFAULT, ScaleFilter.GOOD, cancellable);
+				if (thumbnail == null) {
+					throw new IOError.FAILED ("Could not resize the image");
+				}
+				if (cancellable.is_cancelled ()) {
+					throw new IOError.CANCELLED ("Cancelled");
+				}
+				thumbnails[i] = thumbnail;
+				source = thumbnail;
+			}
+		}
+	}
+
+	class ScaleJob : Work.Job {
+		public Image image;
+		public uint size;
+
+		public override void run (uint worker, Bytes tmp_buffer) throws Error {
+			var scaled = image.resize (size, ResizeFlags.DEFAULT, ScaleFilter.GOOD, cancellable);
+			if (scaled == null) {
+				throw new IOError.FAILED ("Could not resize the image");
+			}
+			if (cancellable.is_cancelled ()) {
+				throw new IOError.CANCELLED ("Cancelled");
+			}
+			image = scaled;
+		}
+	}
+
+	class ValidateJob : Work.Job {
+		public GenericArray<FileData> files;
+		public Thumbnailer.Size size;
+		public ThumbnailStore store;
+		public bool[] valid;
+
+		public override void run (uint worker, Bytes tmp_buffer) throws Error {
+			var n_files = files.length;
+			valid = new bool[n_files];
+			if (store != null) {
+				var uris = new string[n_files];
+				var mtimes = new int64[n_files];
+				for (var i = 0; i < n_files; i++) {
+					uris[i] = files[i].file.get_uri ();
+					Thumbnailer.get_file_mtime (files[i], out mtimes[i]);
+				}
+				store.validate (uris, mtimes, valid);
+				return;
+			}
+			for (var i = 0; i < n_files; i++) {
+				if (cancellable.is_cancelled ()) {
+					throw new IOError.CANCELLED ("Cancelled");
+				}
+				valid[i] = thumbnail_file_is_newer (files[i]);
+			}
+		}
+
+		bool thumbnail_file_is_newer (FileData file_data) {
+			int64 mtime;
+			if (!Thumbnailer.get_file_mtime (file_data, out mtime)) {
+				return false;
+			}
+			try {
+				var thumbnail_file = Thumbnailer.get_thumbnail_file (file_data.file, size, FileIntent.READ, cancellable);
+				var info = thumbnail_file.query_info (FileAttribute.TIME_MODIFIED, FileQueryInfoFlags.NONE, cancellable);
+				var datetime = info.get_modification_date_time ();
+				return (datetime != null) && (datetime.to_unix () >= mtime);
+			}
+			catch (Error error) {
+				return false;
+			}
+		}
+	}
+
+	ThumbnailStore[] stores;
+
+	// Disk space used by the packed caches of all the sizes together, the
+	// thumbnails are also saved as PNG files, so this is only an addition
+	// to speed up loading.  About 2000 thumbnails for the normal size and
+	// 130 for the largest size.
+	const uint64 MAX_STORE_SIZE = 400 * 1024 * 1024;
 }
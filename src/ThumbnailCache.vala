@@ -0,0 +1,126 @@
+// Thumbnails recently loaded by any window, with their texture, to show
+// them again without reading them from the disk cache.
+public class Gth.ThumbnailCache {
+	public ThumbnailCache (size_t _max_size = DEFAULT_MAX_SIZE) {
+		max_size = _max_size;
+		size = 0;
+		entries = new HashTable<string, Entry> (str_hash, str_equal);
+		first = null;
+		last = null;
+	}
+
+	~ThumbnailCache () {
+		clear ();
+	}
+
+	// The textures are converted to the monitor profile, so windows on
+	// monitors with different profiles cannot share them.
+	public static string get_key (string uri, int64 mtime, uint size, string profile_id) {
+		return ("%u:%" + int64.FORMAT + ":%s:%s").printf (size, mtime, profile_id, uri);
+	}
+
+	// Returns null if not found, moves the entry at the end of the
+	// eviction list otherwise.
+	public Image? lookup (string key, out Gdk.Texture texture) {
+		var entry = entries.get (key);
+		if (entry == null) {
+			texture = null;
+			return null;
+		}
+		unlink (entry);
+		append (entry);
+		texture = entry.texture;
+		return entry.image;
+	}
+
+	public void add (string key, Image image, Gdk.Texture texture) {
+		var entry_size = (size_t) image.get_width () * image.get_height () * 4;
+		if (entry_size > max_size) {
+			return;
+		}
+		remove (key);
+		while ((first != null) && (size + entry_size > max_size)) {
+			var oldest_key = first.key;
+			remove (oldest_key);
+		}
+		var entry = new Entry (key, image, texture, entry_size);
+		entries.set (key, entry);
+		append (entry);
+		size += entry_size;
+	}
+
+	public void remove (string key) {
+		var entry = entries.get (key);
+		if (entry == null) {
+			return;
+		}
+		size -= entry.size;
+		unlink (entry);
+		entries.remove (key);
+	}
+
+	public void clear () {
+		first = null;
+		last = null;
+		entries.remove_all ();
+		size = 0;
+	}
+
+	void append (Entry entry) {
+		entry.prev = last;
+		entry.next = null;
+		if (last != null) {
+			last.next = entry;
+		}
+		else {
+			first = entry;
+		}
+		last = entry;
+	}
+
+	void unlink (Entry entry) {
+		if (entry.prev != null) {
+			entry.prev.next = entry.next;
+		}
+		else {
+			first = entry.next;
+		}
+		if (entry.next != null) {
+			entry.next.prev = entry.prev;
+		}
+		else {
+			last = entry.prev;
+		}
+		entry.prev = null;
+		entry.next = null;
+	}
+
+	class Entry {
+		public string key;
+		public Image image;
+		public Gdk.Texture texture;
+		public size_t size;
+		public unowned Entry? next;
+		public unowned Entry? prev;
+
+		public Entry (string _key, Image _image, Gdk.Texture _texture, size_t _size) {
+			key = _key;
+			image = _image;
+			texture = _texture;
+			size = _size;
+			next = null;
+			prev = null;
+		}
+	}
+
+	size_t max_size;
+	size_t size;
+	// The entries are owned by the table, the eviction list goes from the
+	// least to the most recently used entry.
+	HashTable<string, Entry> entries;
+	unowned Entry? first;
+	unowned Entry? last;
+
+	// About a thousand 256 pixels thumbnails.
+	public const size_t DEFAULT_MAX_SIZE = 256 * 1024 * 1024;
+}
@@ -48,7 +48,10 @@ public class Gth.Thumbnailer {
 	public Size cache_size;
 	public bool load_from_cache;
 	public bool save_to_cache;
+	public bool use_packed_cache;
+	public bool generate_all_sizes;
 	public NextFileFunc get_next_file_func;
+	public FilePositionFunc get_position_func;
 
 	public Thumbnailer (Gth.MonitorProfile _monitor_profile, Gth.JobQueue? _app_jobs = null) {
 		monitor_profile = _monitor_profile;
@@ -56,7 +59,10 @@ public class Gth.Thumbnailer {
 		requested_size = 256;
 		load_from_cache = true;
 		save_to_cache = true;
+		use_packed_cache = app.settings.get_boolean (PREF_BROWSER_PACKED_THUMBNAIL_CACHE);
+		generate_all_sizes = app.settings.get_boolean (PREF_BROWSER_GENERATE_ALL_THUMBNAIL_SIZES);
 		get_next_file_func = null;
+		get_position_func = null;
 		file_queue = new Queue<FileData>();
 		job_queue = new GenericArray<ThumbnailJob>();
 		active = false;
@@ -111,6 +117,7 @@ public class Gth.Thumbnailer {
 			return;
 		}
 		load_event = Util.after_next_rearrange (() => {
+			update_priorities ();
 			load_next ();
 			load_event = 0;
 		});
@@ -122,6 +129,27 @@ public class Gth.Thumbnailer {
 
 	uint load_event = 0;
 
+	// Thumbnails of files scrolled out of view wait for the visible ones,
+	// thumbnails of files scrolled far away are cancelled.
+	void update_priorities () {
+		if (get_position_func == null) {
+			return;
+		}
+		var far_jobs = new GenericArray<ThumbnailJob>();
+		foreach (unowned var thumbnail_job in job_queue) {
+			var position = get_position_func (thumbnail_job.file);
+			if (position == ViewPosition.FAR) {
+				far_jobs.add (thumbnail_job);
+				continue;
+			}
+			var priority = (position == ViewPosition.VISIBLE) ? Work.Priority.VISIBLE : Work.Priority.PREFETCH;
+			app.factory.set_priority (thumbnail_job.job.cancellable, priority);
+		}
+		foreach (unowned var thumbnail_job in far_jobs) {
+			thumbnail_job.job.cancel ();
+		}
+	}
+
 	void cancel_load_next () {
 		if (load_event != 0) {
 			Source.remove (load_event);
@@ -129,43 +157,67 @@ public class Gth.Thumbnailer {
 		}
 	}
 
+	// Marks the files with an up to date cached thumbnail, checking all
+	// the files at once without reading the thumbnails.
+	public async void validate_cache (GenericList<FileData> files, Cancellable cancellable) {
+		if (!load_from_cache) {
+			return;
+		}
+		var file_array = new GenericArray<FileData> ();
+		foreach (unowned var file in files) {
+			file_array.add (file);
+		}
+		try {
+			var valid = yield app.thumb_loader.validate (file_array, cache_size, get_packed_cache (), cancellable);
+			var size = cache_size.to_pixels ();
+			for (var i = 0; i < file_array.length; i++) {
+				file_array[i].fresh_thumbnail_size = valid[i] ? size : 0;
+			}
+		}
+		catch (Error error) {
+		}
+	}
+
+	public bool has_fresh_thumbnail (FileData file) {
+		return load_from_cache && (file.fresh_thumbnail_size == cache_size.to_pixels ());
+	}
+
 	void load_next () {
 		if (!active) {
 			return;
 		}
-		if (job_queue.length >= app.thumb_loader.factory.n_workers) {
+		// Files with an up to date cached thumbnail have their own lane,
+		// this way they don't wait for the thumbnails being generated.
+		var n_workers = app.thumb_loader.factory.n_workers;
+		var n_fast_jobs = 0;
+		foreach (unowned var thumbnail_job in job_queue) {
+			if (thumbnail_job.fast) {
+				n_fast_jobs++;
+			}
+		}
+		var slow_lane_full = (job_queue.length - n_fast_jobs >= n_workers);
+		var fast_lane_full = (n_fast_jobs >= n_workers);
+		if (slow_lane_full && fast_lane_full) {
 			return;
 		}
 		FileData file = null;
-		if ((file == null) && (get_next_file_func != null)) {
-			file = get_next_file_func ();
-			// if (file != null) {
-			// 	stdout.printf ("> LOAD THUMBNAIL [next]: %s\n", file.file.get_basename ());
-			// }
-		}
-		if (file == null) {
-			while (true) {
-				file = file_queue.pop_head ();
-				if (file == null) {
-					break;
-				}
-				if (file.has_thumbnail ()) {
-					continue;
-				}
-				// stdout.printf ("> LOAD THUMBNAIL [queue]: %s\n", file.file.get_basename ());
-				break;
+		do {
+			file = get_next_file (slow_lane_full);
+			if (file == null) {
+				return;
 			}
 		}
-		if (file == null) {
-			return;
-		}
-		var thumbnail_job = new ThumbnailJob (app_jobs, file);
+		while (load_thumbnail_from_memory (file));
+		var fast = !fast_lane_full && has_fresh_thumbnail (file);
+		var thumbnail_job = new ThumbnailJob (app_jobs, file, fast);
+		app.factory.set_priority (thumbnail_job.job.cancellable, Work.Priority.VISIBLE);
 		job_queue.add (thumbnail_job);
 		file.thumbnail_state = ThumbnailState.LOADING;
 		load_thumbnail.begin (thumbnail_job.file, thumbnail_job.job, (_obj, res) => {
 			try {
 				var thumbnail = load_thumbnail.end (res);
 				thumbnail_job.file.set_thumbnail (thumbnail, cache_size.to_pixels ());
+				add_thumbnail_to_memory (thumbnail_job.file);
 			}
 			catch (Error error) {
 				//stdout.printf ("> LOAD THUMBNAIL ERROR: %s\n", error.message);
@@ -178,6 +230,67 @@ public class Gth.Thumbnailer {
 		load_next ();
 	}
 
+	FileData? get_next_file (bool slow_lane_full) {
+		FileData file = null;
+		if ((file == null) && (get_next_file_func != null)) {
+			file = get_next_file_func (slow_lane_full);
+			// if (file != null) {
+			// 	stdout.printf ("> LOAD THUMBNAIL [next]: %s\n", file.file.get_basename ());
+			// }
+		}
+		if ((file == null) && !slow_lane_full) {
+			while (true) {
+				file = file_queue.pop_head ();
+				if (file == null) {
+					break;
+				}
+				if (file.has_thumbnail ()) {
+					continue;
+				}
+				// stdout.printf ("> LOAD THUMBNAIL [queue]: %s\n", file.file.get_basename ());
+				break;
+			}
+		}
+		return file;
+	}
+
+	string? get_memory_cache_key (FileData file_data) {
+		unowned var profile_id = monitor_profile.get_color_profile_id ();
+		if (profile_id == null) {
+			return null;
+		}
+		int64 mtime;
+		if (!Thumbnailer.get_file_mtime (file_data, out mtime)) {
+			return null;
+		}
+		return ThumbnailCache.get_key (file_data.file.get_uri (), mtime, _requested_size, profile_id);
+	}
+
+	// Returns true if the thumbnail was found in the memory cache.
+	bool load_thumbnail_from_memory (FileData file_data) {
+		if (!load_from_cache) {
+			return false;
+		}
+		var key = get_memory_cache_key (file_data);
+		if (key == null) {
+			return false;
+		}
+		Gdk.Texture texture;
+		var thumbnail = app.thumbnail_cache.lookup (key, out texture);
+		if (thumbnail == null) {
+			return false;
+		}
+		file_data.set_thumbnail (thumbnail, cache_size.to_pixels (), texture);
+		return true;
+	}
+
+	void add_thumbnail_to_memory (FileData file_data) {
+		var key = get_memory_cache_key (file_data);
+		if (key != null) {
+			app.thumbnail_cache.add (key, file_data.thumbnail_image, (Gdk.Texture) file_data.thumbnail_texture);
+		}
+	}
+
 	async Gth.Image? load_thumbnail (FileData file_data, Job job) throws Error {
 		Gth.Image thumbnail = null;
 		if (load_from_cache) {
@@ -186,10 +299,14 @@ public class Gth.Thumbnailer {
 		if (thumbnail == null) {
 			var	valid_failed = yield has_valid_failed_thumbnail (file_data, job.cancellable);
 			if (!valid_failed) {
-				thumbnail = yield generate_thumbnail (file_data, job.cancellable);
+				Gth.Image image;
+				thumbnail = yield generate_thumbnail (file_data, job.cancellable, out image);
 				if (save_to_cache) {
 					if (thumbnail != null) {
-						yield save_thumbnail_to_cache (file_data, thumbnail, job.cancellable);
+						yield save_thumbnail_to_cache (file_data, thumbnail, cache_size, job.cancellable);
+						if (generate_all_sizes) {
+							save_other_sizes.begin (file_data, image);
+						}
 					}
 					else {
 						yield save_failed_thumbnail_to_cache (file_data, job.cancellable);
@@ -217,9 +334,17 @@ public class Gth.Thumbnailer {
 
 	async Gth.Image? load_thumbnail_from_cache (FileData file_data, Cancellable cancellable) throws Error {
 		try {
-			var thumbnail_file = Thumbnailer.get_thumbnail_file (file_data.file, cache_size, FileIntent.READ, cancellable);
-			var thumbnail = yield app.thumb_loader.load_if_valid (monitor_profile, thumbnail_file, file_data, cancellable);
-			return yield thumbnail.resize_async (_requested_size, ResizeFlags.DEFAULT, ScaleFilter.GOOD, cancellable);
+			Gth.Image thumbnail = null;
+			var store = get_packed_cache ();
+			if (store != null) {
+				thumbnail = yield app.thumb_loader.load_from_store (monitor_profile, store, file_data, cancellable);
+			}
+			if (thumbnail == null) {
+				// The thumbnail is added to the packed cache as well.
+				var thumbnail_file = Thumbnailer.get_thumbnail_file (file_data.file, cache_size, FileIntent.READ, cancellable);
+				thumbnail = yield app.thumb_loader.load_if_valid (monitor_profile, thumbnail_file, file_data, cancellable, store);
+			}
+			return yield app.thumb_loader.resize (thumbnail, _requested_size, cancellable);
 		}
 		catch (Error error) {
 			//stdout.printf ("> load_thumbnail_from_cache %s: %s\n", file_data.file.get_uri (), error.message);
@@ -230,29 +355,64 @@ public class Gth.Thumbnailer {
 		}
 	}
 
-	async Gth.Image? generate_thumbnail (FileData file_data, Cancellable cancellable) throws Error {
+	// Returns the thumbnail of cache_size, or null if it cannot be
+	// generated.  image is set to the decoded image, which is decoded at
+	// the largest size if generate_all_sizes is true.
+	async Gth.Image? generate_thumbnail (FileData file_data, Cancellable cancellable, out Gth.Image? image) throws Error {
+		image = null;
 		try {
-			var image = yield app.image_loader.load_file (monitor_profile, file_data.file, LoadFlags.DEFAULT, cancellable, cache_size.to_pixels ());
-			var resized = yield image.resize_async (cache_size.to_pixels (), ResizeFlags.DEFAULT, ScaleFilter.GOOD, cancellable);
-			set_file_attributes_to_image (resized, file_data);
-			resized.set_attribute ("Thumb::Image::Width", "%u".printf (image.get_width ()));
-			resized.set_attribute ("Thumb::Image::Height", "%u".printf (image.get_height ()));
-			return resized;
+			var load_size = generate_all_sizes ? Size.XXLARGE : cache_size;
+			image = yield app.image_loader.load_file (monitor_profile, file_data.file, LoadFlags.DEFAULT, cancellable, load_size.to_pixels (), Work.Priority.VISIBLE);
+			var thumbnail = yield app.thumb_loader.resize (image, cache_size.to_pixels (), cancellable);
+			set_thumbnail_attributes (thumbnail, file_data, image);
+			return thumbnail;
 		}
 		catch (Error error) {
 			//stdout.printf ("> generate_thumbnail: %s\n", error.message);
 			if (error is IOError.CANCELLED) {
 				throw error;
 			}
+			image = null;
 			return null;
 		}
 	}
 
-	async void save_thumbnail_to_cache (FileData original, Gth.Image thumbnail_image, Cancellable cancellable) throws Error {
+	// Saves the thumbnails of the other sizes after the visible one has
+	// been returned.  The jobs use their own cancellable, this way they keep
+	// the background priority and are not cancelled with the thumbnail job.
+	async void save_other_sizes (FileData file_data, Gth.Image image) {
+		var cancellable = new Cancellable ();
+		app.factory.set_priority (cancellable, Work.Priority.BACKGROUND);
 		try {
-			var thumbnail_file = Thumbnailer.get_thumbnail_file (original.file, cache_size, FileIntent.WRITE, cancellable);
+			var thumbnails = yield app.thumb_loader.resize_to_all_sizes (image, cancellable, Work.Priority.BACKGROUND);
+			for (var i = 0; i < thumbnails.length; i++) {
+				if (((Size) i == cache_size) || (thumbnails[i] == null)) {
+					continue;
+				}
+				set_thumbnail_attributes (thumbnails[i], file_data, image);
+				yield save_thumbnail_to_cache (file_data, thumbnails[i], (Size) i, cancellable);
+			}
+		}
+		catch (Error error) {
+			//stdout.printf ("> save_other_sizes: %s\n", error.message);
+		}
+	}
+
+	void set_thumbnail_attributes (Gth.Image thumbnail, FileData file_data, Gth.Image image) {
+		set_file_attributes_to_image (thumbnail, file_data);
+		thumbnail.set_attribute ("Thumb::Image::Width", "%u".printf (image.get_width ()));
+		thumbnail.set_attribute ("Thumb::Image::Height", "%u".printf (image.get_height ()));
+	}
+
+	async void save_thumbnail_to_cache (FileData original, Gth.Image thumbnail_image, Size size, Cancellable cancellable) throws Error {
+		try {
+			var thumbnail_file = Thumbnailer.get_thumbnail_file (original.file, size, FileIntent.WRITE, cancellable);
 			var thumbnail_file_data = new FileData.for_file (thumbnail_file, "image/png");
 			yield app.image_saver.replace_file (monitor_profile, thumbnail_image, thumbnail_file_data, SaveFlags.NO_METADATA, cancellable);
+			var store = use_packed_cache ? app.thumb_loader.get_store (size) : null;
+			if (store != null) {
+				yield app.thumb_loader.add_to_store (store, original, thumbnail_image, cancellable);
+			}
 		}
 		catch (Error error) {
 			//stdout.printf ("> save_thumbnail_to_cache %s: %s\n", original.file.get_uri (), error.message);
@@ -296,6 +456,20 @@ public class Gth.Thumbnailer {
 		}
 	}
 
+	ThumbnailStore? get_packed_cache () {
+		return use_packed_cache ? app.thumb_loader.get_store (cache_size) : null;
+	}
+
+	public static bool get_file_mtime (FileData file_data, out int64 mtime) {
+		var datetime = file_data.info.get_modification_date_time ();
+		if (datetime == null) {
+			mtime = 0;
+			return false;
+		}
+		mtime = datetime.to_unix ();
+		return true;
+	}
+
 	public static bool valid_thumbnail_for_file (Bytes bytes, FileData file_data, Cancellable cancellable) {
 		try {
 			var attributes = load_png_attributes (bytes);
@@ -362,9 +536,11 @@ public class Gth.Thumbnailer {
 	class ThumbnailJob {
 		public FileData file;
 		public Gth.Job job;
+		public bool fast;
 
-		public ThumbnailJob (Gth.JobQueue jobs, FileData _file) {
+		public ThumbnailJob (Gth.JobQueue jobs, FileData _file, bool _fast) {
 			file = _file;
+			fast = _fast;
 			job = jobs.new_job ("Thumbnail for %s".printf (file.get_display_name ()),
 				JobFlags.DEFAULT,
 				"gth-image-symbolic");
@@ -383,4 +559,8 @@ public class Gth.Thumbnailer {
 	bool active;
 }
 
-public delegate Gth.FileData? Gth.NextFileFunc ();
+// If only_fresh is true returns only files with an up to date cached
+// thumbnail.
+public delegate Gth.FileData? Gth.NextFileFunc (bool only_fresh);
+
+public delegate Gth.ViewPosition Gth.FilePositionFunc (Gth.FileData file);
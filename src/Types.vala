@@ -106,6 +106,12 @@ public enum Gth.ThumbnailState {
 	LOADED;
 }
 
+public enum Gth.ViewPosition {
+	VISIBLE,
+	NEAR,
+	FAR;
+}
+
 public enum Gth.LoadAction {
 	OPEN,
 	OPEN_AS_ROOT,
@@ -0,0 +1,166 @@
+#include <config.h>
+#include <glib.h>
+#include "lib/gth-buffer-pool.h"
+
+// Smaller blocks are left to malloc, larger blocks are too rare to be
+// worth keeping.
+#define MIN_SIZE_LOG2 16
+#define MAX_SIZE_LOG2 28
+#define MIN_POOLED_SIZE ((gsize) 1 << MIN_SIZE_LOG2)
+#define MAX_POOLED_SIZE ((gsize) 1 << MAX_SIZE_LOG2)
+
+// Each power of two is split in SUBCLASSES size classes, this way a block
+// is at most 25% larger than requested.
+#define SUBCLASSES 4
+#define N_CLASSES ((MAX_SIZE_LOG2 - MIN_SIZE_LOG2) * SUBCLASSES)
+
+// Maximum size of the unused blocks.
+#define MAX_CACHED_SIZE ((gsize) 256 * 1024 * 1024)
+
+// Unused blocks are returned to the system after this time.
+#define MAX_UNUSED_SECONDS 5
+
+// Free blocks are linked using their own memory.
+typedef struct _FreeBlock FreeBlock;
+struct _FreeBlock {
+	FreeBlock *next;
+	gint64 release_time;
+};
+
+static GMutex pool_mutex;
+static FreeBlock *free_blocks[N_CLASSES];
+static gsize cached_size = 0;
+static guint trim_id = 0;
+
+// Returns -1 if blocks of this size are not pooled.
+static int get_size_class (gsize size, gsize *class_size) {
+	if ((size <= MIN_POOLED_SIZE) || (size > MAX_POOLED_SIZE)) {
+		return -1;
+	}
+	int size_log2 = g_bit_storage (size - 1) - 1;
+	gsize base = (gsize) 1 << size_log2;
+	gsize step = base / SUBCLASSES;
+	gsize n_steps = (size - base + step - 1) / step;
+	*class_size = base + (n_steps * step);
+	return ((size_log2 - MIN_SIZE_LOG2) * SUBCLASSES) + (int) (n_steps - 1);
+}
+
+static gsize get_class_size (int size_class) {
+	gsize base = (gsize) 1 << (MIN_SIZE_LOG2 + (size_class / SUBCLASSES));
+	return base + ((base / SUBCLASSES) * ((size_class % SUBCLASSES) + 1));
+}
+
+// Frees the blocks unused since min_release_time, the mutex must be locked.
+static void free_old_blocks (gint64 min_release_time) {
+	for (int i = 0; i < N_CLASSES; i++) {
+		FreeBlock **link = &free_blocks[i];
+		while (*link != NULL) {
+			FreeBlock *block = *link;
+			if (block->release_time <= min_release_time) {
+				*link = block->next;
+				cached_size -= get_class_size (i);
+				g_free (block);
+			}
+			else {
+				link = &block->next;
+			}
+		}
+	}
+}
+
+static gboolean trim_cb (gpointer user_data) {
+	g_mutex_lock (&pool_mutex);
+	free_old_blocks (g_get_monotonic_time () - (MAX_UNUSED_SECONDS * G_USEC_PER_SEC));
+	gboolean again = (cached_size > 0);
+	if (!again) {
+		trim_id = 0;
+	}
+	g_mutex_unlock (&pool_mutex);
+	return again ? G_SOURCE_CONTINUE : G_SOURCE_REMOVE;
+}
+
+gpointer gth_buffer_pool_alloc (gsize size) {
+	gsize class_size;
+	int size_class = get_size_class (size, &class_size);
+	if (size_class < 0) {
+		return g_malloc (size);
+	}
+
+	g_mutex_lock (&pool_mutex);
+	FreeBlock *block = free_blocks[size_class];
+	if (block != NULL) {
+		free_blocks[size_class] = block->next;
+		cached_size -= class_size;
+	}
+	g_mutex_unlock (&pool_mutex);
+
+	if (block == NULL) {
+		block = g_malloc (class_size);
+	}
+	return block;
+}
+
+// size must be the same value passed to gth_buffer_pool_alloc.
+void gth_buffer_pool_free (gpointer data, gsize size) {
+	if (data == NULL) {
+		return;
+	}
+
+	gsize class_size;
+	int size_class = get_size_class (size, &class_size);
+	if (size_class < 0) {
+		g_free (data);
+		return;
+	}
+
+	g_mutex_lock (&pool_mutex);
+	if (cached_size + class_size <= MAX_CACHED_SIZE) {
+		FreeBlock *block = data;
+		block->next = free_blocks[size_class];
+		block->release_time = g_get_monotonic_time ();
+		free_blocks[size_class] = block;
+		cached_size += class_size;
+		data = NULL;
+		if (trim_id == 0) {
+			trim_id = g_timeout_add_seconds (MAX_UNUSED_SECONDS, trim_cb, NULL);
+		}
+	}
+	g_mutex_unlock (&pool_mutex);
+
+	if (data != NULL) {
+		g_free (data);
+	}
+}
+
+typedef struct {
+	gpointer data;
+	gsize size;
+} BytesData;
+
+static void bytes_data_free (gpointer user_data) {
+	BytesData *bytes_data = user_data;
+	gth_buffer_pool_free (bytes_data->data, bytes_data->size);
+	g_free (bytes_data);
+}
+
+// Returns a GBytes of the given size, its memory is returned to the pool
+// when the last reference is released.
+GBytes * gth_buffer_pool_new_bytes (gsize size) {
+	BytesData *bytes_data = g_new (BytesData, 1);
+	bytes_data->data = gth_buffer_pool_alloc (size);
+	bytes_data->size = size;
+	return g_bytes_new_with_free_func (bytes_data->data, size, bytes_data_free, bytes_data);
+}
+
+void gth_buffer_pool_trim (void) {
+	g_mutex_lock (&pool_mutex);
+	free_old_blocks (G_MAXINT64);
+	g_mutex_unlock (&pool_mutex);
+}
+
+gsize gth_buffer_pool_get_cached_size (void) {
+	g_mutex_lock (&pool_mutex);
+	gsize size = cached_size;
+	g_mutex_unlock (&pool_mutex);
+	return size;
+}
@@ -0,0 +1,19 @@
+#ifndef GTH_BUFFER_POOL_H
+#define GTH_BUFFER_POOL_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+// A process-wide pool of large memory blocks recycled by size class, used
+// for pixel buffers to avoid returning them to malloc after each image.
+
+gpointer gth_buffer_pool_alloc (gsize size);
+void gth_buffer_pool_free (gpointer data, gsize size);
+GBytes * gth_buffer_pool_new_bytes (gsize size);
+void gth_buffer_pool_trim (void);
+gsize gth_buffer_pool_get_cached_size (void);
+
+G_END_DECLS
+
+#endif /* GTH_BUFFER_POOL_H */
@@ -0,0 +1,38 @@
+#include <config.h>
+#include <glib.h>
+#include "lib/gth-cpu.h"
+
+static GthCpuFeatures detected_features = GTH_CPU_FEATURE_NONE;
+static gint features_mask = GTH_CPU_FEATURE_ALL;
+
+static GthCpuFeatures detect_features (void) {
+	GthCpuFeatures features = GTH_CPU_FEATURE_NONE;
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	__builtin_cpu_init ();
+	if (__builtin_cpu_supports ("sse4.1")) {
+		features |= GTH_CPU_FEATURE_SSE4_1;
+	}
+	if (__builtin_cpu_supports ("avx2")) {
+		features |= GTH_CPU_FEATURE_AVX2;
+	}
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	features |= GTH_CPU_FEATURE_NEON;
+#endif
+	return features;
+}
+
+// Returns the vector instruction sets available at runtime.
+GthCpuFeatures gth_cpu_get_features (void) {
+	static gsize features_initialization = 0;
+	if (g_once_init_enter (&features_initialization)) {
+		detected_features = detect_features ();
+		g_once_init_leave (&features_initialization, 1);
+	}
+	return detected_features & (GthCpuFeatures) g_atomic_int_get (&features_mask);
+}
+
+// Restricts the features returned by gth_cpu_get_features, used to compare
+// the vector code with the scalar code.
+void gth_cpu_set_features_mask (GthCpuFeatures mask) {
+	g_atomic_int_set (&features_mask, (gint) mask);
+}
@@ -0,0 +1,21 @@
+#ifndef GTH_CPU_H
+#define GTH_CPU_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef enum {
+	GTH_CPU_FEATURE_NONE = 0,
+	GTH_CPU_FEATURE_SSE4_1 = 1 << 0,
+	GTH_CPU_FEATURE_AVX2 = 1 << 1,
+	GTH_CPU_FEATURE_NEON = 1 << 2,
+	GTH_CPU_FEATURE_ALL = 0xFF,
+} GthCpuFeatures;
+
+GthCpuFeatures gth_cpu_get_features (void);
+void gth_cpu_set_features_mask (GthCpuFeatures mask);
+
+G_END_DECLS
+
+#endif /* GTH_CPU_H */
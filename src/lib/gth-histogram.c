@@ -1,6 +1,7 @@
 #include <config.h>
 #include <glib.h>
 #include "lib/gth-histogram.h"
+#include "lib/gth-parallel.h"
 #include "lib/pixel.h"
 
 // Signals
@@ -81,82 +82,121 @@ static void gth_histogram_changed (GthHistogram *self) {
 	g_signal_emit (self, gth_histogram_signals[CHANGED], 0);
 }
 
-void gth_histogram_update (GthHistogram *self, GthImage *image) {
-	g_return_if_fail (GTH_IS_HISTOGRAM (self));
-
-	if (image == NULL) {
-		self->priv->n_channels = 0;
-		histogram_reset_values (self);
-		gth_histogram_changed (self);
-		return;
-	}
+// Minimum number of rows processed by a single thread.
+#define MIN_BAND_ROWS 64
 
+typedef struct {
+	guchar *pixels;
+	int rowstride;
+	int width;
 	gboolean has_alpha;
-	if (!gth_image_get_has_alpha (image, &has_alpha)) {
-		has_alpha = FALSE;
-	}
-	int rowstride, width, height;
-	guchar *line = gth_image_prepare_edit (image, &rowstride, &width, &height);
+	gboolean opaque;
+	int **values;
+	GMutex mutex;
+} UpdateData;
 
-	self->priv->n_pixels = width * height;
-	self->priv->n_channels = (has_alpha ? 4 : 3) + 1;
-	histogram_reset_values (self);
+// Each band is counted in its own bins, merged at the end.
+static void histogram_update_band (guint first_row, guint last_row, gpointer user_data) {
+	UpdateData *data = user_data;
+	int values[GTH_HISTOGRAM_N_CHANNELS][256];
+	memset (values, 0, sizeof (values));
 
-	int **values = self->priv->values;
-	int *values_max = self->priv->values_max;
-	guchar *min_value = self->priv->min_value;
-	guchar *max_value = self->priv->max_value;
+	guchar *line = data->pixels + (first_row * data->rowstride);
 	guchar *pixel;
 	guchar red, green, blue, alpha, value;
-	for (int i = 0; i < height; i++) {
+	for (guint i = first_row; i < last_row; i++) {
 		pixel = line;
-		for (int j = 0; j < width; j++) {
-			PIXEL_TO_RGBA (pixel, red, green, blue, alpha);
-
-			// Count values for each RGB channel
-
-			values[GTH_CHANNEL_RED][red] += 1;
-			values[GTH_CHANNEL_GREEN][green] += 1;
-			values[GTH_CHANNEL_BLUE][blue] += 1;
-			if (has_alpha) {
+		if (data->opaque) {
+			// No need to remove the alpha.
+			for (int j = 0; j < data->width; j++) {
+				red = pixel[PIXEL_RED];
+				green = pixel[PIXEL_GREEN];
+				blue = pixel[PIXEL_BLUE];
+				value = MAX (MAX (red, green), blue);
+				values[GTH_CHANNEL_RED][red] += 1;
+				values[GTH_CHANNEL_GREEN][green] += 1;
+				values[GTH_CHANNEL_BLUE][blue] += 1;
+				values[GTH_CHANNEL_VALUE][value] += 1;
+				pixel += 4;
+			}
+		}
+		else {
+			for (int j = 0; j < data->width; j++) {
+				alpha = pixel[PIXEL_ALPHA];
+				if (alpha == 0xFF) {
+					red = pixel[PIXEL_RED];
+					green = pixel[PIXEL_GREEN];
+					blue = pixel[PIXEL_BLUE];
+				}
+				else {
+					PIXEL_TO_RGBA (pixel, red, green, blue, alpha);
+				}
+				value = MAX (MAX (red, green), blue);
+				values[GTH_CHANNEL_RED][red] += 1;
+				values[GTH_CHANNEL_GREEN][green] += 1;
+				values[GTH_CHANNEL_BLUE][blue] += 1;
 				values[GTH_CHANNEL_ALPHA][alpha] += 1;
+				values[GTH_CHANNEL_VALUE][value] += 1;
+				pixel += 4;
 			}
+		}
+		line += data->rowstride;
+	}
 
-			// Count value for the Value channel
+	int last_channel = data->has_alpha ? GTH_CHANNEL_ALPHA : GTH_CHANNEL_BLUE;
+	g_mutex_lock (&data->mutex);
+	for (int c = GTH_CHANNEL_VALUE; c <= last_channel; c++) {
+		for (int v = 0; v < 256; v++) {
+			data->values[c][v] += values[c][v];
+		}
+	}
+	g_mutex_unlock (&data->mutex);
+}
 
-			value = MAX (MAX (red, green), blue);
-			values[GTH_CHANNEL_VALUE][value] += 1;
+void gth_histogram_update (GthHistogram *self, GthImage *image) {
+	g_return_if_fail (GTH_IS_HISTOGRAM (self));
 
-			// Min and max pixel values
+	if (image == NULL) {
+		self->priv->n_channels = 0;
+		histogram_reset_values (self);
+		gth_histogram_changed (self);
+		return;
+	}
 
-			min_value[GTH_CHANNEL_VALUE] = MIN (min_value[GTH_CHANNEL_VALUE], value);
-			min_value[GTH_CHANNEL_RED] = MIN (min_value[GTH_CHANNEL_RED], red);
-			min_value[GTH_CHANNEL_GREEN] = MIN (min_value[GTH_CHANNEL_GREEN], green);
-			min_value[GTH_CHANNEL_BLUE] = MIN (min_value[GTH_CHANNEL_BLUE], blue);
-			if (has_alpha) {
-				min_value[GTH_CHANNEL_ALPHA] = MIN (min_value[GTH_CHANNEL_ALPHA], alpha);
-			}
+	UpdateData data;
+	int height;
+	gboolean has_alpha_is_valid = gth_image_get_has_alpha (image, &data.has_alpha);
+	data.opaque = has_alpha_is_valid && !data.has_alpha;
+	data.pixels = gth_image_prepare_edit (image, &data.rowstride, &data.width, &height);
+	data.values = self->priv->values;
+	g_mutex_init (&data.mutex);
 
-			max_value[GTH_CHANNEL_VALUE] = MAX (max_value[GTH_CHANNEL_VALUE], value);
-			max_value[GTH_CHANNEL_RED] = MAX (max_value[GTH_CHANNEL_RED], red);
-			max_value[GTH_CHANNEL_GREEN] = MAX (max_value[GTH_CHANNEL_GREEN], green);
-			max_value[GTH_CHANNEL_BLUE] = MAX (max_value[GTH_CHANNEL_BLUE], blue);
-			if (has_alpha) {
-				max_value[GTH_CHANNEL_ALPHA] = MAX (max_value[GTH_CHANNEL_ALPHA], alpha);
-			}
+	self->priv->n_pixels = data.width * height;
+	self->priv->n_channels = (data.has_alpha ? 4 : 3) + 1;
+	histogram_reset_values (self);
 
-			// Track min and max value for each channel
+	gth_parallel_for (height, MIN_BAND_ROWS, histogram_update_band, &data);
+	g_mutex_clear (&data.mutex);
 
-			values_max[GTH_CHANNEL_VALUE] = MAX (values_max[GTH_CHANNEL_VALUE], values[GTH_CHANNEL_VALUE][value]);
-			values_max[GTH_CHANNEL_RED] = MAX (values_max[GTH_CHANNEL_RED], values[GTH_CHANNEL_RED][red]);
-			values_max[GTH_CHANNEL_GREEN] = MAX (values_max[GTH_CHANNEL_GREEN], values[GTH_CHANNEL_GREEN][green]);
-			values_max[GTH_CHANNEL_BLUE] = MAX (values_max[GTH_CHANNEL_BLUE], values[GTH_CHANNEL_BLUE][blue]);
-			if (has_alpha) {
-				values_max[GTH_CHANNEL_ALPHA] = MAX (values_max[GTH_CHANNEL_ALPHA], values[GTH_CHANNEL_ALPHA][alpha]);
+	// Min and max values, and max count for each channel.
+
+	for (int c = 0; c < self->priv->n_channels; c++) {
+		int *values = self->priv->values[c];
+		int min = -1;
+		int max = -1;
+		int values_max = 0;
+		for (int v = 0; v < 256; v++) {
+			if (values[v] > 0) {
+				if (min < 0) {
+					min = v;
+				}
+				max = v;
 			}
-			pixel += 4;
+			values_max = MAX (values_max, values[v]);
 		}
-		line += rowstride;
+		self->priv->min_value[c] = (min >= 0) ? min : 0;
+		self->priv->max_value[c] = (max >= 0) ? max : 0;
+		self->priv->values_max[c] = values_max;
 	}
 
 	gth_histogram_changed (self);
@@ -1,6 +1,7 @@
 #include <config.h>
 #include <math.h>
 #include "lib/gth-image.h"
+#include "lib/gth-parallel.h"
 #include "lib/lib.h"
 
 GthImage * gth_image_gaussian_blur (GthImage *source, int radius, GCancellable *cancellable) {
@@ -315,25 +316,42 @@ gboolean gth_image_progressive_blur (GthImage *source, int max_radius, GCancella
 	return completed;
 }
 
-static gboolean _box_blur (GthImage *source, GthImage *destination, int radius,
-	guchar *div_kernel_size, GCancellable *cancellable)
-{
-	int src_rowstride, width, height;
-	guchar *p_src = gth_image_prepare_edit (source, &src_rowstride, &width, &height);
+// Number of adjacent columns processed together by the vertical pass of the
+// box blur: a strip row is 256 bytes, small enough to keep the rows around
+// the kernel in cache.
+#define BOX_BLUR_STRIP_WIDTH 64
 
-	int dest_rowstride;
-	guchar *p_dest = gth_image_prepare_edit (destination, &dest_rowstride, NULL, NULL);
+// Minimum number of rows processed by a single thread.
+#define BOX_BLUR_MIN_BAND_ROWS 16
 
+typedef struct {
+	guchar *p_src;
+	int src_rowstride;
+	guchar *p_dest;
+	int dest_rowstride;
+	int width;
+	int height;
+	int radius;
+	guchar *div_kernel_size;
+	GCancellable *cancellable;
+} BoxBlurData;
+
+static void _box_blur_horizontal_band (guint first_row, guint last_row, gpointer user_data) {
+	BoxBlurData *data = user_data;
+	guchar *p_src = data->p_src + (first_row * data->src_rowstride);
+	guchar *p_dest = data->p_dest + (first_row * data->dest_rowstride);
+	guchar *div_kernel_size = data->div_kernel_size;
+	int radius = data->radius;
 	int radius_plus_1 = radius + 1;
+	int width = data->width;
+	int width_minus_1 = width - 1;
 	int ri, gi, bi, ai;
 	guchar *c1, *c2;
 	int x, y, i, i1, i2;
 	guchar r, g, b, a;
-	// Horizontal blur
-
-	int width_minus_1 = width - 1;
 	guchar *p_dest_row;
-	for (y = 0; y < height; y++) {
+
+	for (y = first_row; y < last_row; y++) {
 		// Calculate the initial sums of the kernel.
 
 		ri = gi = bi = ai = 0;
@@ -385,43 +403,58 @@ static gboolean _box_blur (GthImage *source, GthImage *destination, int radius,
 			ai -= a;
 		}
 
-		p_src += src_rowstride;
-		p_dest += dest_rowstride;
+		p_src += data->src_rowstride;
+		p_dest += data->dest_rowstride;
 
-		if ((cancellable != NULL) && g_cancellable_is_cancelled (cancellable)) {
-			return FALSE;
+		if ((data->cancellable != NULL) && g_cancellable_is_cancelled (data->cancellable)) {
+			break;
 		}
 	}
+}
 
-	// Vertical blur
+// The vertical pass processes a strip of adjacent columns at a time, keeping
+// the sums of the kernel of every column in a small array, so that the image
+// is read by rows instead of by columns.
+static void _box_blur_vertical_strips (guint first_strip, guint last_strip, gpointer user_data) {
+	BoxBlurData *data = user_data;
+	guchar *div_kernel_size = data->div_kernel_size;
+	int src_rowstride = data->src_rowstride;
+	int dest_rowstride = data->dest_rowstride;
+	int radius = data->radius;
+	int radius_plus_1 = radius + 1;
+	int height_minus_1 = data->height - 1;
+	int sums[BOX_BLUR_STRIP_WIDTH * 4];
+	int *sum;
+	guchar *c1, *c2;
+	int x, y, i, i1, i2;
+	guchar r, g, b, a;
 
-	p_src = gth_image_prepare_edit (destination, &src_rowstride, NULL, NULL);
-	p_dest = gth_image_prepare_edit (source, &dest_rowstride, NULL, NULL);
+	for (guint strip = first_strip; strip < last_strip; strip++) {
+		int first_column = strip * BOX_BLUR_STRIP_WIDTH;
+		int columns = MIN (BOX_BLUR_STRIP_WIDTH, data->width - first_column);
+		guchar *p_src = data->p_src + (first_column * 4);
+		guchar *p_dest = data->p_dest + (first_column * 4);
 
-	int height_minus_1 = height - 1;
-	guchar *p_dest_col;
-	for (x = 0; x < width; x++) {
 		// Calculate the initial sums of the kernel
 
-		ri = gi = bi = ai = 0;
-
+		memset (sums, 0, sizeof (int) * 4 * columns);
 		for (i = -radius; i <= radius; i++) {
 			c1 = p_src + (CLAMP (i, 0, height_minus_1) * src_rowstride);
-			PIXEL_TO_RGBA (c1, r, g, b, a);
-			ri += r;
-			gi += g;
-			bi += b;
-			ai += a;
+			sum = sums;
+			for (x = 0; x < columns; x++) {
+				PIXEL_TO_RGBA (c1, r, g, b, a);
+				sum[0] += r;
+				sum[1] += g;
+				sum[2] += b;
+				sum[3] += a;
+				sum += 4;
+				c1 += 4;
+			}
 		}
 
-		p_dest_col = p_dest;
-		for (y = 0; y < height; y++) {
-			// Set as the mean of the kernel
-
-			RGBA_TO_PIXEL (p_dest_col, div_kernel_size[ri], div_kernel_size[gi], div_kernel_size[bi], div_kernel_size[ai]);
-			p_dest_col += dest_rowstride;
-
-			// The pixel to add to the kernel.
+		guchar *p_dest_row = p_dest;
+		for (y = 0; y <= height_minus_1; y++) {
+			// The row to add to the kernel.
 
 			i1 = y + radius_plus_1;
 			if (i1 > height_minus_1) {
@@ -429,7 +462,7 @@ static gboolean _box_blur (GthImage *source, GthImage *destination, int radius,
 			}
 			c1 = p_src + (i1 * src_rowstride);
 
-			// The pixel to remove from the kernel.
+			// The row to remove from the kernel.
 
 			i2 = y - radius;
 			if (i2 < 0) {
@@ -437,28 +470,69 @@ static gboolean _box_blur (GthImage *source, GthImage *destination, int radius,
 			}
 			c2 = p_src + (i2 * src_rowstride);
 
-			// Calculate the new sums of the kernel.
+			guchar *p_dest_pixel = p_dest_row;
+			sum = sums;
+			for (x = 0; x < columns; x++) {
+				// Set as the mean of the kernel
 
-			PIXEL_TO_RGBA (c1, r, g, b, a);
-			ri += r;
-			gi += g;
-			bi += b;
-			ai += a;
+				RGBA_TO_PIXEL (p_dest_pixel, div_kernel_size[sum[0]], div_kernel_size[sum[1]], div_kernel_size[sum[2]], div_kernel_size[sum[3]]);
+				p_dest_pixel += 4;
 
-			PIXEL_TO_RGBA (c2, r, g, b, a);
-			ri -= r;
-			gi -= g;
-			bi -= b;
-			ai -= a;
-		}
+				// Calculate the new sums of the kernel.
 
-		p_src += 4;
-		p_dest += 4;
+				PIXEL_TO_RGBA (c1, r, g, b, a);
+				sum[0] += r;
+				sum[1] += g;
+				sum[2] += b;
+				sum[3] += a;
 
-		if ((cancellable != NULL) && g_cancellable_is_cancelled (cancellable)) {
-			return FALSE;
+				PIXEL_TO_RGBA (c2, r, g, b, a);
+				sum[0] -= r;
+				sum[1] -= g;
+				sum[2] -= b;
+				sum[3] -= a;
+
+				sum += 4;
+				c1 += 4;
+				c2 += 4;
+			}
+			p_dest_row += dest_rowstride;
+		}
+
+		if ((data->cancellable != NULL) && g_cancellable_is_cancelled (data->cancellable)) {
+			break;
 		}
 	}
+}
+
+static gboolean _box_blur (GthImage *source, GthImage *destination, int radius,
+	guchar *div_kernel_size, GCancellable *cancellable)
+{
+	BoxBlurData data;
+	data.radius = radius;
+	data.div_kernel_size = div_kernel_size;
+	data.cancellable = cancellable;
+
+	// Horizontal blur
+
+	data.p_src = gth_image_prepare_edit (source, &data.src_rowstride, &data.width, &data.height);
+	data.p_dest = gth_image_prepare_edit (destination, &data.dest_rowstride, NULL, NULL);
+	gth_parallel_for (data.height, BOX_BLUR_MIN_BAND_ROWS, _box_blur_horizontal_band, &data);
+
+	if ((cancellable != NULL) && g_cancellable_is_cancelled (cancellable)) {
+		return FALSE;
+	}
+
+	// Vertical blur
+
+	data.p_src = gth_image_prepare_edit (destination, &data.src_rowstride, NULL, NULL);
+	data.p_dest = gth_image_prepare_edit (source, &data.dest_rowstride, NULL, NULL);
+	guint n_strips = (data.width + BOX_BLUR_STRIP_WIDTH - 1) / BOX_BLUR_STRIP_WIDTH;
+	gth_parallel_for (n_strips, 1, _box_blur_vertical_strips, &data);
+
+	if ((cancellable != NULL) && g_cancellable_is_cancelled (cancellable)) {
+		return FALSE;
+	}
 
 	return TRUE;
 }
@@ -3,6 +3,7 @@
 #include "lib/gth-curve.h"
 #include "lib/gth-histogram.h"
 #include "lib/gth-image.h"
+#include "lib/gth-pixel-ops.h"
 #include "lib/gth-point.h"
 #include "lib/types.h"
 #include "lib/util.h"
@@ -206,208 +207,50 @@ void gth_image_render_frame (GthImage *canvas, GthImage *background,
 
 #undef RENDER_BLEND
 
-gboolean gth_image_grayscale (GthImage *self, double red_weight, double green_weight, double blue_weight, double amount, GCancellable *cancellable) {
-	if (amount < 0) {
-		amount = tan (amount) * G_PI;
-	}
-	// g_print ("> amount: %f\n", amount);
-	int row_stride;
-	int width;
-	int height;
-	guchar *row = gth_image_prepare_edit (self, &row_stride, &width, &height);
-	guchar *pixel;
-	guchar red, green, blue, alpha;
-	int value, itemp;
-	for (guint y = 0; y < height; y++) {
-		pixel = row;
-		for (guint x = 0; x < width; x++) {
-			PIXEL_TO_RGBA (pixel, red, green, blue, alpha);
-			value = (red_weight * red) + (green_weight * green) + (blue_weight * blue);
-
-			itemp = INTERPOLATE (red, value, amount);
-			red = CLAMP (itemp, 0, 255);
-
-			itemp = INTERPOLATE (green, value, amount);
-			green = CLAMP (itemp, 0, 255);
-
-			itemp = INTERPOLATE (blue, value, amount);
-			blue = CLAMP (itemp, 0, 255);
+// Runs a pipeline with a single operation.
+static gboolean apply_single_op (GthImage *self, GthPixelOps *ops, GCancellable *cancellable) {
+	gboolean completed = gth_image_apply_pixel_ops (self, ops, cancellable);
+	gth_pixel_ops_unref (ops);
+	return completed;
+}
 
-			RGBA_TO_PIXEL (pixel, red, green, blue, alpha);
-			pixel += 4;
-		}
-		row += row_stride;
-		if ((cancellable != NULL) && g_cancellable_is_cancelled (cancellable)) {
-			return FALSE;
-		}
-	}
-	return TRUE;
+gboolean gth_image_grayscale (GthImage *self, double red_weight, double green_weight, double blue_weight, double amount, GCancellable *cancellable) {
+	GthPixelOps *ops = gth_pixel_ops_new ();
+	gth_pixel_ops_add_grayscale (ops, red_weight, green_weight, blue_weight, amount);
+	return apply_single_op (self, ops, cancellable);
 }
 
 gboolean gth_image_grayscale_saturation (GthImage *self, double amount, GCancellable *cancellable) {
-	if (amount < 0) {
-		amount = tan (amount) * G_PI;
-	}
-	// g_print ("> amount: %f\n", amount);
-	int row_stride;
-	int width;
-	int height;
-	guchar *row = gth_image_prepare_edit (self, &row_stride, &width, &height);
-	guchar *pixel;
-	guchar red, green, blue, alpha, min, max;
-	int value, itemp;
-	for (int y = 0; y < height; y++) {
-		pixel = row;
-		for (int x = 0; x < width; x++) {
-			PIXEL_TO_RGBA (pixel, red, green, blue, alpha);
-			max = MAX (MAX (red, green), blue);
-			min = MIN (MIN (red, green), blue);
-			value = (max + min) / 2;
-
-			itemp = INTERPOLATE (red, value, amount);
-			red = CLAMP (itemp, 0, 255);
-
-			itemp = INTERPOLATE (green, value, amount);
-			green = CLAMP (itemp, 0, 255);
-
-			itemp = INTERPOLATE (blue, value, amount);
-			blue = CLAMP (itemp, 0, 255);
-
-			RGBA_TO_PIXEL (pixel, red, green, blue, alpha);
-			pixel += 4;
-		}
-		row += row_stride;
-		if ((cancellable != NULL) && g_cancellable_is_cancelled (cancellable)) {
-			return FALSE;
-		}
-	}
-	return TRUE;
+	GthPixelOps *ops = gth_pixel_ops_new ();
+	gth_pixel_ops_add_grayscale_saturation (ops, amount);
+	return apply_single_op (self, ops, cancellable);
 }
 
 gboolean gth_image_gamma_correction (GthImage *self, double gamma, GCancellable *cancellable) {
 	if (gamma == 1.0) {
 		return TRUE;
 	}
-	// g_print ("> gamma: %f\n", gamma);
-	int row_stride;
-	int width;
-	int height;
-	guchar *row = gth_image_prepare_edit (self, &row_stride, &width, &height);
-	guchar *pixel;
-	guchar red, green, blue, alpha;
-	double value;
-	for (int y = 0; y < height; y++) {
-		pixel = row;
-		for (int x = 0; x < width; x++) {
-			PIXEL_TO_RGBA (pixel, red, green, blue, alpha);
-
-			value = 255.0 * pow (((double) red / 255.0), gamma);
-			red = CLAMP (value, 0, 255);
-
-			value = 255.0 * pow (((double) green / 255.0), gamma);
-			green = CLAMP (value, 0, 255);
-
-			value = 255.0 * pow (((double) blue / 255.0), gamma);
-			blue = CLAMP (value, 0, 255);
-
-			RGBA_TO_PIXEL (pixel, red, green, blue, alpha);
-			pixel += 4;
-		}
-		row += row_stride;
-		if ((cancellable != NULL) && g_cancellable_is_cancelled (cancellable)) {
-			return FALSE;
-		}
-	}
-	return TRUE;
+	GthPixelOps *ops = gth_pixel_ops_new ();
+	gth_pixel_ops_add_gamma_correction (ops, gamma);
+	return apply_single_op (self, ops, cancellable);
 }
 
 gboolean gth_image_adjust_brightness (GthImage *self, double amount, GCancellable *cancellable) {
 	if (amount == 0) {
 		return TRUE;
 	}
-	// g_print ("> amount: %f\n", amount);
-	int row_stride;
-	int width;
-	int height;
-	guchar *row = gth_image_prepare_edit (self, &row_stride, &width, &height);
-	guchar *pixel;
-	guchar red, green, blue, alpha;
-	double dtemp;
-	for (int y = 0; y < height; y++) {
-		pixel = row;
-		for (int x = 0; x < width; x++) {
-			PIXEL_TO_RGBA (pixel, red, green, blue, alpha);
-
-			if (amount > 0) {
-				dtemp = INTERPOLATE (red, 0.0, amount);
-				red = CLAMP (dtemp, 0, 255);
-
-				dtemp = INTERPOLATE (green, 0.0, amount);
-				green = CLAMP (dtemp, 0, 255);
-
-				dtemp = INTERPOLATE (blue, 0.0, amount);
-				blue = CLAMP (dtemp, 0, 255);
-			}
-			else {
-				dtemp = INTERPOLATE (red, 255.0, -amount);
-				red = CLAMP (dtemp, 0, 255);
-
-				dtemp = INTERPOLATE (green, 255.0, -amount);
-				green = CLAMP (dtemp, 0, 255);
-
-				dtemp = INTERPOLATE (blue, 255.0, -amount);
-				blue = CLAMP (dtemp, 0, 255);
-			}
-
-			RGBA_TO_PIXEL (pixel, red, green, blue, alpha);
-			pixel += 4;
-		}
-		row += row_stride;
-		if ((cancellable != NULL) && g_cancellable_is_cancelled (cancellable)) {
-			return FALSE;
-		}
-	}
-	return TRUE;
+	GthPixelOps *ops = gth_pixel_ops_new ();
+	gth_pixel_ops_add_brightness (ops, amount);
+	return apply_single_op (self, ops, cancellable);
 }
 
 gboolean gth_image_adjust_contrast (GthImage *self, double amount, GCancellable *cancellable) {
 	if (amount == 0) {
 		return TRUE;
 	}
-	if (amount < 0) {
-		amount = tan (amount * G_PI_2);
-	}
-	// g_print ("> amount: %f\n", amount);
-	int row_stride;
-	int width;
-	int height;
-	guchar *row = gth_image_prepare_edit (self, &row_stride, &width, &height);
-	guchar *pixel;
-	guchar red, green, blue, alpha;
-	double dtemp;
-	for (int y = 0; y < height; y++) {
-		pixel = row;
-		for (int x = 0; x < width; x++) {
-			PIXEL_TO_RGBA (pixel, red, green, blue, alpha);
-
-			dtemp = INTERPOLATE (red, 127.0, amount);
-			red = CLAMP (dtemp, 0, 255);
-
-			dtemp = INTERPOLATE (green, 127.0, amount);
-			green = CLAMP (dtemp, 0, 255);
-
-			dtemp = INTERPOLATE (blue, 127.0, amount);
-			blue = CLAMP (dtemp, 0, 255);
-
-			RGBA_TO_PIXEL (pixel, red, green, blue, alpha);
-			pixel += 4;
-		}
-		row += row_stride;
-		if ((cancellable != NULL) && g_cancellable_is_cancelled (cancellable)) {
-			return FALSE;
-		}
-	}
-	return TRUE;
+	GthPixelOps *ops = gth_pixel_ops_new ();
+	gth_pixel_ops_add_contrast (ops, amount);
+	return apply_single_op (self, ops, cancellable);
 }
 
 void calc_radial_mask (guint width, guint height, double amount, GthPoint *f1, GthPoint *f2, double *min_d, double *max_d) {
@@ -623,31 +466,9 @@ gboolean gth_image_apply_radial_mask (GthImage *background, GthImage *foreground
 }
 
 gboolean gth_image_apply_value_map (GthImage *self, guchar *value_map, GCancellable *cancellable) {
-	int row_stride;
-	int width;
-	int height;
-	guchar *row = gth_image_prepare_edit (self, &row_stride, &width, &height);
-	guchar *pixel;
-	guchar red, green, blue, alpha;
-	guchar *red_map = value_map + (GTH_CHANNEL_RED * VALUE_MAP_COLUMNS);
-	guchar *green_map = value_map + (GTH_CHANNEL_GREEN * VALUE_MAP_COLUMNS);
-	guchar *blue_map = value_map + (GTH_CHANNEL_BLUE * VALUE_MAP_COLUMNS);
-	for (int y = 0; y < height; y++) {
-		pixel = row;
-		for (int x = 0; x < width; x++) {
-			PIXEL_TO_RGBA (pixel, red, green, blue, alpha);
-			red = red_map[red];
-			green = green_map[green];
-			blue = blue_map[blue];
-			RGBA_TO_PIXEL (pixel, red, green, blue, alpha);
-			pixel += 4;
-		}
-		row += row_stride;
-		if ((cancellable != NULL) && (g_cancellable_is_cancelled (cancellable))) {
-			return FALSE;
-		}
-	}
-	return TRUE;
+	GthPixelOps *ops = gth_pixel_ops_new ();
+	gth_pixel_ops_add_value_map (ops, value_map);
+	return apply_single_op (self, ops, cancellable);
 }
 
 gboolean gth_image_apply_curve (GthImage *self, GthPoints *points, GCancellable *cancellable)
@@ -655,32 +476,15 @@ gboolean gth_image_apply_curve (GthImage *self, GthPoints *points, GCancellable
 	if (points == NULL) {
 		return TRUE;
 	}
-	guchar *value_map = gth_points_get_value_map (points, NULL);
-	gboolean completed = gth_image_apply_value_map (self, value_map, cancellable);
-	g_free (value_map);
-	return completed;
+	GthPixelOps *ops = gth_pixel_ops_new ();
+	gth_pixel_ops_add_curve (ops, points);
+	return apply_single_op (self, ops, cancellable);
 }
 
 gboolean gth_image_colorize (GthImage *self, double red_amount, double green_amount, double blue_amount, GCancellable *cancellable) {
-	GthPoint lighter_point = { 127, 127 };
-	GthPoint darker_point = { 82, 187 };
-	GthPoint middle_point;
-
-	gth_point_init_interpolate (&middle_point, &lighter_point, &darker_point, red_amount);
-	GthPoint red_points[] = { { 0, 0 }, middle_point, { 255, 255 } };
-
-	gth_point_init_interpolate (&middle_point, &lighter_point, &darker_point, green_amount);
-	GthPoint green_points[] = { { 0, 0 }, middle_point, { 255, 255 } };
-
-	gth_point_init_interpolate (&middle_point, &lighter_point, &darker_point, blue_amount);
-	GthPoint blue_points[] = { { 0, 0 }, middle_point, { 255, 255 } };
-
-	GthPoints points;
-	gth_points_init (&points, NULL, 0,
-		red_points, (red_amount > 0) ? 3 : 0,
-		green_points, (green_amount > 0) ? 3 : 0,
-		blue_points, (blue_amount > 0) ? 3 : 0);
-	return gth_image_apply_curve (self, &points, cancellable);
+	GthPixelOps *ops = gth_pixel_ops_new ();
+	gth_pixel_ops_add_colorize (ops, red_amount, green_amount, blue_amount);
+	return apply_single_op (self, ops, cancellable);
 }
 
 gboolean gth_image_soft_light_with_radial_gradient (GthImage *self, GCancellable *cancellable) {
@@ -2,6 +2,15 @@
 #include <math.h>
 #include "lib/gth-image.h"
 #include "lib/gfixed.h"
+#include "lib/gth-cpu.h"
+#include "lib/gth-parallel.h"
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_KERNELS 1
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define HAVE_NEON_KERNELS 1
+#include <arm_neon.h>
+#endif
 #include "lib/types.h"
 
 
@@ -9,6 +18,10 @@ typedef double ScaleReal;
 typedef ScaleReal (*WeightFunc) (ScaleReal distance);
 
 
+// Minimum number of rows processed by a single thread.
+#define MIN_BAND_ROWS 16
+
+
 // gth_image_resize_if_larger
 // Based on code from ImageMagick/magick/resize.c
 
@@ -183,42 +196,54 @@ filter_get_weight (Filter *filter,
 }
 
 
-static void
-horizontal_scale_and_transpose (GthImage *image,
-				GthImage *scaled,
-				ScaleReal scale_factor,
-				Filter *filter,
-				GCancellable *cancellable)
-{
-	if (filter->cancelled) {
-		return;
-	}
+// Contributions
+
 
+// The source pixels that contribute to a destination pixel, and their
+// weights as 16.16 fixed point values.  The weights only depend on the
+// scale factor, so they are computed once for every destination index and
+// used for all the rows.
+typedef struct {
+	int start;
+	int n;
+	gint32 *weights;
+} Contribution;
+
+
+typedef struct {
+	Contribution *contributions;
+	gint32 *weights;
+} ContributionTable;
+
+
+static ContributionTable *
+contribution_table_new (Filter		*filter,
+			ScaleReal	 scale_factor,
+			int		 source_size,
+			int		 destination_size)
+{
 	ScaleReal scale = MAX ((ScaleReal) 1.0 / scale_factor, 1.0);
 	ScaleReal support = scale * filter_get_support (filter);
 	if (support < 0.5) {
 		support = 0.5;
 		scale = 1.0;
 	}
+	scale = 1.0 / scale;
 
-	int src_rowstride, image_width;
-	guchar *p_src = gth_image_prepare_edit (image, &src_rowstride, &image_width, NULL);
-
-	int dest_rowstride, scaled_width, scaled_height;
-	guchar *p_dest = gth_image_prepare_edit (scaled, &dest_rowstride, &scaled_width, &scaled_height);
-
-	ScaleReal *weights = g_new (ScaleReal, 2.0 * support + 3.0);
+	int max_taps = (int) (2.0 * support + 3.0);
+	ContributionTable *table = g_new (ContributionTable, 1);
+	table->contributions = g_new (Contribution, destination_size);
+	table->weights = g_new (gint32, (gsize) max_taps * destination_size);
 
-	int x, y, i, n, temp;
-	ScaleReal r, g, b, a, w;
+	ScaleReal *weights = g_new (ScaleReal, max_taps);
+	int i, n;
 
-	scale = 1.0 / scale;
-	for (y = 0; y < scaled_height; y++) {
+	for (int y = 0; y < destination_size; y++) {
 		ScaleReal bisect = ((ScaleReal) y + 0.5) / scale_factor;
 		int start = bisect - support + 0.5;
 		start = MAX (start, 0);
 		int stop = bisect + support + 0.5;
-		stop = MIN (stop, image_width);
+		stop = MIN (stop, source_size);
 
 		ScaleReal density = 0.0;
 		for (n = 0; n < stop - start; n++) {
@@ -236,44 +261,337 @@ horizontal_scale_and_transpose (GthImage *image,
 			}
 		}
 
-		guchar *p_src_row = p_src + (start * 4);
-		guchar *p_dest_pixel = p_dest;
+		Contribution *contribution = table->contributions + y;
+		contribution->start = start;
+		contribution->n = n;
+		contribution->weights = table->weights + ((gsize) y * max_taps);
+
+		// Convert to fixed point, the rounding error is assigned to the
+		// largest weight to keep the sum equal to 1.
+
+		gint32 sum = 0;
+		int max_idx = 0;
+		for (i = 0; i < n; i++) {
+			contribution->weights[i] = (gint32) lround (weights[i] * GFIXED_1);
+			sum += contribution->weights[i];
+			if (contribution->weights[i] > contribution->weights[max_idx]) {
+				max_idx = i;
+			}
+		}
+		if ((n > 0) && (density != 0.0)) {
+			contribution->weights[max_idx] += GFIXED_1 - sum;
+		}
+	}
 
-		for (x = 0; x < scaled_width; x++) {
-			guchar *p_src_pixel;
+	g_free (weights);
 
-			p_src_pixel = p_src_row;
+	return table;
+}
 
-			r = g = b = a = 0.0;
-			for (i = 0; i < n; i++) {
-				w = weights[i];
 
-				r += w * p_src_pixel[PIXEL_RED];
-				g += w * p_src_pixel[PIXEL_GREEN];
-				b += w * p_src_pixel[PIXEL_BLUE];
-				a += w * p_src_pixel[PIXEL_ALPHA];
+static void
+contribution_table_free (ContributionTable *table)
+{
+	g_free (table->weights);
+	g_free (table->contributions);
+	g_free (table);
+}
 
-				p_src_pixel += 4;
-			}
 
-			p_dest_pixel[PIXEL_RED] = PIXEL_CLAMP (r + 0.5);
-			p_dest_pixel[PIXEL_GREEN] = PIXEL_CLAMP (g + 0.5);
-			p_dest_pixel[PIXEL_BLUE] = PIXEL_CLAMP (b + 0.5);
-			p_dest_pixel[PIXEL_ALPHA] = PIXEL_CLAMP (a + 0.5);
+// Row kernels
+//
+// Compute a destination row: the i-th destination pixel is the weighted sum
+// of the n pixels starting at p_src_row + i * src_rowstride.  The vector
+// kernels process 4 source pixels per iteration and produce the same result
+// of the scalar kernel.
+
+
+typedef void (*ScaleRowFunc) (const guchar *p_src_row, int src_rowstride,
+			      guchar *p_dest_pixel, int width,
+			      const gint32 *weights, int n);
+
+
+static void
+scale_row_scalar (const guchar	*p_src_row,
+		  int		 src_rowstride,
+		  guchar	*p_dest_pixel,
+		  int		 width,
+		  const gint32	*weights,
+		  int		 n)
+{
+	int x, i, temp;
+	gint32 r, g, b, a, w;
+
+	for (x = 0; x < width; x++) {
+		const guchar *p_src_pixel;
+
+		p_src_pixel = p_src_row;
+
+		r = g = b = a = 0;
+		for (i = 0; i < n; i++) {
+			w = weights[i];
+
+			r += w * p_src_pixel[PIXEL_RED];
+			g += w * p_src_pixel[PIXEL_GREEN];
+			b += w * p_src_pixel[PIXEL_BLUE];
+			a += w * p_src_pixel[PIXEL_ALPHA];
 
-			p_dest_pixel += 4;
-			p_src_row += src_rowstride;
+			p_src_pixel += 4;
 		}
 
-		p_dest += dest_rowstride;
-		if ((cancellable != NULL) && g_cancellable_is_cancelled (cancellable)) {
-			filter->cancelled = TRUE;
-			goto out;
+		p_dest_pixel[PIXEL_RED] = PIXEL_CLAMP (GFIXED_ROUND_TO_INT (r));
+		p_dest_pixel[PIXEL_GREEN] = PIXEL_CLAMP (GFIXED_ROUND_TO_INT (g));
+		p_dest_pixel[PIXEL_BLUE] = PIXEL_CLAMP (GFIXED_ROUND_TO_INT (b));
+		p_dest_pixel[PIXEL_ALPHA] = PIXEL_CLAMP (GFIXED_ROUND_TO_INT (a));
+
+		p_dest_pixel += 4;
+		p_src_row += src_rowstride;
+	}
+}
+
+
+#ifdef HAVE_X86_KERNELS
+
+
+// The channels are kept in memory order, one 32 bit lane per channel.
+
+
+__attribute__((target("sse4.1")))
+static inline __m128i
+load_pixel_sse41 (const guchar *p_pixel)
+{
+	gint32 pixel;
+	memcpy (&pixel, p_pixel, 4);
+	return _mm_cvtepu8_epi32 (_mm_cvtsi32_si128 (pixel));
+}
+
+
+__attribute__((target("sse4.1")))
+static inline void
+store_pixel_sse41 (guchar *p_pixel,
+		   __m128i sum)
+{
+	// Same as PIXEL_CLAMP (GFIXED_ROUND_TO_INT (sum)) for each channel.
+	sum = _mm_srai_epi32 (_mm_add_epi32 (sum, _mm_set1_epi32 (1 << 15)), 16);
+	sum = _mm_packs_epi32 (sum, sum);
+	sum = _mm_packus_epi16 (sum, sum);
+	gint32 pixel = _mm_cvtsi128_si32 (sum);
+	memcpy (p_pixel, &pixel, 4);
+}
+
+
+__attribute__((target("sse4.1")))
+static void
+scale_row_sse41 (const guchar	*p_src_row,
+		 int		 src_rowstride,
+		 guchar		*p_dest_pixel,
+		 int		 width,
+		 const gint32	*weights,
+		 int		 n)
+{
+	for (int x = 0; x < width; x++) {
+		const guchar *p_src_pixel = p_src_row;
+		__m128i sum = _mm_setzero_si128 ();
+		int i = 0;
+
+		for (; i + 4 <= n; i += 4) {
+			__m128i pixels = _mm_loadu_si128 ((const __m128i *) p_src_pixel);
+			sum = _mm_add_epi32 (sum, _mm_mullo_epi32 (_mm_cvtepu8_epi32 (pixels), _mm_set1_epi32 (weights[i])));
+			sum = _mm_add_epi32 (sum, _mm_mullo_epi32 (_mm_cvtepu8_epi32 (_mm_srli_si128 (pixels, 4)), _mm_set1_epi32 (weights[i + 1])));
+			sum = _mm_add_epi32 (sum, _mm_mullo_epi32 (_mm_cvtepu8_epi32 (_mm_srli_si128 (pixels, 8)), _mm_set1_epi32 (weights[i + 2])));
+			sum = _mm_add_epi32 (sum, _mm_mullo_epi32 (_mm_cvtepu8_epi32 (_mm_srli_si128 (pixels, 12)), _mm_set1_epi32 (weights[i + 3])));
+			p_src_pixel += 16;
+		}
+		for (; i < n; i++) {
+			sum = _mm_add_epi32 (sum, _mm_mullo_epi32 (load_pixel_sse41 (p_src_pixel), _mm_set1_epi32 (weights[i])));
+			p_src_pixel += 4;
 		}
+
+		store_pixel_sse41 (p_dest_pixel, sum);
+		p_dest_pixel += 4;
+		p_src_row += src_rowstride;
 	}
+}
 
-out:
-	g_free (weights);
+
+__attribute__((target("avx2")))
+static void
+scale_row_avx2 (const guchar	*p_src_row,
+		int		 src_rowstride,
+		guchar		*p_dest_pixel,
+		int		 width,
+		const gint32	*weights,
+		int		 n)
+{
+	for (int x = 0; x < width; x++) {
+		const guchar *p_src_pixel = p_src_row;
+		__m256i sum2 = _mm256_setzero_si256 ();
+		int i = 0;
+
+		// Two pixels per 256 bit register.
+		for (; i + 4 <= n; i += 4) {
+			__m128i pixels = _mm_loadu_si128 ((const __m128i *) p_src_pixel);
+			__m256i w01 = _mm256_setr_epi32 (weights[i], weights[i], weights[i], weights[i],
+				weights[i + 1], weights[i + 1], weights[i + 1], weights[i + 1]);
+			__m256i w23 = _mm256_setr_epi32 (weights[i + 2], weights[i + 2], weights[i + 2], weights[i + 2],
+				weights[i + 3], weights[i + 3], weights[i + 3], weights[i + 3]);
+			sum2 = _mm256_add_epi32 (sum2, _mm256_mullo_epi32 (_mm256_cvtepu8_epi32 (pixels), w01));
+			sum2 = _mm256_add_epi32 (sum2, _mm256_mullo_epi32 (_mm256_cvtepu8_epi32 (_mm_srli_si128 (pixels, 8)), w23));
+			p_src_pixel += 16;
+		}
+
+		__m128i sum = _mm_add_epi32 (_mm256_castsi256_si128 (sum2), _mm256_extracti128_si256 (sum2, 1));
+		for (; i < n; i++) {
+			sum = _mm_add_epi32 (sum, _mm_mullo_epi32 (load_pixel_sse41 (p_src_pixel), _mm_set1_epi32 (weights[i])));
+			p_src_pixel += 4;
+		}
+
+		store_pixel_sse41 (p_dest_pixel, sum);
+		p_dest_pixel += 4;
+		p_src_row += src_rowstride;
+	}
+}
+
+
+#endif /* HAVE_X86_KERNELS */
+
+
+#ifdef HAVE_NEON_KERNELS
+
+
+static void
+scale_row_neon (const guchar	*p_src_row,
+		int		 src_rowstride,
+		guchar		*p_dest_pixel,
+		int		 width,
+		const gint32	*weights,
+		int		 n)
+{
+	for (int x = 0; x < width; x++) {
+		const guchar *p_src_pixel = p_src_row;
+		int32x4_t sum = vdupq_n_s32 (0);
+		int i = 0;
+
+		for (; i + 4 <= n; i += 4) {
+			uint8x16_t pixels = vld1q_u8 (p_src_pixel);
+			int16x8_t p01 = vreinterpretq_s16_u16 (vmovl_u8 (vget_low_u8 (pixels)));
+			int16x8_t p23 = vreinterpretq_s16_u16 (vmovl_u8 (vget_high_u8 (pixels)));
+			sum = vmlaq_n_s32 (sum, vmovl_s16 (vget_low_s16 (p01)), weights[i]);
+			sum = vmlaq_n_s32 (sum, vmovl_s16 (vget_high_s16 (p01)), weights[i + 1]);
+			sum = vmlaq_n_s32 (sum, vmovl_s16 (vget_low_s16 (p23)), weights[i + 2]);
+			sum = vmlaq_n_s32 (sum, vmovl_s16 (vget_high_s16 (p23)), weights[i + 3]);
+			p_src_pixel += 16;
+		}
+		for (; i < n; i++) {
+			guint32 pixel;
+			memcpy (&pixel, p_src_pixel, 4);
+			uint8x8_t pixel8 = vreinterpret_u8_u32 (vdup_n_u32 (pixel));
+			int16x4_t pixel16 = vget_low_s16 (vreinterpretq_s16_u16 (vmovl_u8 (pixel8)));
+			sum = vmlaq_n_s32 (sum, vmovl_s16 (pixel16), weights[i]);
+			p_src_pixel += 4;
+		}
+
+		// Same as PIXEL_CLAMP (GFIXED_ROUND_TO_INT (sum)) for each channel.
+		int16x4_t sum16 = vqmovn_s32 (vrshrq_n_s32 (sum, 16));
+		uint8x8_t sum8 = vqmovun_s16 (vcombine_s16 (sum16, sum16));
+		guint32 pixel = vget_lane_u32 (vreinterpret_u32_u8 (sum8), 0);
+		memcpy (p_dest_pixel, &pixel, 4);
+
+		p_dest_pixel += 4;
+		p_src_row += src_rowstride;
+	}
+}
+
+
+#endif /* HAVE_NEON_KERNELS */
+
+
+static ScaleRowFunc
+get_scale_row_func (void)
+{
+	GthCpuFeatures features = gth_cpu_get_features ();
+#ifdef HAVE_X86_KERNELS
+	if (features & GTH_CPU_FEATURE_AVX2) {
+		return scale_row_avx2;
+	}
+	if (features & GTH_CPU_FEATURE_SSE4_1) {
+		return scale_row_sse41;
+	}
+#endif
+#ifdef HAVE_NEON_KERNELS
+	if (features & GTH_CPU_FEATURE_NEON) {
+		return scale_row_neon;
+	}
+#endif
+	return scale_row_scalar;
+}
+
+
+typedef struct {
+	ContributionTable *table;
+	ScaleRowFunc scale_row;
+	guchar *p_src;
+	int src_rowstride;
+	guchar *p_dest;
+	int dest_rowstride;
+	int scaled_width;
+	GCancellable *cancellable;
+} ScaleData;
+
+
+// Each output row only depends on the source image, so the rows can be
+// computed in parallel by bands.
+static void
+horizontal_scale_and_transpose_band (guint		 first_row,
+				     guint		 last_row,
+				     gpointer		 user_data)
+{
+	ScaleData *data = user_data;
+	guchar *p_dest = data->p_dest + (first_row * data->dest_rowstride);
+
+	for (int y = first_row; y < last_row; y++) {
+		Contribution *contribution = data->table->contributions + y;
+		data->scale_row (data->p_src + (contribution->start * 4),
+			data->src_rowstride,
+			p_dest,
+			data->scaled_width,
+			contribution->weights,
+			contribution->n);
+
+		p_dest += data->dest_rowstride;
+		if ((data->cancellable != NULL) && g_cancellable_is_cancelled (data->cancellable)) {
+			break;
+		}
+	}
+}
+
+
+static void
+horizontal_scale_and_transpose (GthImage *image,
+				GthImage *scaled,
+				ScaleReal scale_factor,
+				Filter *filter,
+				GCancellable *cancellable)
+{
+	if (filter->cancelled) {
+		return;
+	}
+
+	ScaleData data;
+	int image_width, scaled_height;
+	data.p_src = gth_image_prepare_edit (image, &data.src_rowstride, &image_width, NULL);
+	data.p_dest = gth_image_prepare_edit (scaled, &data.dest_rowstride, &data.scaled_width, &scaled_height);
+	data.table = contribution_table_new (filter, scale_factor, image_width, scaled_height);
+	data.scale_row = get_scale_row_func ();
+	data.cancellable = cancellable;
+
+	gth_parallel_for (scaled_height, MIN_BAND_ROWS, horizontal_scale_and_transpose_band, &data);
+
+	if ((cancellable != NULL) && g_cancellable_is_cancelled (cancellable)) {
+		filter->cancelled = TRUE;
+	}
+
+	contribution_table_free (data.table);
 }
 
 
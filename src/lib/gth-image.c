@@ -1,8 +1,10 @@
 #include <config.h>
 #include <glib.h>
 #include <lcms2.h>
+#include "lib/gth-buffer-pool.h"
 #include "lib/gth-color-manager.h"
 #include "lib/gth-image.h"
+#include "lib/gth-parallel.h"
 #include "lib/pixel.h"
 
 
@@ -41,15 +43,39 @@ struct _GthImagePrivate {
 	// Animation
 	GPtrArray *frames;
 	guint total_time; // Milliseconds
+	struct _GthFrameRenderer *renderer;
 };
 
 typedef struct {
 	guint ref;
-	GthImage *image;
+	GthImage *image; // NULL if not decoded yet.
 	guint start; // Milliseconds
 	guint delay; // Milliseconds
+
+	// Keyframes keep the background of the frame to decode the following
+	// frames without starting from the first one.
+	gboolean has_background;
+	GthImage *background;
 } GthFrame;
 
+// Lazily decoded frames: only the first frame, the last FRAME_CACHE_SIZE
+// decoded frames and at most MAX_KEYFRAMES backgrounds are kept in memory.
+#define FRAME_CACHE_SIZE 8
+#define MAX_KEYFRAMES 16
+#define MIN_KEYFRAME_INTERVAL 16
+
+typedef struct _GthFrameRenderer {
+	GMutex mutex;
+	GthRenderFrameFunc render_func;
+	gpointer user_data;
+	GDestroyNotify destroy_func;
+	GthImage *background; // The background of next_frame.
+	guint next_frame;
+	guint keyframe_interval;
+	guint cache[FRAME_CACHE_SIZE]; // Decoded frames, 0 means empty.
+	guint cache_pos;
+} GthFrameRenderer;
+
 G_DEFINE_TYPE_WITH_CODE (GthImage,
 			 gth_image,
 			 G_TYPE_OBJECT,
@@ -58,8 +84,10 @@ G_DEFINE_TYPE_WITH_CODE (GthImage,
 static GthFrame * gth_frame_new (GthImage *image, guint delay) {
 	GthFrame *frame = g_new0 (GthFrame, 1);
 	frame->ref = 1;
-	frame->image = g_object_ref (image);
+	frame->image = _g_object_ref (image);
 	frame->delay = delay;
+	frame->has_background = FALSE;
+	frame->background = NULL;
 	return frame;
 }
 
@@ -74,12 +102,22 @@ static void gth_frame_unref (GthFrame *frame) {
 	if (frame->ref > 0) {
 		frame->ref--;
 		if (frame->ref == 0) {
-			g_object_unref (frame->image);
+			_g_object_unref (frame->image);
+			_g_object_unref (frame->background);
 			g_free (frame);
 		}
 	}
 }
 
+static void gth_frame_renderer_free (GthFrameRenderer *renderer) {
+	if (renderer->destroy_func != NULL) {
+		renderer->destroy_func (renderer->user_data);
+	}
+	_g_object_unref (renderer->background);
+	g_mutex_clear (&renderer->mutex);
+	g_free (renderer);
+}
+
 static void _gth_image_free_data (GthImage *self) {
 	if (self->priv->bytes != NULL) {
 		g_bytes_unref (self->priv->bytes);
@@ -106,6 +144,9 @@ static void gth_image_finalize (GObject *object) {
 	}
 	_g_object_unref (self->priv->info);
 	g_ptr_array_unref (self->priv->frames);
+	if (self->priv->renderer != NULL) {
+		gth_frame_renderer_free (self->priv->renderer);
+	}
 
 	/* Chain up */
 	G_OBJECT_CLASS (gth_image_parent_class)->finalize (object);
@@ -142,6 +183,7 @@ static void gth_image_init (GthImage *self) {
 	self->priv->info = g_file_info_new ();
 	self->priv->frames = g_ptr_array_new_with_free_func ((GDestroyNotify) gth_frame_unref);
 	self->priv->total_time = 0;
+	self->priv->renderer = NULL;
 }
 
 void gth_image_init_pixels (GthImage *self, guint width, guint height) {
@@ -152,12 +194,9 @@ void gth_image_init_pixels (GthImage *self, guint width, guint height) {
 
 	self->priv->row_stride = (int) (width * PIXEL_BYTES);
 	gsize size = (gsize) self->priv->row_stride * height;
-	guchar *buffer = g_malloc (size);
-	if (buffer != NULL) {
-		self->priv->bytes = g_bytes_new_take (buffer, size);
-		self->priv->width = width;
-		self->priv->height = height;
-	}
+	self->priv->bytes = gth_buffer_pool_new_bytes (size);
+	self->priv->width = width;
+	self->priv->height = height;
 }
 
 GthImage * gth_image_new (guint width, guint height) {
@@ -223,11 +262,10 @@ GthImage * gth_image_new_as_frame (GthImage *self) {
 }
 
 static GBytes * _g_bytes_new_slice (GBytes *bytes, gsize offset, gsize new_size) {
-	gsize old_size;
-	const guchar *old_buffer = g_bytes_get_data (bytes, &old_size);
-	old_buffer += offset;
-	guchar *new_buffer = g_memdup2 (old_buffer, old_size);
-	return g_bytes_new_take (new_buffer, new_size);
+	const guchar *old_buffer = g_bytes_get_data (bytes, NULL);
+	GBytes *new_bytes = gth_buffer_pool_new_bytes (new_size);
+	memcpy ((gpointer) g_bytes_get_data (new_bytes, NULL), old_buffer + offset, new_size);
+	return new_bytes;
 }
 
 void gth_image_copy_pixels (GthImage *src, GthImage *dest) {
@@ -386,14 +424,7 @@ GdkTexture * gth_image_get_texture (GthImage *self) {
 		(gsize) self->priv->row_stride);
 }
 
-GdkTexture * gth_image_get_texture_for_rect (GthImage *self, guint x, guint y, guint width, guint height, guint frame_index) {
-	g_return_val_if_fail (GTH_IS_IMAGE (self), NULL);
-	GthImagePrivate *priv = self->priv;
-	if ((priv->frames->len > 0) && (frame_index > 0) && (frame_index < priv->frames->len)) {
-		GthFrame *frame = g_ptr_array_index (priv->frames, frame_index);
-		priv = frame->image->priv;
-	}
-
+static GdkTexture * _gth_image_get_texture_for_rect (GthImagePrivate *priv, guint x, guint y, guint width, guint height) {
 	// Check x and width
 	if (width == 0) {
 		return NULL;
@@ -425,6 +456,14 @@ GdkTexture * gth_image_get_texture_for_rect (GthImage *self, guint x, guint y, g
 	return texture;
 }
 
+GdkTexture * gth_image_get_texture_for_rect (GthImage *self, guint x, guint y, guint width, guint height, guint frame_index) {
+	g_return_val_if_fail (GTH_IS_IMAGE (self), NULL);
+	GthImage *frame_image = gth_image_get_frame (self, frame_index);
+	GdkTexture *texture = _gth_image_get_texture_for_rect (frame_image->priv, x, y, width, height);
+	g_object_unref (frame_image);
+	return texture;
+}
+
 GthImage * gth_image_get_subimage (GthImage *source, guint x, guint y, guint width, guint height) {
 	g_return_val_if_fail (GTH_IS_IMAGE (source), NULL);
 	if (x + width > source->priv->width) {
@@ -636,6 +675,104 @@ void gth_image_add_frame (GthImage *self, GthImage *frame_image, guint delay) {
 	}
 }
 
+// Adds a frame decoded on demand by the frame renderer, the first frame
+// must be added with gth_image_add_frame.
+void gth_image_add_lazy_frame (GthImage *self, guint delay) {
+	g_return_if_fail (GTH_IS_IMAGE (self));
+	GthImagePrivate *priv = self->priv;
+	g_return_if_fail (priv->frames->len > 0);
+	GthFrame *frame = gth_frame_new (NULL, delay);
+	g_ptr_array_add (priv->frames, frame);
+	frame->start = priv->total_time;
+	priv->total_time += frame->delay;
+}
+
+void gth_image_set_frame_renderer (GthImage *self,
+	GthRenderFrameFunc render_func,
+	gpointer user_data,
+	GDestroyNotify destroy_func)
+{
+	g_return_if_fail (GTH_IS_IMAGE (self));
+	GthImagePrivate *priv = self->priv;
+	if (priv->renderer != NULL) {
+		gth_frame_renderer_free (priv->renderer);
+	}
+	GthFrameRenderer *renderer = g_new0 (GthFrameRenderer, 1);
+	g_mutex_init (&renderer->mutex);
+	renderer->render_func = render_func;
+	renderer->user_data = user_data;
+	renderer->destroy_func = destroy_func;
+	renderer->background = NULL;
+	renderer->next_frame = 0;
+	renderer->keyframe_interval = MAX (MIN_KEYFRAME_INTERVAL, (priv->frames->len + MAX_KEYFRAMES - 1) / MAX_KEYFRAMES);
+	renderer->cache_pos = 0;
+	priv->renderer = renderer;
+}
+
+static GthImage * _gth_image_render_frame (GthImage *self, guint frame_index) {
+	GthImagePrivate *priv = self->priv;
+	GthFrameRenderer *renderer = priv->renderer;
+
+	// Start from the nearest keyframe, or continue from the last decoded
+	// frame if it's nearer.
+	guint keyframe = frame_index - (frame_index % renderer->keyframe_interval);
+	while (keyframe > 0) {
+		GthFrame *frame = g_ptr_array_index (priv->frames, keyframe);
+		if (frame->has_background) {
+			break;
+		}
+		keyframe -= renderer->keyframe_interval;
+	}
+	if ((renderer->next_frame > frame_index) || (renderer->next_frame < keyframe)) {
+		_g_object_unref (renderer->background);
+		renderer->background = NULL;
+		if (keyframe > 0) {
+			GthFrame *frame = g_ptr_array_index (priv->frames, keyframe);
+			renderer->background = _g_object_ref (frame->background);
+		}
+		renderer->next_frame = keyframe;
+	}
+
+	GthImage *result = NULL;
+	while (renderer->next_frame <= frame_index) {
+		guint index = renderer->next_frame;
+		GthFrame *frame = g_ptr_array_index (priv->frames, index);
+		if ((index % renderer->keyframe_interval == 0) && !frame->has_background) {
+			frame->background = _g_object_ref (renderer->background);
+			frame->has_background = TRUE;
+		}
+		GthImage *image = renderer->render_func (index, &renderer->background, renderer->user_data, NULL);
+		if (image == NULL) {
+			// Restart from a keyframe the next time.
+			renderer->next_frame = G_MAXUINT;
+			break;
+		}
+		renderer->next_frame++;
+		if (index == frame_index) {
+			result = image;
+		}
+		else {
+			g_object_unref (image);
+		}
+	}
+	return result;
+}
+
+static void _gth_image_cache_frame (GthImage *self, guint frame_index, GthImage *image) {
+	GthImagePrivate *priv = self->priv;
+	GthFrameRenderer *renderer = priv->renderer;
+	guint old_index = renderer->cache[renderer->cache_pos];
+	if (old_index > 0) {
+		GthFrame *old_frame = g_ptr_array_index (priv->frames, old_index);
+		_g_object_unref (old_frame->image);
+		old_frame->image = NULL;
+	}
+	GthFrame *frame = g_ptr_array_index (priv->frames, frame_index);
+	frame->image = g_object_ref (image);
+	renderer->cache[renderer->cache_pos] = frame_index;
+	renderer->cache_pos = (renderer->cache_pos + 1) % FRAME_CACHE_SIZE;
+}
+
 gboolean gth_image_get_is_animated (GthImage *self) {
 	g_return_val_if_fail (GTH_IS_IMAGE (self), FALSE);
 	return self->priv->frames->len > 1;
@@ -692,15 +829,27 @@ gboolean gth_image_next_frame (GthImage *self, guint *frame_index) {
 GthImage * gth_image_get_frame (GthImage *self, guint frame_index) {
 	g_return_val_if_fail (GTH_IS_IMAGE (self), NULL);
 	GthImagePrivate *priv = self->priv;
-	if ((priv->frames->len > 0) && (frame_index > 0) && (frame_index < priv->frames->len)) {
+	if ((priv->frames->len == 0) || (frame_index == 0) || (frame_index >= priv->frames->len)) {
+		return g_object_ref (self);
+	}
+	if (priv->renderer == NULL) {
 		GthFrame *frame = g_ptr_array_index (priv->frames, frame_index);
-		g_object_ref (frame->image);
-		return frame->image;
+		return g_object_ref (frame->image);
 	}
-	else {
-		g_object_ref (self);
-		return self;
+
+	g_mutex_lock (&priv->renderer->mutex);
+	GthFrame *frame = g_ptr_array_index (priv->frames, frame_index);
+	GthImage *image = _g_object_ref (frame->image);
+	if (image == NULL) {
+		image = _gth_image_render_frame (self, frame_index);
+		if (image != NULL) {
+			_gth_image_cache_frame (self, frame_index, image);
+		}
 	}
+	g_mutex_unlock (&priv->renderer->mutex);
+
+	// Show the first frame if the frame cannot be decoded.
+	return (image != NULL) ? image : g_object_ref (self);
 }
 
 void gth_image_set_icc_profile (GthImage *self, GthIccProfile *profile) {
@@ -732,6 +881,31 @@ bool gth_image_has_icc_profile (GthImage *self) {
 	return self->priv->icc_profile != NULL;
 }
 
+// Minimum number of rows transformed by a single thread.
+#define ICC_TRANSFORM_MIN_BAND_ROWS 32
+
+typedef struct {
+	cmsHTRANSFORM transform;
+	guchar *pixels;
+	int row_stride;
+	guint width;
+	GCancellable *cancellable;
+} IccTransformData;
+
+// cmsDoTransform can be called from different threads on the same transform,
+// each band works on its own rows.
+static void icc_transform_band (guint first_row, guint last_row, gpointer user_data) {
+	IccTransformData *data = user_data;
+	guchar *row_pointer = data->pixels + ((gsize) first_row * data->row_stride);
+	for (guint row = first_row; row < last_row; row++) {
+		if (g_cancellable_is_cancelled (data->cancellable)) {
+			break;
+		}
+		cmsDoTransform (data->transform, row_pointer, row_pointer, data->width);
+		row_pointer += data->row_stride;
+	}
+}
+
 void gth_image_apply_icc_profile (GthImage *self,
 	GthColorManager *color_manager,
 	GthIccProfile *out_profile,
@@ -761,78 +935,15 @@ void gth_image_apply_icc_profile (GthImage *self,
 		return;
 	}
 
-	cmsHTRANSFORM hTransform = (cmsHTRANSFORM) gth_icc_transform_get_transform (transform);
-	guchar *row_pointer = gth_image_get_pixels (self, NULL);
-	for (guint row = 0; row < self->priv->height; row++) {
-		if (g_cancellable_is_cancelled (cancellable)) {
-			break;
-		}
-		cmsDoTransform (hTransform, row_pointer, row_pointer, self->priv->width);
-		row_pointer += self->priv->row_stride;
-	}
+	IccTransformData data;
+	data.transform = (cmsHTRANSFORM) gth_icc_transform_get_transform (transform);
+	data.pixels = gth_image_get_pixels (self, NULL);
+	data.row_stride = self->priv->row_stride;
+	data.width = self->priv->width;
+	data.cancellable = cancellable;
+	gth_parallel_for (self->priv->height, ICC_TRANSFORM_MIN_BAND_ROWS, icc_transform_band, &data);
 
 	g_object_unref (transform);
 
 	gth_image_set_icc_profile (self, out_profile);
 }
-
-// -- gth_image_apply_icc_profile_async --
-
-typedef struct {
-	GthImage *image;
-	GthColorManager *color_manager;
-	GthIccProfile *out_profile;
-} ApplyProfileData;
-
-static void apply_profile_data_free (gpointer user_data) {
-	ApplyProfileData *apd = user_data;
-	g_object_unref (apd->image);
-	g_object_unref (apd->color_manager);
-	g_object_unref (apd->out_profile);
-	g_free (apd);
-}
-
-static void _gth_image_apply_icc_profile_thread (GTask *task,
-	gpointer source_object,
-	gpointer task_data,
-	GCancellable *cancellable)
-{
-	ApplyProfileData *apd = g_task_get_task_data (task);
-	gth_image_apply_icc_profile (apd->image, apd->color_manager, apd->out_profile, cancellable);
-
-	if ((cancellable != NULL) && g_cancellable_is_cancelled (cancellable)) {
-		g_task_return_error (task, g_error_new_literal (G_IO_ERROR, G_IO_ERROR_CANCELLED, ""));
-		return;
-	}
-
-	g_task_return_boolean (task, TRUE);
-}
-
-void gth_image_apply_icc_profile_async (GthImage *image,
-	GthColorManager *color_manager,
-	GthIccProfile *out_profile,
-	GCancellable *cancellable,
-	GAsyncReadyCallback callback,
-	gpointer user_data)
-{
-	g_return_if_fail (image != NULL);
-	g_return_if_fail (out_profile != NULL);
-
-	ApplyProfileData *apd = g_new (ApplyProfileData, 1);
-	apd->image = g_object_ref (image);
-	apd->color_manager = g_object_ref (color_manager);
-	apd->out_profile = g_object_ref (out_profile);
-
-	GTask *task = g_task_new (NULL, cancellable, callback, user_data);
-	g_task_set_task_data (task, apd, apply_profile_data_free);
-	g_task_run_in_thread (task, _gth_image_apply_icc_profile_thread);
-
-	g_object_unref (task);
-}
-
-gboolean gth_image_apply_icc_profile_finish (GthImage *self,
-	GAsyncResult *result,
-	GError **error)
-{
-	return g_task_propagate_boolean (G_TASK (result), error);
-}
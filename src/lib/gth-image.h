@@ -6,6 +6,7 @@
 #include <gio/gio.h>
 #include "lib/gth-color-manager.h"
 #include "lib/gth-icc-profile.h"
+#include "lib/gth-pixel-ops.h"
 #include "lib/gth-point.h"
 #include "lib/gth-points.h"
 #include "lib/lib.h"
@@ -91,6 +92,15 @@ cairo_surface_t * gth_image_get_scaled_texture (GthImage *self, double x_scale,
 
 // Animated images
 void gth_image_add_frame (GthImage *self, GthImage *frame, uint delay);
+
+// Renders the frame frame_index over *background, the canvas left by the
+// previous frames (NULL if empty), and replaces *background with the canvas
+// for the next frame.  The background image must not be modified.
+// Returns the displayed frame, or NULL on error leaving *background as is.
+typedef GthImage * (*GthRenderFrameFunc) (guint frame_index, GthImage **background, gpointer user_data, GError **error);
+
+void gth_image_add_lazy_frame (GthImage *self, uint delay);
+void gth_image_set_frame_renderer (GthImage *self, GthRenderFrameFunc render_func, gpointer user_data, GDestroyNotify destroy_func);
 gboolean gth_image_get_is_animated (GthImage *self);
 guint gth_image_get_frames (GthImage *self);
 gboolean gth_image_get_frame_at (GthImage *self, gulong *time, guint *frame_index);
@@ -105,15 +115,6 @@ void gth_image_apply_icc_profile (GthImage *self,
 	GthColorManager	*color_manager,
 	GthIccProfile *out_profile,
 	GCancellable *cancellable);
-void gth_image_apply_icc_profile_async (GthImage *self,
-	GthColorManager	*color_manager,
-	GthIccProfile *out_profile,
-	GCancellable *cancellable,
-	GAsyncReadyCallback callback,
-	gpointer user_data);
-gboolean gth_image_apply_icc_profile_finish(GthImage *self,
-	GAsyncResult *result,
-	GError **error);
 
 // Resize
 GthImage * gth_image_resize_to (GthImage *self,
@@ -169,6 +170,7 @@ gboolean gth_image_apply_vignette (GthImage *self, double amount, GCancellable *
 gboolean gth_image_apply_radial_mask (GthImage *background, GthImage *foreground, double amount, GCancellable *cancellable);
 gboolean gth_image_apply_curve (GthImage *self, GthPoints *points, GCancellable *cancellable);
 gboolean gth_image_colorize (GthImage *self, double red_amount, double green_amount, double blue_amount, GCancellable *cancellable);
+gboolean gth_image_apply_pixel_ops (GthImage *self, GthPixelOps *ops, GCancellable *cancellable);
 gboolean gth_image_soft_light_with_radial_gradient (GthImage *self, GCancellable *cancellable);
 gboolean gth_image_dither_ordered (GthImage *self, GCancellable *cancellable);
 gboolean gth_image_dither_error_diffusion (GthImage *self, GCancellable *cancellable);
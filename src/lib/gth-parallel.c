@@ -0,0 +1,164 @@
+#include <config.h>
+#include <glib.h>
+#include "lib/gth-parallel.h"
+
+// Split the items in more bands than threads to balance the load when some
+// bands take longer than others.
+#define BANDS_PER_THREAD 4
+
+typedef struct {
+	gint ref;
+	GthParallelWorkerFunc func;
+	gpointer user_data;
+	guint n_items;
+	guint band_size;
+	guint n_bands;
+	gint next_band;
+	gint next_worker;
+	gint pending_bands;
+	GMutex mutex;
+	GCond cond;
+} ParallelJob;
+
+static ParallelJob * parallel_job_new (guint n_items, guint n_bands, GthParallelWorkerFunc func, gpointer user_data) {
+	ParallelJob *job = g_new0 (ParallelJob, 1);
+	job->ref = 1;
+	job->func = func;
+	job->user_data = user_data;
+	job->n_items = n_items;
+	job->band_size = (n_items + n_bands - 1) / n_bands;
+	job->n_bands = (n_items + job->band_size - 1) / job->band_size;
+	job->next_band = 0;
+	job->next_worker = 0;
+	job->pending_bands = (gint) job->n_bands;
+	g_mutex_init (&job->mutex);
+	g_cond_init (&job->cond);
+	return job;
+}
+
+static ParallelJob * parallel_job_ref (ParallelJob *job) {
+	g_atomic_int_inc (&job->ref);
+	return job;
+}
+
+static void parallel_job_unref (ParallelJob *job) {
+	if (g_atomic_int_dec_and_test (&job->ref)) {
+		g_mutex_clear (&job->mutex);
+		g_cond_clear (&job->cond);
+		g_free (job);
+	}
+}
+
+// Called by the pool threads and by the calling thread: every participant
+// takes the next free band until none is left, this way the job completes
+// even when all the pool threads are busy.
+static void parallel_job_run_bands (ParallelJob *job) {
+	guint worker = (guint) g_atomic_int_add (&job->next_worker, 1);
+	while (TRUE) {
+		guint band = (guint) g_atomic_int_add (&job->next_band, 1);
+		if (band >= job->n_bands) {
+			break;
+		}
+		guint start = band * job->band_size;
+		guint end = MIN (start + job->band_size, job->n_items);
+		job->func (start, end, worker, job->user_data);
+		if (g_atomic_int_dec_and_test (&job->pending_bands)) {
+			g_mutex_lock (&job->mutex);
+			g_cond_signal (&job->cond);
+			g_mutex_unlock (&job->mutex);
+		}
+	}
+}
+
+static void parallel_job_wait (ParallelJob *job) {
+	g_mutex_lock (&job->mutex);
+	while (g_atomic_int_get (&job->pending_bands) > 0) {
+		g_cond_wait (&job->cond, &job->mutex);
+	}
+	g_mutex_unlock (&job->mutex);
+}
+
+static void pool_func (gpointer data, gpointer user_data) {
+	ParallelJob *job = data;
+	parallel_job_run_bands (job);
+	parallel_job_unref (job);
+}
+
+static GThreadPool *shared_pool = NULL;
+static gint max_threads_limit = 0;
+
+static GThreadPool * get_shared_pool (void) {
+	static gsize pool_initialization = 0;
+	if (g_once_init_enter (&pool_initialization)) {
+		// The calling thread works as well, hence the -1.
+		int max_threads = MAX (g_get_num_processors () - 1, 1);
+		shared_pool = g_thread_pool_new (pool_func, NULL, max_threads, FALSE, NULL);
+		g_once_init_leave (&pool_initialization, 1);
+	}
+	return shared_pool;
+}
+
+guint gth_parallel_get_n_threads (void) {
+	guint n_threads = MAX (g_get_num_processors (), 1);
+	guint limit = (guint) g_atomic_int_get (&max_threads_limit);
+	return (limit > 0) ? MIN (n_threads, limit) : n_threads;
+}
+
+// Limits the number of threads used by gth_parallel_for, 0 means no limit.
+// Used by tests and benchmarks to compare against the sequential code.
+void gth_parallel_set_max_threads (guint max_threads) {
+	g_atomic_int_set (&max_threads_limit, (gint) max_threads);
+}
+
+// Splits the range [0, n_items) in bands of at least min_band_size items and
+// calls func for each band using the shared thread pool and at most
+// max_workers threads (0 means no limit).  Returns when all the bands have
+// been processed.  func must only write data that belongs to its own band.
+void gth_parallel_for_workers (guint n_items, guint min_band_size, guint max_workers, GthParallelWorkerFunc func, gpointer user_data) {
+	g_return_if_fail (func != NULL);
+
+	if (n_items == 0) {
+		return;
+	}
+
+	guint n_threads = gth_parallel_get_n_threads ();
+	if (max_workers > 0) {
+		n_threads = MIN (n_threads, max_workers);
+	}
+	guint n_bands = MIN (n_threads * BANDS_PER_THREAD, n_items / MAX (min_band_size, 1));
+	if ((n_threads <= 1) || (n_bands <= 1)) {
+		func (0, n_items, 0, user_data);
+		return;
+	}
+
+	GThreadPool *pool = get_shared_pool ();
+	ParallelJob *job = parallel_job_new (n_items, n_bands, func, user_data);
+	guint n_helpers = MIN (n_threads - 1, job->n_bands - 1);
+	for (guint i = 0; i < n_helpers; i++) {
+		g_thread_pool_push (pool, parallel_job_ref (job), NULL);
+	}
+	parallel_job_run_bands (job);
+	parallel_job_wait (job);
+	parallel_job_unref (job);
+}
+
+typedef struct {
+	GthParallelFunc func;
+	gpointer user_data;
+} SimpleFuncData;
+
+static void simple_func (guint start, guint end, guint worker, gpointer user_data) {
+	SimpleFuncData *data = user_data;
+	data->func (start, end, data->user_data);
+}
+
+// Same as gth_parallel_for_workers, for functions that don't need the
+// worker index.
+void gth_parallel_for (guint n_items, guint min_band_size, GthParallelFunc func, gpointer user_data) {
+	g_return_if_fail (func != NULL);
+
+	SimpleFuncData data;
+	data.func = func;
+	data.user_data = user_data;
+	gth_parallel_for_workers (n_items, min_band_size, 0, simple_func, &data);
+}
@@ -0,0 +1,23 @@
+#ifndef GTH_PARALLEL_H
+#define GTH_PARALLEL_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+// Processes the items in the range [start, end).
+typedef void (*GthParallelFunc) (guint start, guint end, gpointer user_data);
+
+// Same as GthParallelFunc, worker is an index in the range
+// [0, gth_parallel_get_n_threads ()) that is never used by two bands at the
+// same time, it can be used to access per-thread data.
+typedef void (*GthParallelWorkerFunc) (guint start, guint end, guint worker, gpointer user_data);
+
+guint gth_parallel_get_n_threads (void);
+void gth_parallel_set_max_threads (guint max_threads);
+void gth_parallel_for (guint n_items, guint min_band_size, GthParallelFunc func, gpointer user_data);
+void gth_parallel_for_workers (guint n_items, guint min_band_size, guint max_workers, GthParallelWorkerFunc func, gpointer user_data);
+
+G_END_DECLS
+
+#endif /* GTH_PARALLEL_H */
@@ -0,0 +1,282 @@
+#include <config.h>
+#include <math.h>
+#include "lib/gth-image.h"
+#include "lib/gth-parallel.h"
+#include "lib/gth-pixel-ops.h"
+#include "lib/gth-point.h"
+#include "lib/types.h"
+#include "lib/util.h"
+
+// Minimum number of rows processed by a single thread.
+#define MIN_BAND_ROWS 16
+
+typedef enum {
+	STAGE_VALUE_MAP,
+	STAGE_GRAYSCALE,
+	STAGE_GRAYSCALE_SATURATION,
+} StageType;
+
+typedef struct {
+	StageType type;
+	guchar red_map[256];
+	guchar green_map[256];
+	guchar blue_map[256];
+	double red_weight;
+	double green_weight;
+	double blue_weight;
+	double amount;
+} Stage;
+
+struct _GthPixelOps {
+	guint ref_count;
+	GPtrArray *stages;
+};
+
+GthPixelOps * gth_pixel_ops_new (void) {
+	GthPixelOps *ops = g_new (GthPixelOps, 1);
+	ops->ref_count = 1;
+	ops->stages = g_ptr_array_new_with_free_func (g_free);
+	return ops;
+}
+
+GthPixelOps * gth_pixel_ops_ref (GthPixelOps *ops) {
+	g_return_val_if_fail (ops != NULL, NULL);
+	ops->ref_count++;
+	return ops;
+}
+
+void gth_pixel_ops_unref (GthPixelOps *ops) {
+	g_return_if_fail (ops != NULL);
+	if (ops->ref_count > 0) {
+		ops->ref_count--;
+		if (ops->ref_count == 0) {
+			g_ptr_array_unref (ops->stages);
+			g_free (ops);
+		}
+	}
+}
+
+gboolean gth_pixel_ops_is_empty (GthPixelOps *ops) {
+	g_return_val_if_fail (ops != NULL, TRUE);
+	return ops->stages->len == 0;
+}
+
+static Stage * add_stage (GthPixelOps *ops, StageType type) {
+	Stage *stage = g_new0 (Stage, 1);
+	stage->type = type;
+	g_ptr_array_add (ops->stages, stage);
+	return stage;
+}
+
+// Adds a per-channel lookup table, composing it with the previous one if
+// possible.
+static void add_channel_maps (GthPixelOps *ops, const guchar *red_map, const guchar *green_map, const guchar *blue_map) {
+	Stage *last = (ops->stages->len > 0) ? g_ptr_array_index (ops->stages, ops->stages->len - 1) : NULL;
+	if ((last != NULL) && (last->type == STAGE_VALUE_MAP)) {
+		for (int v = 0; v < 256; v++) {
+			last->red_map[v] = red_map[last->red_map[v]];
+			last->green_map[v] = green_map[last->green_map[v]];
+			last->blue_map[v] = blue_map[last->blue_map[v]];
+		}
+	}
+	else {
+		Stage *stage = add_stage (ops, STAGE_VALUE_MAP);
+		memcpy (stage->red_map, red_map, 256);
+		memcpy (stage->green_map, green_map, 256);
+		memcpy (stage->blue_map, blue_map, 256);
+	}
+}
+
+static void add_map (GthPixelOps *ops, const guchar *map) {
+	add_channel_maps (ops, map, map, map);
+}
+
+void gth_pixel_ops_add_value_map (GthPixelOps *ops, const guchar *value_map) {
+	g_return_if_fail (ops != NULL);
+	g_return_if_fail (value_map != NULL);
+	add_channel_maps (ops,
+		value_map + (GTH_CHANNEL_RED * VALUE_MAP_COLUMNS),
+		value_map + (GTH_CHANNEL_GREEN * VALUE_MAP_COLUMNS),
+		value_map + (GTH_CHANNEL_BLUE * VALUE_MAP_COLUMNS));
+}
+
+void gth_pixel_ops_add_curve (GthPixelOps *ops, GthPoints *points) {
+	g_return_if_fail (ops != NULL);
+	if (points == NULL) {
+		return;
+	}
+	guchar *value_map = gth_points_get_value_map (points, NULL);
+	gth_pixel_ops_add_value_map (ops, value_map);
+	g_free (value_map);
+}
+
+void gth_pixel_ops_add_colorize (GthPixelOps *ops, double red_amount, double green_amount, double blue_amount) {
+	g_return_if_fail (ops != NULL);
+	GthPoint lighter_point = { 127, 127 };
+	GthPoint darker_point = { 82, 187 };
+	GthPoint middle_point;
+
+	gth_point_init_interpolate (&middle_point, &lighter_point, &darker_point, red_amount);
+	GthPoint red_points[] = { { 0, 0 }, middle_point, { 255, 255 } };
+
+	gth_point_init_interpolate (&middle_point, &lighter_point, &darker_point, green_amount);
+	GthPoint green_points[] = { { 0, 0 }, middle_point, { 255, 255 } };
+
+	gth_point_init_interpolate (&middle_point, &lighter_point, &darker_point, blue_amount);
+	GthPoint blue_points[] = { { 0, 0 }, middle_point, { 255, 255 } };
+
+	GthPoints points;
+	gth_points_init (&points, NULL, 0,
+		red_points, (red_amount > 0) ? 3 : 0,
+		green_points, (green_amount > 0) ? 3 : 0,
+		blue_points, (blue_amount > 0) ? 3 : 0);
+	gth_pixel_ops_add_curve (ops, &points);
+}
+
+void gth_pixel_ops_add_brightness (GthPixelOps *ops, double amount) {
+	g_return_if_fail (ops != NULL);
+	guchar map[256];
+	double dtemp;
+	for (int v = 0; v < 256; v++) {
+		if (amount > 0) {
+			dtemp = INTERPOLATE (v, 0.0, amount);
+		}
+		else {
+			dtemp = INTERPOLATE (v, 255.0, -amount);
+		}
+		map[v] = CLAMP (dtemp, 0, 255);
+	}
+	add_map (ops, map);
+}
+
+void gth_pixel_ops_add_contrast (GthPixelOps *ops, double amount) {
+	g_return_if_fail (ops != NULL);
+	if (amount < 0) {
+		amount = tan (amount * G_PI_2);
+	}
+	guchar map[256];
+	double dtemp;
+	for (int v = 0; v < 256; v++) {
+		dtemp = INTERPOLATE (v, 127.0, amount);
+		map[v] = CLAMP (dtemp, 0, 255);
+	}
+	add_map (ops, map);
+}
+
+void gth_pixel_ops_add_gamma_correction (GthPixelOps *ops, double gamma) {
+	g_return_if_fail (ops != NULL);
+	guchar map[256];
+	double value;
+	for (int v = 0; v < 256; v++) {
+		value = 255.0 * pow (((double) v / 255.0), gamma);
+		map[v] = CLAMP (value, 0, 255);
+	}
+	add_map (ops, map);
+}
+
+void gth_pixel_ops_add_grayscale (GthPixelOps *ops, double red_weight, double green_weight, double blue_weight, double amount) {
+	g_return_if_fail (ops != NULL);
+	if (amount < 0) {
+		amount = tan (amount) * G_PI;
+	}
+	Stage *stage = add_stage (ops, STAGE_GRAYSCALE);
+	stage->red_weight = red_weight;
+	stage->green_weight = green_weight;
+	stage->blue_weight = blue_weight;
+	stage->amount = amount;
+}
+
+void gth_pixel_ops_add_grayscale_saturation (GthPixelOps *ops, double amount) {
+	g_return_if_fail (ops != NULL);
+	if (amount < 0) {
+		amount = tan (amount) * G_PI;
+	}
+	Stage *stage = add_stage (ops, STAGE_GRAYSCALE_SATURATION);
+	stage->amount = amount;
+}
+
+static inline void stage_apply (Stage *stage, guchar *red, guchar *green, guchar *blue) {
+	int value, itemp;
+	guchar min, max;
+
+	switch (stage->type) {
+	case STAGE_VALUE_MAP:
+		*red = stage->red_map[*red];
+		*green = stage->green_map[*green];
+		*blue = stage->blue_map[*blue];
+		return;
+
+	case STAGE_GRAYSCALE:
+		value = (stage->red_weight * *red) + (stage->green_weight * *green) + (stage->blue_weight * *blue);
+		break;
+
+	case STAGE_GRAYSCALE_SATURATION:
+		max = MAX (MAX (*red, *green), *blue);
+		min = MIN (MIN (*red, *green), *blue);
+		value = (max + min) / 2;
+		break;
+
+	default:
+		return;
+	}
+
+	itemp = INTERPOLATE (*red, value, stage->amount);
+	*red = CLAMP (itemp, 0, 255);
+
+	itemp = INTERPOLATE (*green, value, stage->amount);
+	*green = CLAMP (itemp, 0, 255);
+
+	itemp = INTERPOLATE (*blue, value, stage->amount);
+	*blue = CLAMP (itemp, 0, 255);
+}
+
+typedef struct {
+	GthPixelOps *ops;
+	guchar *pixels;
+	int row_stride;
+	int width;
+	GCancellable *cancellable;
+} ApplyData;
+
+static void apply_band (guint first_row, guint last_row, gpointer user_data) {
+	ApplyData *data = user_data;
+	Stage **stages = (Stage **) data->ops->stages->pdata;
+	guint n_stages = data->ops->stages->len;
+	guchar *row = data->pixels + (first_row * data->row_stride);
+	guchar *pixel;
+	guchar red, green, blue, alpha;
+
+	for (guint y = first_row; y < last_row; y++) {
+		pixel = row;
+		for (int x = 0; x < data->width; x++) {
+			PIXEL_TO_RGBA (pixel, red, green, blue, alpha);
+			for (guint i = 0; i < n_stages; i++) {
+				stage_apply (stages[i], &red, &green, &blue);
+			}
+			RGBA_TO_PIXEL (pixel, red, green, blue, alpha);
+			pixel += 4;
+		}
+		row += data->row_stride;
+		if ((data->cancellable != NULL) && g_cancellable_is_cancelled (data->cancellable)) {
+			break;
+		}
+	}
+}
+
+gboolean gth_image_apply_pixel_ops (GthImage *self, GthPixelOps *ops, GCancellable *cancellable) {
+	g_return_val_if_fail (GTH_IS_IMAGE (self), FALSE);
+	g_return_val_if_fail (ops != NULL, FALSE);
+
+	if (gth_pixel_ops_is_empty (ops)) {
+		return TRUE;
+	}
+
+	ApplyData data;
+	int height;
+	data.ops = ops;
+	data.pixels = gth_image_prepare_edit (self, &data.row_stride, &data.width, &height);
+	data.cancellable = cancellable;
+	gth_parallel_for (height, MIN_BAND_ROWS, apply_band, &data);
+
+	return (cancellable == NULL) || !g_cancellable_is_cancelled (cancellable);
+}
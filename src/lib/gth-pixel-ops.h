@@ -0,0 +1,29 @@
+#ifndef GTH_PIXEL_OPS_H
+#define GTH_PIXEL_OPS_H
+
+#include <glib.h>
+#include "lib/gth-points.h"
+
+G_BEGIN_DECLS
+
+// A sequence of per-pixel color operations applied to an image with a single
+// pass: the pixels are un-premultiplied and premultiplied once, and
+// consecutive per-channel operations are composed in a single lookup table.
+typedef struct _GthPixelOps GthPixelOps;
+
+GthPixelOps * gth_pixel_ops_new (void);
+GthPixelOps * gth_pixel_ops_ref (GthPixelOps *ops);
+void gth_pixel_ops_unref (GthPixelOps *ops);
+gboolean gth_pixel_ops_is_empty (GthPixelOps *ops);
+void gth_pixel_ops_add_value_map (GthPixelOps *ops, const guchar *value_map);
+void gth_pixel_ops_add_curve (GthPixelOps *ops, GthPoints *points);
+void gth_pixel_ops_add_colorize (GthPixelOps *ops, double red_amount, double green_amount, double blue_amount);
+void gth_pixel_ops_add_brightness (GthPixelOps *ops, double amount);
+void gth_pixel_ops_add_contrast (GthPixelOps *ops, double amount);
+void gth_pixel_ops_add_gamma_correction (GthPixelOps *ops, double gamma);
+void gth_pixel_ops_add_grayscale (GthPixelOps *ops, double red_weight, double green_weight, double blue_weight, double amount);
+void gth_pixel_ops_add_grayscale_saturation (GthPixelOps *ops, double amount);
+
+G_END_DECLS
+
+#endif /* GTH_PIXEL_OPS_H */
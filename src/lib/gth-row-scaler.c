@@ -0,0 +1,106 @@
+#include <config.h>
+#include <glib.h>
+#include "lib/gth-row-scaler.h"
+
+struct _GthRowScaler {
+	guint src_width;
+	guint src_height;
+	guint dest_width;
+	guint dest_height;
+	GthImage *image;
+	guchar *dest_row;
+	int dest_row_stride;
+	guint *dest_column; // Destination column of each source column.
+	guint *column_size; // Source columns of each destination column.
+	guint64 *sums; // Channel sums of the current destination row.
+	guint src_y;
+	guint dest_y;
+	guint rows; // Source rows added to the current destination row.
+};
+
+GthRowScaler * gth_row_scaler_new (guint src_width, guint src_height, guint dest_width, guint dest_height) {
+	g_return_val_if_fail ((dest_width > 0) && (dest_width <= src_width), NULL);
+	g_return_val_if_fail ((dest_height > 0) && (dest_height <= src_height), NULL);
+
+	GthImage *image = gth_image_new (dest_width, dest_height);
+	if (image == NULL) {
+		return NULL;
+	}
+
+	GthRowScaler *self = g_new0 (GthRowScaler, 1);
+	self->src_width = src_width;
+	self->src_height = src_height;
+	self->dest_width = dest_width;
+	self->dest_height = dest_height;
+	self->image = image;
+	self->dest_row = gth_image_prepare_edit (image, &self->dest_row_stride, NULL, NULL);
+	self->dest_column = g_new (guint, src_width);
+	self->column_size = g_new0 (guint, dest_width);
+	for (guint x = 0; x < src_width; x++) {
+		guint dest_x = (guint) (((guint64) x * dest_width) / src_width);
+		self->dest_column[x] = dest_x;
+		self->column_size[dest_x]++;
+	}
+	self->sums = g_new0 (guint64, dest_width * PIXEL_BYTES);
+	self->src_y = 0;
+	self->dest_y = 0;
+	self->rows = 0;
+	return self;
+}
+
+static void write_dest_row (GthRowScaler *self) {
+	guint64 *sum = self->sums;
+	guchar *p_dest = self->dest_row;
+	for (guint x = 0; x < self->dest_width; x++) {
+		guint64 n = (guint64) self->column_size[x] * self->rows;
+		for (int c = 0; c < PIXEL_BYTES; c++) {
+			p_dest[c] = (guchar) ((sum[c] + (n / 2)) / n);
+		}
+		sum += PIXEL_BYTES;
+		p_dest += PIXEL_BYTES;
+	}
+	memset (self->sums, 0, sizeof (guint64) * self->dest_width * PIXEL_BYTES);
+	self->dest_row += self->dest_row_stride;
+	self->dest_y++;
+	self->rows = 0;
+}
+
+void gth_row_scaler_add_row (GthRowScaler *self, const guchar *row) {
+	if (self->src_y >= self->src_height) {
+		return;
+	}
+
+	const guchar *p_src = row;
+	for (guint x = 0; x < self->src_width; x++) {
+		guint64 *sum = self->sums + (self->dest_column[x] * PIXEL_BYTES);
+		sum[0] += p_src[0];
+		sum[1] += p_src[1];
+		sum[2] += p_src[2];
+		sum[3] += p_src[3];
+		p_src += PIXEL_BYTES;
+	}
+	self->rows++;
+	self->src_y++;
+
+	// Write the destination row when the next source row belongs to the
+	// next one.
+	guint next_dest_y = (guint) (((guint64) self->src_y * self->dest_height) / self->src_height);
+	if (next_dest_y > self->dest_y) {
+		write_dest_row (self);
+	}
+}
+
+GthImage * gth_row_scaler_get_image (GthRowScaler *self) {
+	return g_object_ref (self->image);
+}
+
+void gth_row_scaler_free (GthRowScaler *self) {
+	if (self == NULL) {
+		return;
+	}
+	g_object_unref (self->image);
+	g_free (self->dest_column);
+	g_free (self->column_size);
+	g_free (self->sums);
+	g_free (self);
+}
@@ -0,0 +1,24 @@
+#ifndef GTH_ROW_SCALER_H
+#define GTH_ROW_SCALER_H
+
+#include <glib.h>
+#include "lib/gth-image.h"
+
+G_BEGIN_DECLS
+
+// Reduces an image while it's decoded, one source row at a time, so the
+// full size image is never allocated.  Each destination pixel is the
+// average of the source pixels it covers (box filter), the rows must be
+// in the pixel format and the destination size can't be larger than the
+// source size.
+
+typedef struct _GthRowScaler GthRowScaler;
+
+GthRowScaler * gth_row_scaler_new (guint src_width, guint src_height, guint dest_width, guint dest_height);
+void gth_row_scaler_add_row (GthRowScaler *self, const guchar *row);
+GthImage * gth_row_scaler_get_image (GthRowScaler *self);
+void gth_row_scaler_free (GthRowScaler *self);
+
+G_END_DECLS
+
+#endif /* GTH_ROW_SCALER_H */
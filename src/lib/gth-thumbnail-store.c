@@ -0,0 +1,596 @@
+#include <config.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include "lib/gth-thumbnail-store.h"
+
+#define INDEX_MAGIC "GTHTHUMB"
+#define INDEX_VERSION 2
+#define MIN_CAPACITY 4096
+#define KEY_SIZE 16 // MD5 digest of the uri.
+#define MAX_RECORD_SIZE (64 * 1024 * 1024)
+
+// The records are written to the data file of the current generation.
+// When it is full a new generation starts and the data file of the
+// previous one is emptied and reused, this way the thumbnails not used
+// during the last two generations are removed, as well as the space of the
+// replaced thumbnails.  Reading a thumbnail of the previous generation
+// copies it to the current one.
+
+typedef struct {
+	char magic[8];
+	guint32 version;
+	guint32 capacity;
+	guint32 count;
+	guint32 generation; // Current generation.
+} IndexHeader;
+
+typedef struct {
+	guint8 key[KEY_SIZE];
+	gint64 mtime;
+	guint64 offset;
+	guint32 size; // 0 if the entry is empty.
+	guint32 generation;
+} IndexEntry;
+
+// Each record in the data file is a header followed by the uri, the color
+// profile and the compressed pixels.
+typedef struct {
+	guint32 uri_size;
+	guint32 width;
+	guint32 height;
+	guint32 has_alpha;
+	guint32 original_width; // 0 if not known.
+	guint32 original_height;
+	guint32 profile_type;
+	guint32 profile_size;
+	double gamma;
+	guint32 pixels_size;
+	guint32 reserved;
+} RecordHeader;
+
+struct _GthThumbnailStorePrivate {
+	GMutex mutex;
+	char *index_path;
+	char *data_path[2]; // Indexed by generation % 2.
+	char *old_data_path; // The data file of the first version.
+	guint64 max_data_size;
+	gboolean opened;
+	int index_fd;
+	int data_fd[2];
+	IndexHeader *index;
+	gsize index_size;
+};
+
+G_DEFINE_TYPE_WITH_CODE (GthThumbnailStore, gth_thumbnail_store, G_TYPE_OBJECT, G_ADD_PRIVATE (GthThumbnailStore))
+
+static void close_index (GthThumbnailStorePrivate *priv) {
+	if (priv->index != NULL) {
+		munmap (priv->index, priv->index_size);
+		priv->index = NULL;
+		priv->index_size = 0;
+	}
+	if (priv->index_fd >= 0) {
+		close (priv->index_fd);
+		priv->index_fd = -1;
+	}
+}
+
+static void gth_thumbnail_store_finalize (GObject *object) {
+	GthThumbnailStore *self = GTH_THUMBNAIL_STORE (object);
+	close_index (self->priv);
+	for (int i = 0; i < 2; i++) {
+		if (self->priv->data_fd[i] >= 0) {
+			close (self->priv->data_fd[i]);
+		}
+		g_free (self->priv->data_path[i]);
+	}
+	g_free (self->priv->index_path);
+	g_free (self->priv->old_data_path);
+	g_mutex_clear (&self->priv->mutex);
+	G_OBJECT_CLASS (gth_thumbnail_store_parent_class)->finalize (object);
+}
+
+static void gth_thumbnail_store_class_init (GthThumbnailStoreClass *klass) {
+	GObjectClass *object_class = (GObjectClass*) klass;
+	object_class->finalize = gth_thumbnail_store_finalize;
+}
+
+static void gth_thumbnail_store_init (GthThumbnailStore *self) {
+	self->priv = gth_thumbnail_store_get_instance_private (self);
+	g_mutex_init (&self->priv->mutex);
+	self->priv->index_path = NULL;
+	self->priv->data_path[0] = NULL;
+	self->priv->data_path[1] = NULL;
+	self->priv->old_data_path = NULL;
+	self->priv->max_data_size = 0;
+	self->priv->opened = FALSE;
+	self->priv->index_fd = -1;
+	self->priv->data_fd[0] = -1;
+	self->priv->data_fd[1] = -1;
+	self->priv->index = NULL;
+	self->priv->index_size = 0;
+}
+
+// path is the store filename without extension, max_data_size is the
+// maximum size of the data files.
+GthThumbnailStore * gth_thumbnail_store_new (const char *path, guint64 max_data_size) {
+	GthThumbnailStore *self = (GthThumbnailStore *) g_object_new (GTH_TYPE_THUMBNAIL_STORE, NULL);
+	self->priv->index_path = g_strconcat (path, ".index", NULL);
+	self->priv->data_path[0] = g_strconcat (path, ".data.0", NULL);
+	self->priv->data_path[1] = g_strconcat (path, ".data.1", NULL);
+	self->priv->old_data_path = g_strconcat (path, ".data", NULL);
+	self->priv->max_data_size = max_data_size;
+	return self;
+}
+
+static gsize get_index_size (guint32 capacity) {
+	return sizeof (IndexHeader) + ((gsize) capacity * sizeof (IndexEntry));
+}
+
+static IndexEntry * get_entries (IndexHeader *index) {
+	return (IndexEntry *) (index + 1);
+}
+
+// Creates an empty index with the given capacity.
+static gboolean create_index (const char *path, guint32 capacity, int *fd, IndexHeader **index, gsize *size) {
+	*size = get_index_size (capacity);
+	*fd = g_open (path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (*fd < 0) {
+		return FALSE;
+	}
+	if (ftruncate (*fd, *size) != 0) {
+		close (*fd);
+		return FALSE;
+	}
+	*index = mmap (NULL, *size, PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0);
+	if (*index == MAP_FAILED) {
+		close (*fd);
+		return FALSE;
+	}
+	memcpy ((*index)->magic, INDEX_MAGIC, sizeof ((*index)->magic));
+	(*index)->version = INDEX_VERSION;
+	(*index)->capacity = capacity;
+	(*index)->count = 0;
+	(*index)->generation = 0;
+	return TRUE;
+}
+
+// Maps the existing index if valid.
+static gboolean map_index (GthThumbnailStorePrivate *priv) {
+	priv->index_fd = g_open (priv->index_path, O_RDWR, 0);
+	if (priv->index_fd < 0) {
+		return FALSE;
+	}
+	struct stat st;
+	if ((fstat (priv->index_fd, &st) != 0) || (st.st_size < (off_t) sizeof (IndexHeader))) {
+		close_index (priv);
+		return FALSE;
+	}
+	priv->index_size = st.st_size;
+	priv->index = mmap (NULL, priv->index_size, PROT_READ | PROT_WRITE, MAP_SHARED, priv->index_fd, 0);
+	if (priv->index == MAP_FAILED) {
+		priv->index = NULL;
+		close_index (priv);
+		return FALSE;
+	}
+	if ((memcmp (priv->index->magic, INDEX_MAGIC, sizeof (priv->index->magic)) != 0)
+		|| (priv->index->version != INDEX_VERSION)
+		|| (priv->index->capacity < MIN_CAPACITY)
+		|| (get_index_size (priv->index->capacity) != priv->index_size)
+		|| (priv->index->count >= priv->index->capacity))
+	{
+		close_index (priv);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+// Opens the files the first time, the mutex must be locked.
+static gboolean open_store (GthThumbnailStorePrivate *priv) {
+	if (priv->opened) {
+		return priv->index != NULL;
+	}
+	priv->opened = TRUE;
+
+	gboolean new_index = FALSE;
+	if (!map_index (priv)) {
+		if (!create_index (priv->index_path, MIN_CAPACITY, &priv->index_fd, &priv->index, &priv->index_size)) {
+			priv->index = NULL;
+			priv->index_fd = -1;
+			return FALSE;
+		}
+		new_index = TRUE;
+	}
+
+	// The data of a new index is not valid.
+	int flags = O_RDWR | O_CREAT;
+	if (new_index) {
+		flags |= O_TRUNC;
+		g_unlink (priv->old_data_path);
+	}
+	for (int i = 0; i < 2; i++) {
+		priv->data_fd[i] = g_open (priv->data_path[i], flags, 0600);
+		if (priv->data_fd[i] < 0) {
+			close_index (priv);
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+static int get_data_fd (GthThumbnailStorePrivate *priv, guint32 generation) {
+	return priv->data_fd[generation % 2];
+}
+
+// Whether the entry refers to the current or the previous generation.
+static gboolean entry_is_valid (IndexHeader *index, IndexEntry *entry) {
+	return (entry->size > 0)
+		&& ((entry->generation == index->generation)
+			|| (entry->generation + 1 == index->generation));
+}
+
+static void get_key (const char *uri, guint8 *key) {
+	GChecksum *checksum = g_checksum_new (G_CHECKSUM_MD5);
+	g_checksum_update (checksum, (const guchar *) uri, -1);
+	gsize size = KEY_SIZE;
+	g_checksum_get_digest (checksum, key, &size);
+	g_checksum_free (checksum);
+}
+
+// Returns the entry with the given key or the empty entry where to add it.
+// The index is never full.
+static IndexEntry * find_entry (IndexHeader *index, const guint8 *key) {
+	IndexEntry *entries = get_entries (index);
+	guint32 hash;
+	memcpy (&hash, key, sizeof (hash));
+	guint32 i = hash % index->capacity;
+	while (TRUE) {
+		IndexEntry *entry = entries + i;
+		if ((entry->size == 0) || (memcmp (entry->key, key, KEY_SIZE) == 0)) {
+			return entry;
+		}
+		i = (i + 1) % index->capacity;
+	}
+}
+
+// Replaces the index with one with the given capacity and generation,
+// keeping only the entries still valid in that generation.  The mutex must
+// be locked.
+static gboolean rebuild_index (GthThumbnailStorePrivate *priv, guint32 capacity, guint32 generation) {
+	char *tmp_path = g_strconcat (priv->index_path, ".tmp", NULL);
+	int fd;
+	IndexHeader *index;
+	gsize size;
+	if (!create_index (tmp_path, capacity, &fd, &index, &size)) {
+		g_free (tmp_path);
+		return FALSE;
+	}
+	index->generation = generation;
+
+	IndexEntry *entries = get_entries (priv->index);
+	for (guint32 i = 0; i < priv->index->capacity; i++) {
+		if (entry_is_valid (index, entries + i)) {
+			IndexEntry *entry = find_entry (index, entries[i].key);
+			*entry = entries[i];
+			index->count++;
+		}
+	}
+
+	if (g_rename (tmp_path, priv->index_path) != 0) {
+		munmap (index, size);
+		close (fd);
+		g_unlink (tmp_path);
+		g_free (tmp_path);
+		return FALSE;
+	}
+	g_free (tmp_path);
+
+	close_index (priv);
+	priv->index_fd = fd;
+	priv->index = index;
+	priv->index_size = size;
+	return TRUE;
+}
+
+// Starts a new generation, removing the thumbnails of the previous one.
+// The mutex must be locked.
+static gboolean start_new_generation (GthThumbnailStorePrivate *priv) {
+	guint32 generation = priv->index->generation + 1;
+	// The index doesn't refer to the data file to reuse after this.
+	if (!rebuild_index (priv, priv->index->capacity, generation)) {
+		return FALSE;
+	}
+	return ftruncate (get_data_fd (priv, generation), 0) == 0;
+}
+
+// Removes all the thumbnails, the mutex must be locked.
+static void reset_store (GthThumbnailStorePrivate *priv) {
+	memset (get_entries (priv->index), 0, (gsize) priv->index->capacity * sizeof (IndexEntry));
+	priv->index->count = 0;
+	for (int i = 0; i < 2; i++) {
+		if (ftruncate (priv->data_fd[i], 0) != 0) {
+			// Ignore, the entries have been removed anyway.
+		}
+	}
+}
+
+static gboolean read_all (int fd, guint8 *buffer, gsize size, off_t offset) {
+	while (size > 0) {
+		ssize_t n = pread (fd, buffer, size, offset);
+		if (n <= 0) {
+			return FALSE;
+		}
+		buffer += n;
+		size -= n;
+		offset += n;
+	}
+	return TRUE;
+}
+
+static gboolean write_all (int fd, const guint8 *buffer, gsize size, off_t offset) {
+	while (size > 0) {
+		ssize_t n = pwrite (fd, buffer, size, offset);
+		if (n <= 0) {
+			return FALSE;
+		}
+		buffer += n;
+		size -= n;
+		offset += n;
+	}
+	return TRUE;
+}
+
+// Writes the record in the data file of the current generation and updates
+// the index.  The mutex must be locked.
+static gboolean append_record (GthThumbnailStorePrivate *priv, const guint8 *key, gint64 mtime, const guint8 *record, gsize record_size) {
+	guint64 max_generation_size = priv->max_data_size / 2;
+	if (record_size > max_generation_size) {
+		return FALSE;
+	}
+
+	off_t offset = lseek (get_data_fd (priv, priv->index->generation), 0, SEEK_END);
+	if (offset < 0) {
+		return FALSE;
+	}
+	if ((guint64) offset + record_size > max_generation_size) {
+		if (!start_new_generation (priv)) {
+			return FALSE;
+		}
+		offset = 0;
+	}
+
+	// Write the data before updating the index, this way the index
+	// doesn't refer to missing data.
+	if (!write_all (get_data_fd (priv, priv->index->generation), record, record_size, offset)) {
+		return FALSE;
+	}
+
+	IndexEntry *entry = find_entry (priv->index, key);
+	if (entry->size == 0) {
+		// Keep the load factor under 3/4.
+		if (((guint64) priv->index->count + 1) * 4 > (guint64) priv->index->capacity * 3) {
+			if (!rebuild_index (priv, priv->index->capacity * 2, priv->index->generation)) {
+				return FALSE;
+			}
+			entry = find_entry (priv->index, key);
+		}
+		priv->index->count++;
+	}
+	memcpy (entry->key, key, KEY_SIZE);
+	entry->mtime = mtime;
+	entry->offset = offset;
+	entry->size = record_size;
+	entry->generation = priv->index->generation;
+	return TRUE;
+}
+
+static GthIccProfile * profile_from_record (RecordHeader *header, const guint8 *data) {
+	GthIccProfile *profile = NULL;
+	switch ((GthIccType) header->profile_type) {
+	case GTH_ICC_TYPE_SRGB:
+		profile = gth_icc_profile_new_srgb ();
+		break;
+	case GTH_ICC_TYPE_ADOBERGB:
+		profile = gth_icc_profile_new_adobergb ();
+		break;
+	case GTH_ICC_TYPE_SRGB_GAMMA:
+		profile = gth_icc_profile_new_srgb_with_gamma (header->gamma);
+		break;
+	case GTH_ICC_TYPE_BYTES:
+		if (header->profile_size > 0) {
+			GBytes *bytes = g_bytes_new (data, header->profile_size);
+			profile = gth_icc_profile_new_from_bytes (bytes, NULL);
+			g_bytes_unref (bytes);
+		}
+		break;
+	default:
+		break;
+	}
+	return profile;
+}
+
+// Returns the thumbnail of the file with the given uri if the modification
+// time matches, NULL otherwise.
+GthImage * gth_thumbnail_store_lookup (GthThumbnailStore *self, const char *uri, gint64 mtime) {
+	g_return_val_if_fail (GTH_IS_THUMBNAIL_STORE (self), NULL);
+
+	guint8 key[KEY_SIZE];
+	get_key (uri, key);
+
+	GthThumbnailStorePrivate *priv = self->priv;
+	g_mutex_lock (&priv->mutex);
+	if (!open_store (priv)) {
+		g_mutex_unlock (&priv->mutex);
+		return NULL;
+	}
+	IndexEntry *entry = find_entry (priv->index, key);
+	if (!entry_is_valid (priv->index, entry)
+		|| (entry->size < sizeof (RecordHeader))
+		|| (entry->size > MAX_RECORD_SIZE)
+		|| (entry->mtime != mtime))
+	{
+		g_mutex_unlock (&priv->mutex);
+		return NULL;
+	}
+	gsize record_size = entry->size;
+	guint8 *record = g_malloc (record_size);
+	gboolean valid = read_all (get_data_fd (priv, entry->generation), record, record_size, (off_t) entry->offset);
+
+	RecordHeader header;
+	memcpy (&header, record, sizeof (RecordHeader));
+	gsize uri_size = strlen (uri);
+	valid = valid
+		&& (header.uri_size == uri_size)
+		&& (sizeof (RecordHeader) + (guint64) header.uri_size + header.profile_size + header.pixels_size == record_size)
+		&& (header.width > 0)
+		&& (header.height > 0)
+		&& (memcmp (record + sizeof (RecordHeader), uri, uri_size) == 0);
+
+	// Keep the thumbnails in use.
+	if (valid && (entry->generation != priv->index->generation)) {
+		append_record (priv, key, mtime, record, record_size);
+	}
+	g_mutex_unlock (&priv->mutex);
+
+	if (!valid) {
+		g_free (record);
+		return NULL;
+	}
+
+	GthImage *image = gth_image_new (header.width, header.height);
+	if (image == NULL) {
+		g_free (record);
+		return NULL;
+	}
+	gsize pixels_size;
+	guchar *pixels = gth_image_get_pixels (image, &pixels_size);
+	uLongf uncompressed_size = pixels_size;
+	const guint8 *profile_data = record + sizeof (RecordHeader) + header.uri_size;
+	const guint8 *compressed = profile_data + header.profile_size;
+	if ((uncompress (pixels, &uncompressed_size, compressed, header.pixels_size) != Z_OK)
+		|| (uncompressed_size != pixels_size))
+	{
+		g_object_unref (image);
+		g_free (record);
+		return NULL;
+	}
+
+	gth_image_set_has_alpha (image, header.has_alpha != 0);
+	if ((header.original_width > 0) && (header.original_height > 0)) {
+		gth_image_set_original_image_size (image, header.original_width, header.original_height);
+	}
+	GthIccProfile *profile = profile_from_record (&header, profile_data);
+	if (profile != NULL) {
+		gth_image_set_icc_profile (image, profile);
+		g_object_unref (profile);
+	}
+
+	g_free (record);
+	return image;
+}
+
+// Adds or replaces the thumbnail of the file with the given uri.
+void gth_thumbnail_store_add (GthThumbnailStore *self, const char *uri, gint64 mtime, GthImage *thumbnail) {
+	g_return_if_fail (GTH_IS_THUMBNAIL_STORE (self));
+	g_return_if_fail (GTH_IS_IMAGE (thumbnail));
+
+	gsize pixels_size;
+	const guchar *pixels = gth_image_get_pixels (thumbnail, &pixels_size);
+	if ((pixels == NULL) || (pixels_size == 0)) {
+		return;
+	}
+
+	RecordHeader header = { 0, };
+	header.uri_size = strlen (uri);
+	header.width = gth_image_get_width (thumbnail);
+	header.height = gth_image_get_height (thumbnail);
+	header.has_alpha = gth_image_get_has_alpha_if_valid (thumbnail);
+	gth_image_get_original_image_size (thumbnail, &header.original_width, &header.original_height);
+
+	GBytes *profile_bytes = NULL;
+	GthIccProfile *profile = gth_image_get_icc_profile (thumbnail);
+	header.profile_type = (profile != NULL) ? gth_icc_profile_get_known_type (profile) : GTH_ICC_TYPE_UNKNOWN;
+	if (header.profile_type == GTH_ICC_TYPE_SRGB_GAMMA) {
+		header.gamma = gth_icc_profile_get_gamma (profile);
+	}
+	else if (header.profile_type == GTH_ICC_TYPE_BYTES) {
+		profile_bytes = gth_icc_profile_get_bytes (profile);
+		if (profile_bytes != NULL) {
+			header.profile_size = g_bytes_get_size (profile_bytes);
+		}
+	}
+
+	// Thumbnails are compressed with the fastest level, loading them is
+	// more important than saving space.
+	uLongf compressed_size = compressBound (pixels_size);
+	gsize record_size = sizeof (RecordHeader) + header.uri_size + header.profile_size + compressed_size;
+	guint8 *record = g_malloc (record_size);
+	guint8 *compressed = record + sizeof (RecordHeader) + header.uri_size + header.profile_size;
+	if (compress2 (compressed, &compressed_size, pixels, pixels_size, Z_BEST_SPEED) != Z_OK) {
+		g_free (record);
+		if (profile_bytes != NULL) {
+			g_bytes_unref (profile_bytes);
+		}
+		return;
+	}
+	header.pixels_size = compressed_size;
+	record_size = sizeof (RecordHeader) + header.uri_size + header.profile_size + compressed_size;
+	memcpy (record, &header, sizeof (RecordHeader));
+	memcpy (record + sizeof (RecordHeader), uri, header.uri_size);
+	if (profile_bytes != NULL) {
+		memcpy (record + sizeof (RecordHeader) + header.uri_size, g_bytes_get_data (profile_bytes, NULL), header.profile_size);
+		g_bytes_unref (profile_bytes);
+	}
+
+	guint8 key[KEY_SIZE];
+	get_key (uri, key);
+
+	GthThumbnailStorePrivate *priv = self->priv;
+	g_mutex_lock (&priv->mutex);
+	if (!open_store (priv)) {
+		g_mutex_unlock (&priv->mutex);
+		g_free (record);
+		return;
+	}
+
+	append_record (priv, key, mtime, record, record_size);
+	g_mutex_unlock (&priv->mutex);
+
+	g_free (record);
+}
+
+// Sets valid[i] to TRUE if the store contains a thumbnail for uris[i] with
+// modification time mtimes[i].  Only the index is read.
+void gth_thumbnail_store_validate (GthThumbnailStore *self, const char **uris, const gint64 *mtimes, gboolean *valid, guint n_files) {
+	g_return_if_fail (GTH_IS_THUMBNAIL_STORE (self));
+
+	GthThumbnailStorePrivate *priv = self->priv;
+	g_mutex_lock (&priv->mutex);
+	if (!open_store (priv)) {
+		g_mutex_unlock (&priv->mutex);
+		memset (valid, 0, n_files * sizeof (gboolean));
+		return;
+	}
+	for (guint i = 0; i < n_files; i++) {
+		guint8 key[KEY_SIZE];
+		get_key (uris[i], key);
+		IndexEntry *entry = find_entry (priv->index, key);
+		valid[i] = entry_is_valid (priv->index, entry) && (entry->mtime == mtimes[i]);
+	}
+	g_mutex_unlock (&priv->mutex);
+}
+
+void gth_thumbnail_store_clear (GthThumbnailStore *self) {
+	g_return_if_fail (GTH_IS_THUMBNAIL_STORE (self));
+	g_mutex_lock (&self->priv->mutex);
+	if (open_store (self->priv)) {
+		reset_store (self->priv);
+	}
+	g_mutex_unlock (&self->priv->mutex);
+}
@@ -0,0 +1,46 @@
+#ifndef GTH_THUMBNAIL_STORE_H
+#define GTH_THUMBNAIL_STORE_H
+
+#include <glib.h>
+#include <glib-object.h>
+#include "lib/gth-image.h"
+
+G_BEGIN_DECLS
+
+// A cache of decoded thumbnails kept in append-only data files with the
+// compressed pixels, and an index, a memory-mapped hash table from the file
+// uri to the position of its thumbnail in the data files.  When the data
+// files are full the thumbnails not used recently are removed.
+// The store is used before the freedesktop thumbnails, which are still
+// saved for the other applications.
+
+#define GTH_TYPE_THUMBNAIL_STORE (gth_thumbnail_store_get_type ())
+#define GTH_THUMBNAIL_STORE(o) (G_TYPE_CHECK_INSTANCE_CAST ((o), GTH_TYPE_THUMBNAIL_STORE, GthThumbnailStore))
+#define GTH_THUMBNAIL_STORE_CLASS(k) (G_TYPE_CHECK_CLASS_CAST ((k), GTH_TYPE_THUMBNAIL_STORE, GthThumbnailStoreClass))
+#define GTH_IS_THUMBNAIL_STORE(o) (G_TYPE_CHECK_INSTANCE_TYPE ((o), GTH_TYPE_THUMBNAIL_STORE))
+#define GTH_IS_THUMBNAIL_STORE_CLASS(k) (G_TYPE_CHECK_CLASS_TYPE ((k), GTH_TYPE_THUMBNAIL_STORE))
+#define GTH_THUMBNAIL_STORE_GET_CLASS(o) (G_TYPE_INSTANCE_GET_CLASS((o), GTH_TYPE_THUMBNAIL_STORE, GthThumbnailStoreClass))
+
+typedef struct _GthThumbnailStore GthThumbnailStore;
+typedef struct _GthThumbnailStorePrivate GthThumbnailStorePrivate;
+typedef struct _GthThumbnailStoreClass GthThumbnailStoreClass;
+
+struct _GthThumbnailStore {
+	GObject __parent;
+	GthThumbnailStorePrivate *priv;
+};
+
+struct _GthThumbnailStoreClass {
+	GObjectClass __parent_class;
+};
+
+GType gth_thumbnail_store_get_type (void) G_GNUC_CONST;
+GthThumbnailStore * gth_thumbnail_store_new (const char *path, guint64 max_data_size);
+GthImage * gth_thumbnail_store_lookup (GthThumbnailStore *self, const char *uri, gint64 mtime);
+void gth_thumbnail_store_add (GthThumbnailStore *self, const char *uri, gint64 mtime, GthImage *thumbnail);
+void gth_thumbnail_store_validate (GthThumbnailStore *self, const char **uris, const gint64 *mtimes, gboolean *valid, guint n_files);
+void gth_thumbnail_store_clear (GthThumbnailStore *self);
+
+G_END_DECLS
+
+#endif /* GTH_THUMBNAIL_STORE_H */
@@ -1,3 +1,4 @@
+#include <string.h>
 #include "image-info.h"
 #include "svg-info.h"
 #include "lib/util.h"
@@ -25,37 +26,84 @@
 #define BUFFER_SIZE 4096
 
 
-gboolean load_image_info_from_stream (GInputStream *stream, int *width, int *height, GCancellable *cancellable) {
-	int buffer_size = BUFFER_SIZE;
-	guchar *buffer = g_new (guchar, buffer_size);
+static guint32 _read_uint32_be (const guchar *p) {
+	return ((guint32) p[0] << 24) + ((guint32) p[1] << 16) + ((guint32) p[2] << 8) + (guint32) p[3];
+}
+
+
+static gboolean load_png_header (const guchar *buffer, gsize size, GthImageInfo *image_info) {
+	if ((size < 26)
+		// IHDR Image header
+		|| (buffer[12] != 0x49)
+		|| (buffer[13] != 0x48)
+		|| (buffer[14] != 0x44)
+		|| (buffer[15] != 0x52))
+	{
+		return FALSE;
+	}
+
+	image_info->width = _read_uint32_be (buffer + 16);
+	image_info->height = _read_uint32_be (buffer + 20);
+	guchar color_type = buffer[25];
+	image_info->has_alpha = (color_type == 4) || (color_type == 6);
+
+	// Look for transparency and animation control chunks, they must
+	// appear before the image data.
+	gsize offset = 8;
+	while (offset + 8 <= size) {
+		guint32 length = _read_uint32_be (buffer + offset);
+		const guchar *type = buffer + offset + 4;
+		if (memcmp (type, "IDAT", 4) == 0) {
+			break;
+		}
+		if (memcmp (type, "tRNS", 4) == 0) {
+			image_info->has_alpha = TRUE;
+		}
+		else if ((memcmp (type, "acTL", 4) == 0) && (offset + 12 <= size)) {
+			image_info->frames = _read_uint32_be (buffer + offset + 8);
+		}
+		if (length > size) {
+			break;
+		}
+		offset += length + 12;
+	}
+	return TRUE;
+}
+
+
+void gth_image_info_init (GthImageInfo *image_info) {
+	image_info->width = 0;
+	image_info->height = 0;
+	image_info->orientation = GTH_TRANSFORM_NONE;
+	image_info->has_alpha = FALSE;
+	image_info->frames = 1;
+}
+
+
+gboolean load_image_header_from_stream (GInputStream *stream, GthImageInfo *image_info, GCancellable *cancellable) {
+	gth_image_info_init (image_info);
+
+	guchar *buffer = g_new (guchar, BUFFER_SIZE);
 	gsize size;
-	if (!g_input_stream_read_all (stream, buffer, buffer_size,
+	if (!g_input_stream_read_all (stream, buffer, BUFFER_SIZE,
 		&size, cancellable, NULL))
 	{
 		g_free (buffer);
 		return FALSE;
 	}
 
-	GthImageInfo image_info;
 	gboolean format_recognized = FALSE;
-	const char *mime_type = guess_content_type (buffer, buffer_size);
+	const char *mime_type = guess_content_type (buffer, size);
 	// g_print ("> mime_type: %s\n", mime_type);
 	if (mime_type == NULL) {
+		g_free (buffer);
 		return FALSE;
 	}
 
-	if ((size >= 24)
-		&& (g_strcmp0 (mime_type, "image/png") == 0)
-		// IHDR Image header
-		&& (buffer[12] == 0x49)
-		&& (buffer[13] == 0x48)
-		&& (buffer[14] == 0x44)
-		&& (buffer[15] == 0x52))
-	{
-		// PNG
-		image_info.width  = (buffer[16] << 24) + (buffer[17] << 16) + (buffer[18] << 8) + buffer[19];
-		image_info.height = (buffer[20] << 24) + (buffer[21] << 16) + (buffer[22] << 8) + buffer[23];
-		format_recognized = TRUE;
+	if (g_strcmp0 (mime_type, "image/png") == 0) {
+		if (load_png_header (buffer, size, image_info)) {
+			format_recognized = TRUE;
+		}
 	}
 
 	if (!format_recognized
@@ -63,7 +111,7 @@ gboolean load_image_info_from_stream (GInputStream *stream, int *width, int *hei
 		&& (g_strcmp0 (mime_type, "image/jpeg") == 0))
 	{
 		// JPEG
-		if (load_jpeg_info (stream, &image_info, cancellable)) {
+		if (load_jpeg_info (stream, image_info, cancellable)) {
 			format_recognized = TRUE;
 		}
 	}
@@ -73,22 +121,21 @@ gboolean load_image_info_from_stream (GInputStream *stream, int *width, int *hei
 		&& (size > 15)
 		&& (g_strcmp0 (mime_type, "image/webp") == 0))
 	{
-		WebPDecoderConfig config;
-
-		if (WebPInitDecoderConfig (&config)) {
-			if (WebPGetFeatures (buffer, buffer_size, &config.input) == VP8_STATUS_OK) {
-				image_info.width = config.input.width;
-				image_info.height = config.input.height;
-				format_recognized = TRUE;
-			}
-			WebPFreeDecBuffer (&config.output);
+		// Only parses the VP8/VP8L/VP8X headers.
+		WebPBitstreamFeatures features;
+		if (WebPGetFeatures (buffer, size, &features) == VP8_STATUS_OK) {
+			image_info->width = features.width;
+			image_info->height = features.height;
+			image_info->has_alpha = features.has_alpha;
+			image_info->frames = features.has_animation ? 0 : 1;
+			format_recognized = TRUE;
 		}
 	}
 #endif /* HAVE_LIBWEBP */
 
 #if HAVE_LIBJXL
 	if (!format_recognized && (size >= 12)) {
-		if (load_jxl_info (stream, &image_info, buffer, size, cancellable)) {
+		if (load_jxl_info (stream, image_info, buffer, size, cancellable)) {
 			format_recognized = TRUE;
 		}
 	}
@@ -100,7 +147,7 @@ gboolean load_image_info_from_stream (GInputStream *stream, int *width, int *hei
 		&& ((g_strcmp0 (mime_type, "image/heic") == 0)
 			|| (g_strcmp0 (mime_type, "image/avif") == 0)))
 	{
-		if (load_heif_info (stream, &image_info, buffer, size, cancellable)) {
+		if (load_heif_info (stream, image_info, buffer, size, cancellable)) {
 			format_recognized = TRUE;
 		}
 	}
@@ -108,7 +155,7 @@ gboolean load_image_info_from_stream (GInputStream *stream, int *width, int *hei
 
 #if HAVE_LIBTIFF
 	if (!format_recognized && (g_strcmp0 (mime_type, "image/tiff") == 0)) {
-		if (load_tiff_info (stream, &image_info, cancellable)) {
+		if (load_tiff_info (stream, image_info, cancellable)) {
 			format_recognized = TRUE;
 		}
 	}
@@ -116,7 +163,7 @@ gboolean load_image_info_from_stream (GInputStream *stream, int *width, int *hei
 
 #if HAVE_LIBGIF
 	if (!format_recognized && (g_strcmp0 (mime_type, "image/gif") == 0)) {
-		if (load_gif_info (buffer, buffer_size, &image_info, cancellable)) {
+		if (load_gif_info (buffer, size, image_info, cancellable)) {
 			format_recognized = TRUE;
 		}
 	}
@@ -124,43 +171,95 @@ gboolean load_image_info_from_stream (GInputStream *stream, int *width, int *hei
 
 #if HAVE_LIBRAW
 	if (!format_recognized && _g_content_type_is_raw (mime_type)) {
-		if (load_raw_info (stream, &image_info, cancellable)) {
+		if (load_raw_info (stream, image_info, cancellable)) {
 			format_recognized = TRUE;
 		}
 	}
 #endif /* HAVE_LIBRAW */
 
 	if (!format_recognized && (g_strcmp0 (mime_type, "image/svg+xml") == 0)) {
-		if (load_svg_info ((const char *) buffer, buffer_size, &image_info, cancellable)) {
+		if (load_svg_info ((const char *) buffer, size, image_info, cancellable)) {
 			format_recognized = TRUE;
 		}
 	}
 
 	g_free (buffer);
 
-	if (width != NULL)
-		*width = image_info.width;
-	if (height != NULL)
-		*height = image_info.height;
-
 	return format_recognized;
 }
 
-gboolean load_image_info_from_bytes (GBytes *bytes, int *width, int *height, GCancellable *cancellable) {
+gboolean load_image_header_from_bytes (GBytes *bytes, GthImageInfo *image_info, GCancellable *cancellable) {
 	GInputStream *stream = g_memory_input_stream_new_from_bytes (bytes);
-	gboolean result = load_image_info_from_stream (stream, width, height, cancellable);
+	gboolean result = load_image_header_from_stream (stream, image_info, cancellable);
 	g_object_unref (stream);
 	return result;
 }
 
-gboolean load_image_info (GFile *file, int *width, int *height, GCancellable *cancellable) {
+// The content type is used for the formats that cannot be recognized from
+// the data, such as the RAW formats based on TIFF, whose first directory
+// often contains a small thumbnail.
+gboolean load_image_header_for_content_type (GBytes *bytes, const char *content_type, GthImageInfo *image_info, GCancellable *cancellable) {
+#if HAVE_LIBRAW
+	if (_g_content_type_is_raw (content_type)) {
+		gth_image_info_init (image_info);
+		GInputStream *stream = g_memory_input_stream_new_from_bytes (bytes);
+		gboolean result = load_raw_info (stream, image_info, cancellable);
+		g_object_unref (stream);
+		if (result) {
+			return TRUE;
+		}
+	}
+#endif /* HAVE_LIBRAW */
+	return load_image_header_from_bytes (bytes, image_info, cancellable);
+}
+
+gboolean load_image_header (GFile *file, GthImageInfo *image_info, GCancellable *cancellable) {
 	GFileInputStream *file_stream = g_file_read (file, cancellable, NULL);
 	if (file_stream == NULL) {
 		return FALSE;
 	}
 	GInputStream *buffered = g_buffered_input_stream_new_sized (G_INPUT_STREAM (file_stream), BUFFER_SIZE);
-	gboolean result = load_image_info_from_stream (buffered, width, height, cancellable);
+	gboolean result = load_image_header_from_stream (buffered, image_info, cancellable);
 	g_object_unref (buffered);
 	g_object_unref (file_stream);
 	return result;
 }
+
+// Returns the size of the image as displayed, after applying the orientation.
+void gth_image_info_get_oriented_size (GthImageInfo *image_info, int *width, int *height) {
+	g_return_if_fail (image_info != NULL);
+	gboolean swap = (image_info->orientation == GTH_TRANSFORM_ROTATE_90)
+		|| (image_info->orientation == GTH_TRANSFORM_ROTATE_270)
+		|| (image_info->orientation == GTH_TRANSFORM_TRANSPOSE)
+		|| (image_info->orientation == GTH_TRANSFORM_TRANSVERSE);
+	if (width != NULL)
+		*width = swap ? image_info->height : image_info->width;
+	if (height != NULL)
+		*height = swap ? image_info->width : image_info->height;
+}
+
+static gboolean get_oriented_size (gboolean success, GthImageInfo *image_info, int *width, int *height) {
+	if (!success) {
+		return FALSE;
+	}
+	gth_image_info_get_oriented_size (image_info, width, height);
+	return TRUE;
+}
+
+gboolean load_image_info_from_stream (GInputStream *stream, int *width, int *height, GCancellable *cancellable) {
+	GthImageInfo image_info;
+	gboolean success = load_image_header_from_stream (stream, &image_info, cancellable);
+	return get_oriented_size (success, &image_info, width, height);
+}
+
+gboolean load_image_info_from_bytes (GBytes *bytes, int *width, int *height, GCancellable *cancellable) {
+	GthImageInfo image_info;
+	gboolean success = load_image_header_from_bytes (bytes, &image_info, cancellable);
+	return get_oriented_size (success, &image_info, width, height);
+}
+
+gboolean load_image_info (GFile *file, int *width, int *height, GCancellable *cancellable) {
+	GthImageInfo image_info;
+	gboolean success = load_image_header (file, &image_info, cancellable);
+	return get_oriented_size (success, &image_info, width, height);
+}
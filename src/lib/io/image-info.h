@@ -6,13 +6,22 @@
 G_BEGIN_DECLS
 
 typedef struct {
-	int width;
+	int width; // Size of the image as stored, before applying the orientation.
 	int height;
+	GthTransform orientation;
+	gboolean has_alpha;
+	int frames; // 0 if unknown, for example for animations that must be scanned.
 } GthImageInfo;
 
+void gth_image_info_init (GthImageInfo *image_info);
+void gth_image_info_get_oriented_size (GthImageInfo *image_info, int *width, int *height);
 gboolean load_image_info (GFile *file, int *width, int *height, GCancellable *cancellable);
 gboolean load_image_info_from_bytes (GBytes *bytes, int *width, int *height, GCancellable *cancellable);
 gboolean load_image_info_from_stream (GInputStream *stream, int *width, int *height, GCancellable *cancellable);
+gboolean load_image_header (GFile *file, GthImageInfo *image_info, GCancellable *cancellable);
+gboolean load_image_header_from_bytes (GBytes *bytes, GthImageInfo *image_info, GCancellable *cancellable);
+gboolean load_image_header_from_stream (GInputStream *stream, GthImageInfo *image_info, GCancellable *cancellable);
+gboolean load_image_header_for_content_type (GBytes *bytes, const char *content_type, GthImageInfo *image_info, GCancellable *cancellable);
 
 G_END_DECLS
 
@@ -1,5 +1,6 @@
 #include <config.h>
 #include <math.h>
+#include <string.h>
 #include <gif_lib.h>
 #include "load-gif.h"
 
@@ -29,58 +30,138 @@ static const char *get_error_text (int code) {
 	return (str != NULL) ? str : "Undefined error";
 }
 
+// Frames are decoded on demand: the whole file is scanned once to read the
+// position and the control block of each frame, without decompressing the
+// image data.
+
 typedef struct {
-	ColorMapObject *color_map;
-	const uint8_t *screen_buffer;
-	int screen_row_size;
+	int offset; // Offset of the image descriptor.
 	GraphicsControlBlock gcb;
-	GthImage *prev_image;
-	int last_disposal_mode;
-	guint32 background_color;
-} RenderContext;
+} FrameInfo;
+
+typedef struct {
+	GBytes *bytes;
+	ReadData read_data;
+	GifFileType *file;
+	GArray *frames;
+	uint8_t *frame_buffer; // Color indexes of the current frame.
+} GifAnimation;
+
+static void gif_animation_free (GifAnimation *animation) {
+	if (animation->file != NULL) {
+		DGifCloseFile (animation->file, NULL);
+	}
+	g_array_unref (animation->frames);
+	g_free (animation->frame_buffer);
+	g_bytes_unref (animation->bytes);
+	g_free (animation);
+}
+
+static gboolean read_frame (GifAnimation *animation, FrameInfo *frame_info, GError **error) {
+	static const int InterlacedOffset[] = { 0, 4, 2, 1}; // The way Interlaced image should.
+	static const int InterlacedJumps[] = { 8, 8, 4, 2};  // be read - offsets and jumps...
+
+	GifFileType *file = animation->file;
+	animation->read_data.offset = frame_info->offset;
+	if (DGifGetImageDesc (file) == GIF_ERROR) {
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED, get_error_text (file->Error));
+		return FALSE;
+	}
+
+	// The descriptors are not needed, avoid accumulating them.
+	GifFreeSavedImages (file);
+	file->SavedImages = NULL;
+	file->ImageCount = 0;
+
+	int width = file->Image.Width;
+	int height = file->Image.Height;
+	if (file->Image.Interlace) {
+		// Need to perform 4 passes on the images:
+		for (int i = 0; i < 4; i++) {
+			for (int j = InterlacedOffset[i]; j < height; j += InterlacedJumps[i]) {
+				if (DGifGetLine (file, animation->frame_buffer + (j * width), width) == GIF_ERROR) {
+					g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED, get_error_text (file->Error));
+					return FALSE;
+				}
+			}
+		}
+	}
+	else {
+		uint8_t *row = animation->frame_buffer;
+		for (int i = 0; i < height; i++) {
+			if (DGifGetLine (file, row, width) == GIF_ERROR) {
+				g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED, get_error_text (file->Error));
+				return FALSE;
+			}
+			row += width;
+		}
+	}
+	return TRUE;
+}
+
+static GthImage * render_frame (guint frame_index, GthImage **background, gpointer user_data, GError **error) {
+	GifAnimation *animation = user_data;
+	GifFileType *file = animation->file;
+	FrameInfo *frame_info = &g_array_index (animation->frames, FrameInfo, frame_index);
+	if (!read_frame (animation, frame_info, error)) {
+		return NULL;
+	}
+
+	ColorMapObject *color_map = (file->Image.ColorMap ? file->Image.ColorMap : file->SColorMap);
+	if (color_map == NULL) {
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED, "Gif Image does not have a colormap.");
+		return NULL;
+	}
+
+	// Check that the background color is valid.
+	guint32 background_color = 0;
+	if ((file->SBackGroundColor >= 0)
+		&& (file->SBackGroundColor < color_map->ColorCount))
+	{
+		GifColorType *entry = &(color_map->Colors[file->SBackGroundColor]);
+		background_color = PACK_RGBA (entry->Red, entry->Green, entry->Blue, 0xFF);
+	}
+
+	int last_disposal_mode = DISPOSAL_UNSPECIFIED;
+	if (frame_index > 0) {
+		last_disposal_mode = g_array_index (animation->frames, FrameInfo, frame_index - 1).gcb.DisposalMode;
+	}
 
-static GthImage * render_frame (GifFileType *file, RenderContext *render_ctx) {
 	GthImage *image = gth_image_new (file->SWidth, file->SHeight);
 	if (image == NULL) {
-		//g_print (">> [1]\n");
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED, "Failed to create frame %u", frame_index);
 		return NULL;
 	}
+	gth_image_set_has_alpha (image, TRUE);
 	int image_row_stride;
 	guchar *image_row = gth_image_prepare_edit (image, &image_row_stride, NULL, NULL);
 	guchar *pixel_p;
 
+	GthImage *prev_image = *background;
 	int prev_image_row_stride;
 	guchar *prev_image_row = NULL;
 	guchar *prev_pixel_p = NULL;
-	gboolean has_previous_image = render_ctx->prev_image != NULL;
+	gboolean has_previous_image = prev_image != NULL;
 	if (has_previous_image) {
-		prev_image_row = gth_image_prepare_edit (render_ctx->prev_image, &prev_image_row_stride, NULL, NULL);
+		prev_image_row = gth_image_prepare_edit (prev_image, &prev_image_row_stride, NULL, NULL);
 	}
 
-	const uint8_t *screen_row;
+	int transparent_color = frame_info->gcb.TransparentColor;
+	const uint8_t *frame_row;
 	GifColorType *entry;
 	for (int i = 0; i < file->SHeight; i++) {
-		screen_row = render_ctx->screen_buffer + (render_ctx->screen_row_size * i);
+		gboolean inside_row = (i >= file->Image.Top) && (i < file->Image.Top + file->Image.Height);
+		frame_row = inside_row ? animation->frame_buffer + ((i - file->Image.Top) * file->Image.Width) : NULL;
 		pixel_p = image_row;
 		prev_pixel_p = prev_image_row;
 		for (int j = 0; j < file->SWidth; j++) {
-			if (screen_row[j] == render_ctx->gcb.TransparentColor) {
-				// Transparent pixel.
-				if (has_previous_image) {
-					*(guint32*) pixel_p = *(guint32*) prev_pixel_p;
-				}
-				else {
-					*(guint32*) pixel_p = (guint32) 0;
-				}
-			}
-			else if ((i < file->Image.Top)
-				|| (i >= file->Image.Top + file->Image.Height)
+			if (!inside_row
 				|| (j < file->Image.Left)
 				|| (j >= file->Image.Left + file->Image.Width))
 			{
 				// Outside the current image.
-				if (render_ctx->last_disposal_mode == DISPOSE_BACKGROUND) {
-					*(guint32*) pixel_p = render_ctx->background_color;
+				if (last_disposal_mode == DISPOSE_BACKGROUND) {
+					*(guint32*) pixel_p = background_color;
 				}
 				else if (has_previous_image) {
 					*(guint32*) pixel_p = *(guint32*) prev_pixel_p;
@@ -89,19 +170,25 @@ static GthImage * render_frame (GifFileType *file, RenderContext *render_ctx) {
 					*(guint32*) pixel_p = (guint32) 0;
 				}
 			}
-			else {
-				// Inside the current image and not transparent.
-				// Check if color is within color palette
-				if (screen_row[j] >= render_ctx->color_map->ColorCount) {
-					//g_print (">> [2] %d >= %d\n", screen_row[j], render_ctx->color_map->ColorCount);
-					g_object_unref (image);
-					return NULL;
+			else if (frame_row[j - file->Image.Left] == transparent_color) {
+				// Transparent pixel.
+				if (has_previous_image) {
+					*(guint32*) pixel_p = *(guint32*) prev_pixel_p;
 				}
 				else {
-					entry = &render_ctx->color_map->Colors[screen_row[j]];
-					*(guint32*) pixel_p = PACK_RGBA (entry->Red, entry->Green, entry->Blue, 0xFF);
+					*(guint32*) pixel_p = (guint32) 0;
 				}
 			}
+			else if (frame_row[j - file->Image.Left] >= color_map->ColorCount) {
+				// Color outside of the color palette.
+				g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED, "Failed to create frame %u", frame_index);
+				g_object_unref (image);
+				return NULL;
+			}
+			else {
+				entry = &color_map->Colors[frame_row[j - file->Image.Left]];
+				*(guint32*) pixel_p = PACK_RGBA (entry->Red, entry->Green, entry->Blue, 0xFF);
+			}
 			pixel_p += 4;
 			if (has_previous_image) {
 				prev_pixel_p += 4;
@@ -112,66 +199,30 @@ static GthImage * render_frame (GifFileType *file, RenderContext *render_ctx) {
 			prev_image_row += prev_image_row_stride;
 		}
 	}
-	return image;
-}
 
-GthImage * load_gif (GBytes *bytes, guint requested_size, GCancellable *cancellable, GError **error) {
-	gsize buffer_size;
-	const void *buffer = g_bytes_get_data (bytes, &buffer_size);
-	ReadData read_data = {
-		.buffer = buffer,
-		.size = buffer_size,
-		.offset = 0,
-	};
-
-	int error_code;
-	GifFileType *file = DGifOpen (&read_data, read_bytes_func, &error_code);
-	if (file == NULL) {
-		//g_print ("> ERROR %d\n", error_code);
-		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED, get_error_text (error_code));
-		return NULL;
-	}
-
-	//g_print ("> ScreenSize: %dx%d\n", file->SWidth, file->SHeight);
-
-	if ((file->SWidth == 0) || (file->SHeight == 0)) {
-		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED, _("Invalid file format"));
-		DGifCloseFile (file, NULL);
-		return NULL;
+	// Dispose the frame.
+	if (frame_info->gcb.DisposalMode == DISPOSE_BACKGROUND) {
+		_g_object_unref (*background);
+		*background = NULL;
 	}
-
-	// Screen buffer
-	int screen_row_size = file->SWidth * sizeof (GifPixelType);
-	int screen_buffer_size = file->SHeight * screen_row_size;
-	uint8_t *screen_buffer = (uint8_t *) g_malloc0 (screen_buffer_size);
-	if (screen_buffer == NULL) {
-		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED, "Failed to allocate memory");
-		DGifCloseFile (file, NULL);
-		return NULL;
+	else if (frame_info->gcb.DisposalMode != DISPOSE_PREVIOUS) {
+		_g_object_unref (*background);
+		*background = g_object_ref (image);
 	}
-	//memset (screen_buffer, (GifPixelType) file->SBackGroundColor, screen_buffer_size);
 
-	// Scan the content of the GIF file and load the image(s):
+	return image;
+}
 
-	GthImage *image = NULL;
-	static const int InterlacedOffset[] = { 0, 4, 2, 1}; // The way Interlaced image should.
-	static const int InterlacedJumps[] = { 8, 8, 4, 2};  // be read - offsets and jumps...
-	int image_idx = 0;
+// Reads the position and the control block of each frame.
+static gboolean scan_frames (GifAnimation *animation, GCancellable *cancellable, GError **error) {
+	GifFileType *file = animation->file;
 	GifRecordType record_type;
-	RenderContext render_ctx = {
-		.color_map = NULL,
-		.screen_buffer = screen_buffer,
-		.screen_row_size = screen_row_size,
-		.prev_image = NULL,
-		.last_disposal_mode = DISPOSAL_UNSPECIFIED,
-		.background_color = 0,
-	};
+	gboolean success = FALSE;
 
 	file->ExtensionBlocks = NULL;
 	file->ExtensionBlockCount = 0;
 
 	do {
-		int row, col, width, height;
 		GifByteType *ext_data;
 		int ext_code;
 
@@ -186,118 +237,54 @@ GthImage * load_gif (GBytes *bytes, guint requested_size, GCancellable *cancella
 		}
 
 		switch (record_type) {
-		case IMAGE_DESC_RECORD_TYPE:
-			//g_print ("> IMAGE_DESC_RECORD_TYPE\n");
+		case IMAGE_DESC_RECORD_TYPE: {
+			FrameInfo frame_info;
+			frame_info.offset = animation->read_data.offset;
 			if (DGifGetImageDesc (file) == GIF_ERROR) {
 				g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED, get_error_text (file->Error));
 				goto close;
 			}
 
-			render_ctx.gcb.DisposalMode = DISPOSAL_UNSPECIFIED;
-			render_ctx.gcb.UserInputFlag = 0;
-			render_ctx.gcb.DelayTime = 10;
-			render_ctx.gcb.TransparentColor = NO_TRANSPARENT_COLOR;
-
-			//g_print ("  ExtensionBlockCount %d\n", file->ExtensionBlockCount);
+			frame_info.gcb.DisposalMode = DISPOSAL_UNSPECIFIED;
+			frame_info.gcb.UserInputFlag = 0;
+			frame_info.gcb.DelayTime = 10;
+			frame_info.gcb.TransparentColor = NO_TRANSPARENT_COLOR;
 			for (int i = 0; i < file->ExtensionBlockCount; i++) {
 				ExtensionBlock *block = file->ExtensionBlocks + i;
 				if ((uint8_t) block->Function == 0xF9) {
-					DGifExtensionToGCB (block->ByteCount, block->Bytes, &render_ctx.gcb);
-					//g_print ("  > DisposalMode: %d\n", render_ctx.gcb.DisposalMode);
-					//g_print ("    DelayTime: %d\n", render_ctx.gcb.DelayTime);
-					//g_print ("    TransparentColor: %d\n", render_ctx.gcb.TransparentColor);
+					DGifExtensionToGCB (block->ByteCount, block->Bytes, &frame_info.gcb);
 				}
 			}
-
-			row = file->Image.Top; // Image Position relative to Screen.
-			col = file->Image.Left;
-			width = file->Image.Width;
-			height = file->Image.Height;
-			if (image_idx == 0) {
-				image = gth_image_new (file->SWidth, file->SHeight);
-				gth_image_set_has_alpha (image, TRUE);
-			}
-			image_idx++;
-			//g_print ("  Image %d at (%d, %d) [%dx%d]:\n", image_idx, col, row, width, height);
+			GifFreeExtensions (&file->ExtensionBlockCount, &file->ExtensionBlocks);
 
 			if ((file->Image.Left + file->Image.Width > file->SWidth)
 				|| (file->Image.Top + file->Image.Height > file->SHeight))
 			{
-				g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED, "Image %d is not inside the screen.", image_idx);
+				g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED, "Image %u is not inside the screen.", animation->frames->len + 1);
 				goto close;
 			}
 
-			//g_print ("  Interlace: %d\n", file->Image.Interlace);
-			if (file->Image.Interlace) {
-				// Need to perform 4 passes on the images:
-				for (int i = 0; i < 4; i++) {
-					for (int j = row + InterlacedOffset[i]; j < row + height; j += InterlacedJumps[i]) {
-						uint8_t *screen_row = screen_buffer + (j * screen_row_size) + col;
-						if (DGifGetLine (file, screen_row, width) == GIF_ERROR) {
-							g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED, get_error_text (file->Error));
-							goto close;
-						}
-					}
-				}
-			}
-			else {
-				uint8_t *screen_row = screen_buffer + (row * screen_row_size) + col;
-				for (int i = 0; i < height; i++) {
-					if (DGifGetLine (file, screen_row, width) == GIF_ERROR) {
-						g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED, get_error_text (file->Error));
-						goto close;
-					}
-					screen_row += screen_row_size;
-				}
-			}
-
-			render_ctx.color_map = (file->Image.ColorMap ? file->Image.ColorMap : file->SColorMap);
-			if (render_ctx.color_map == NULL) {
-				g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED, "Gif Image does not have a colormap.");
-				goto close;
-			}
-
-			// Check that the background color is valid.
-			if ((file->SBackGroundColor >= 0)
-				|| (file->SBackGroundColor < render_ctx.color_map->ColorCount))
-			{
-				GifColorType *entry = &(render_ctx.color_map->Colors[file->SBackGroundColor]);
-				render_ctx.background_color = PACK_RGBA (entry->Red, entry->Green, entry->Blue, 0xFF);
-			}
-			else {
-				render_ctx.background_color = 0;
-			}
-
-			GthImage *frame = render_frame (file, &render_ctx);
-			if (frame == NULL) {
-				g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED, "Failed to create frame %d", image_idx);
+			// Skip the image data without decompressing it.
+			int code_size;
+			GifByteType *code_block;
+			if (DGifGetCode (file, &code_size, &code_block) == GIF_ERROR) {
+				g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED, get_error_text (file->Error));
 				goto close;
 			}
-
-			guint milliseconds = (render_ctx.gcb.DelayTime > 0) ? (guint) render_ctx.gcb.DelayTime * 10 : 100;
-			gth_image_add_frame (image, frame, milliseconds);
-
-			if (render_ctx.gcb.DisposalMode == DISPOSE_BACKGROUND) {
-				// Reset prev_image to NULL.
-				if (render_ctx.prev_image != NULL) {
-					g_object_unref (render_ctx.prev_image);
-					render_ctx.prev_image = NULL;
-				}
-				//memset (screen_buffer, (GifPixelType) file->SBackGroundColor, screen_buffer_size);
-			}
-			else if (render_ctx.gcb.DisposalMode != DISPOSE_PREVIOUS) {
-				if (render_ctx.prev_image != NULL) {
-					g_object_unref (render_ctx.prev_image);
+			while (code_block != NULL) {
+				if (DGifGetCodeNext (file, &code_block) == GIF_ERROR) {
+					g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED, get_error_text (file->Error));
+					goto close;
 				}
-				render_ctx.prev_image = g_object_ref (frame);
 			}
-			render_ctx.last_disposal_mode = render_ctx.gcb.DisposalMode;
 
-			g_object_unref (frame);
+			GifFreeSavedImages (file);
+			file->SavedImages = NULL;
+			file->ImageCount = 0;
 
-			file->ExtensionBlocks = NULL;
-			file->ExtensionBlockCount = 0;
+			g_array_append_val (animation->frames, frame_info);
 			break;
+		}
 
 		case EXTENSION_RECORD_TYPE:
 			if (DGifGetExtension (file, &ext_code, &ext_data) == GIF_ERROR) {
@@ -312,7 +299,8 @@ GthImage * load_gif (GBytes *bytes, guint requested_size, GCancellable *cancella
 					ext_data[0],
 					&ext_data[1]) == GIF_ERROR)
 				{
-					return (GIF_ERROR);
+					g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED, "Failed");
+					goto close;
 				}
 			}
 			while (ext_data != NULL) {
@@ -344,80 +332,142 @@ GthImage * load_gif (GBytes *bytes, guint requested_size, GCancellable *cancella
 	}
 	while (record_type != TERMINATE_RECORD_TYPE);
 
+	success = TRUE;
+
 close:
 
-	if (render_ctx.prev_image != NULL) {
-		g_object_unref (render_ctx.prev_image);
-		render_ctx.prev_image = NULL;
+	GifFreeExtensions (&file->ExtensionBlockCount, &file->ExtensionBlocks);
+	return success;
+}
+
+static guint get_frame_delay (FrameInfo *frame_info) {
+	return (frame_info->gcb.DelayTime > 0) ? (guint) frame_info->gcb.DelayTime * 10 : 100;
+}
+
+GthImage * load_gif (GBytes *bytes, guint requested_size, GCancellable *cancellable, GError **error) {
+	GifAnimation *animation = g_new0 (GifAnimation, 1);
+	animation->bytes = g_bytes_ref (bytes);
+	gsize buffer_size;
+	animation->read_data.buffer = g_bytes_get_data (bytes, &buffer_size);
+	animation->read_data.size = buffer_size;
+	animation->read_data.offset = 0;
+	animation->frames = g_array_new (FALSE, FALSE, sizeof (FrameInfo));
+
+	int error_code;
+	animation->file = DGifOpen (&animation->read_data, read_bytes_func, &error_code);
+	if (animation->file == NULL) {
+		//g_print ("> ERROR %d\n", error_code);
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED, get_error_text (error_code));
+		gif_animation_free (animation);
+		return NULL;
+	}
+
+	GifFileType *file = animation->file;
+	//g_print ("> ScreenSize: %dx%d\n", file->SWidth, file->SHeight);
+
+	if ((file->SWidth == 0) || (file->SHeight == 0)) {
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED, _("Invalid file format"));
+		gif_animation_free (animation);
+		return NULL;
+	}
+
+	if (!scan_frames (animation, cancellable, error)) {
+		gif_animation_free (animation);
+		return NULL;
+	}
+	if (animation->frames->len == 0) {
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED, _("Invalid file format"));
+		gif_animation_free (animation);
+		return NULL;
+	}
+
+	animation->frame_buffer = (uint8_t *) g_try_malloc ((gsize) file->SWidth * file->SHeight * sizeof (GifPixelType));
+	if (animation->frame_buffer == NULL) {
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED, "Failed to allocate memory");
+		gif_animation_free (animation);
+		return NULL;
 	}
-	g_free (screen_buffer);
-	DGifCloseFile (file, NULL);
 
-	if ((error != NULL) && (*error != NULL)) {
-		if (image != NULL) {
-			g_object_unref (image);
-			image = NULL;
+	// Decode the first frame now, the others when requested.
+	GthImage *background = NULL;
+	GthImage *first_frame = render_frame (0, &background, animation, error);
+	_g_object_unref (background);
+	if (first_frame == NULL) {
+		gif_animation_free (animation);
+		return NULL;
+	}
+
+	GthImage *image = (GthImage *) g_object_new (GTH_TYPE_IMAGE, NULL);
+	gth_image_set_has_alpha (image, TRUE);
+	gth_image_add_frame (image, first_frame, get_frame_delay (&g_array_index (animation->frames, FrameInfo, 0)));
+	g_object_unref (first_frame);
+
+	if (animation->frames->len > 1) {
+		// The other frames are decoded after the loader returns, keep a
+		// private copy of the data because bytes can be a mapping of a
+		// file that may change.
+		GBytes *copy = g_bytes_new (animation->read_data.buffer, animation->read_data.size);
+		g_bytes_unref (animation->bytes);
+		animation->bytes = copy;
+		animation->read_data.buffer = g_bytes_get_data (copy, NULL);
+		for (guint i = 1; i < animation->frames->len; i++) {
+			gth_image_add_lazy_frame (image, get_frame_delay (&g_array_index (animation->frames, FrameInfo, i)));
 		}
+		gth_image_set_frame_renderer (image, render_frame, animation, (GDestroyNotify) gif_animation_free);
+	}
+	else {
+		gif_animation_free (animation);
 	}
+
 	return image;
 }
 
 // GIF format described here: https://giflib.sourceforge.net/whatsinagif/bits_and_bytes.html
 gboolean load_gif_info (const guchar *buffer, int buffer_size, GthImageInfo *image_info, GCancellable *cancellable) {
 	if (buffer_size < 13) {
-		//g_print ("  [0]\n");
 		return FALSE;
 	}
 
+	// Logical screen size.
 	image_info->width = ((int) buffer[7] << 8) + (int) buffer[6];
 	image_info->height = ((int) buffer[9] << 8) + (int) buffer[8];
-	//g_print ("> screen size: %d %d\n", image_info->width, image_info->height);
-	return TRUE;
 
 	uint8_t flags = buffer[10];
-	//g_print ("> buffer[%d]: %X\n", 10, (uint8_t) buffer[10]);
 	gboolean has_color_table = (flags & 0b10000000) != 0;
-	//g_print ("  has_color_table: %d\n", has_color_table);
 	int offset = 13;
 	if (has_color_table) {
-		// Size of Global Color Table
+		// Skip the global color table.
 		int size = (flags & 0b00000111);
-		int entries = (int) pow (2, size + 1);
-		//g_print ("  N: %d (entries: %d) (size: %d)\n", N, entries, size);
-		// Skip the color table
-		offset += entries * 3;
-	}
-	//g_print ("  [1.1] buffer[offset]: %X (offset: %d)\n", (uint8_t) buffer[offset], offset);
-	if (offset > buffer_size) {
-		//g_print ("  [1.2]\n");
-		return FALSE;
+		offset += (1 << (size + 1)) * 3;
 	}
-	// Skip extension blocks
-	while (buffer[offset] == 0x21) {
-		if (offset + 3 > buffer_size) {
-			//g_print ("  [2]\n");
-			return FALSE;
-		}
+
+	// Read the extension blocks that precede the first image: a graphic
+	// control extension with the transparency flag means alpha, the
+	// NETSCAPE2.0 application extension means animation.
+	while ((offset + 3 <= buffer_size) && (buffer[offset] == 0x21)) {
+		guchar label = buffer[offset + 1];
 		offset += 2;
 		int block_size = buffer[offset];
+		if ((label == 0xF9) && (block_size >= 4) && (offset + 2 <= buffer_size)) {
+			if ((buffer[offset + 1] & 0x01) != 0) {
+				image_info->has_alpha = TRUE;
+			}
+		}
+		if ((label == 0xFF) && (block_size == 11) && (offset + 12 <= buffer_size)) {
+			if (memcmp (buffer + offset + 1, "NETSCAPE2.0", 11) == 0) {
+				// The number of frames is only known after reading the whole file.
+				image_info->frames = 0;
+			}
+		}
 		offset += 1;
 		while (block_size > 0) {
 			offset += block_size;
 			if (offset + 1 > buffer_size) {
-				//g_print ("  [3]\n");
-				return FALSE;
+				return TRUE;
 			}
 			block_size = buffer[offset];
 			offset += 1;
 		}
 	}
-	// Image descriptor
-	if ((offset + 8 > buffer_size) || (buffer[offset] != 0x2C)) {
-		//g_print ("  [4] buffer[offset]: %X (offset: %d) (buffer_size: %d)\n", (uint8_t) buffer[offset], offset, buffer_size);
-		return FALSE;
-	}
-	// First image size
-	image_info->width = ((int) buffer[offset + 6] << 8) + (int) buffer[offset + 5];
-	image_info->height = ((int) buffer[offset + 8] << 8) + (int) buffer[offset + 7];
 	return TRUE;
 }
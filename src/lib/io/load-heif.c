@@ -1,4 +1,5 @@
 #include <config.h>
+#include <string.h>
 #include <libheif/heif.h>
 #include <libheif/heif_sequences.h>
 #include <lcms2.h>
@@ -20,6 +21,101 @@ static int cancel_decoding_func (void* progress_user_data) {
 	return FALSE;
 }
 
+static struct heif_context * _heif_context_new_from_bytes (GBytes *bytes, GError **error) {
+	struct heif_context *ctx = heif_context_alloc ();
+	gsize buffer_size;
+	const void *buffer = g_bytes_get_data (bytes, &buffer_size);
+	struct heif_error err = heif_context_read_from_memory_without_copy (ctx, buffer, buffer_size, NULL);
+	if (err.code != heif_error_Ok) {
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED, err.message);
+		heif_context_free (ctx);
+		return NULL;
+	}
+	return ctx;
+}
+
+static GthImage * _heif_decode_image (struct heif_image_handle *handle, heif_decoding_options *options, GError **error) {
+	gboolean has_alpha = heif_image_handle_has_alpha_channel (handle);
+
+	struct heif_image *img = NULL;
+	struct heif_error err = heif_decode_image (handle, &img, heif_colorspace_RGB,
+		has_alpha ? heif_chroma_interleaved_RGBA : heif_chroma_interleaved_RGB,
+		options);
+	if (err.code != heif_error_Ok) {
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED, err.message);
+		return NULL;
+	}
+
+	int image_width = heif_image_get_primary_width (img);
+	int image_height = heif_image_get_primary_height (img);
+	int data_stride;
+	const uint8_t *data = heif_image_get_plane_readonly (img, heif_channel_interleaved, &data_stride);
+	if (data == NULL) {
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED, "heif_image_get_plane_readonly failed");
+		heif_image_release (img);
+		return NULL;
+	}
+
+	GthImage *image = gth_image_new (image_width, image_height);
+	gth_image_set_has_alpha (image, has_alpha);
+	gth_image_copy_from_rgba_big_endian (image, data, has_alpha, data_stride);
+
+	if (heif_image_get_color_profile_type (img) != heif_color_profile_type_not_present) {
+		size_t icc_data_size = heif_image_get_raw_color_profile_size (img);
+		gpointer icc_data = g_malloc (icc_data_size);
+		err = heif_image_get_raw_color_profile (img, icc_data);
+		if (err.code == heif_error_Ok) {
+			GBytes *bytes = g_bytes_new_take (icc_data, icc_data_size);
+			GthIccProfile *profile = gth_icc_profile_new_from_bytes (bytes, NULL);
+			if (profile != NULL) {
+				gth_image_set_icc_profile (image, profile);
+				g_object_unref (profile);
+			}
+			icc_data = NULL;
+			g_bytes_unref (bytes);
+		}
+		g_free (icc_data);
+	}
+
+	heif_image_release (img);
+
+	return image;
+}
+
+// Returns the smallest thumbnail with the longer side at least
+// requested_size pixels long, or NULL.
+static struct heif_image_handle * _heif_get_thumbnail (struct heif_image_handle *handle, guint requested_size) {
+	int n_thumbnails = heif_image_handle_get_number_of_thumbnails (handle);
+	if (n_thumbnails <= 0) {
+		return NULL;
+	}
+	heif_item_id *ids = g_new (heif_item_id, n_thumbnails);
+	n_thumbnails = heif_image_handle_get_list_of_thumbnail_IDs (handle, ids, n_thumbnails);
+	struct heif_image_handle *best_thumbnail = NULL;
+	for (int i = 0; i < n_thumbnails; i++) {
+		struct heif_image_handle *thumbnail = NULL;
+		struct heif_error err = heif_image_handle_get_thumbnail (handle, ids[i], &thumbnail);
+		if (err.code != heif_error_Ok) {
+			continue;
+		}
+		int width = heif_image_handle_get_width (thumbnail);
+		int height = heif_image_handle_get_height (thumbnail);
+		if (((guint) MAX (width, height) >= requested_size)
+			&& ((best_thumbnail == NULL) || (width < heif_image_handle_get_width (best_thumbnail))))
+		{
+			if (best_thumbnail != NULL) {
+				heif_image_handle_release (best_thumbnail);
+			}
+			best_thumbnail = thumbnail;
+		}
+		else {
+			heif_image_handle_release (thumbnail);
+		}
+	}
+	g_free (ids);
+	return best_thumbnail;
+}
+
 GthImage* load_heif (GBytes *bytes, guint requested_size, GCancellable *cancellable, GError **error) {
 	GthImage *image = NULL;
 
@@ -34,12 +130,9 @@ GthImage* load_heif (GBytes *bytes, guint requested_size, GCancellable *cancella
 		options->cancel_decoding = cancel_decoding_func;
 	}
 
-	struct heif_context *ctx = heif_context_alloc ();
-	gsize buffer_size;
-	const void *buffer = g_bytes_get_data (bytes, &buffer_size);
-	struct heif_error err = heif_context_read_from_memory_without_copy (ctx, buffer, buffer_size, NULL);
-	if (err.code != heif_error_Ok) {
-		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED, err.message);
+	struct heif_error err;
+	struct heif_context *ctx = _heif_context_new_from_bytes (bytes, error);
+	if (ctx == NULL) {
 		goto stop_loading;
 	}
 
@@ -105,52 +198,66 @@ GthImage* load_heif (GBytes *bytes, guint requested_size, GCancellable *cancella
 			goto stop_loading;
 		}
 
-		gboolean has_alpha = heif_image_handle_has_alpha_channel (handle);
+		int original_width = heif_image_handle_get_width (handle);
+		int original_height = heif_image_handle_get_height (handle);
 
-		struct heif_image *img = NULL;
-		err = heif_decode_image (handle, &img, heif_colorspace_RGB,
-			has_alpha ? heif_chroma_interleaved_RGBA : heif_chroma_interleaved_RGB,
-			options);
-		if (err.code != heif_error_Ok) {
-			g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED, err.message);
-			heif_image_handle_release (handle);
-			goto stop_loading;
+		// Use the embedded thumbnail if it's large enough.
+		struct heif_image_handle *thumbnail = NULL;
+		if (requested_size > 0) {
+			thumbnail = _heif_get_thumbnail (handle, requested_size);
 		}
+		if (thumbnail != NULL) {
+			image = _heif_decode_image (thumbnail, options, NULL);
+			heif_image_handle_release (thumbnail);
 
-		int image_width = heif_image_get_primary_width (img);
-		int image_height = heif_image_get_primary_height (img);
-		int data_stride;
-		const uint8_t *data = heif_image_get_plane_readonly (img, heif_channel_interleaved, &data_stride);
-		if (data == NULL) {
-			g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED, "heif_image_get_plane_readonly failed");
-			heif_image_release (img);
-			heif_image_handle_release (handle);
-			goto stop_loading;
+			// Thumbnails usually don't have a color profile, use the
+			// one of the primary image.
+			if ((image != NULL) && !gth_image_has_icc_profile (image)) {
+				size_t icc_data_size = heif_image_handle_get_raw_color_profile_size (handle);
+				if (icc_data_size > 0) {
+					gpointer icc_data = g_malloc (icc_data_size);
+					err = heif_image_handle_get_raw_color_profile (handle, icc_data);
+					if (err.code == heif_error_Ok) {
+						GBytes *icc_bytes = g_bytes_new_take (icc_data, icc_data_size);
+						GthIccProfile *profile = gth_icc_profile_new_from_bytes (icc_bytes, NULL);
+						if (profile != NULL) {
+							gth_image_set_icc_profile (image, profile);
+							g_object_unref (profile);
+						}
+						icc_data = NULL;
+						g_bytes_unref (icc_bytes);
+					}
+					g_free (icc_data);
+				}
+			}
 		}
+		if (image == NULL) {
+			image = _heif_decode_image (handle, options, error);
+		}
+		heif_image_handle_release (handle);
 
-		image = gth_image_new (image_width, image_height);
-		gth_image_set_has_alpha (image, has_alpha);
-		gth_image_copy_from_rgba_big_endian (image, data, has_alpha, data_stride);
-
-		if (heif_image_get_color_profile_type (img) != heif_color_profile_type_not_present) {
-			size_t icc_data_size = heif_image_get_raw_color_profile_size (img);
-			gpointer icc_data = g_malloc (icc_data_size);
-			err = heif_image_get_raw_color_profile (img, icc_data);
-			if (err.code == heif_error_Ok) {
-				GBytes *bytes = g_bytes_new_take (icc_data, icc_data_size);
-				GthIccProfile *profile = gth_icc_profile_new_from_bytes (bytes, NULL);
-				if (profile != NULL) {
-					gth_image_set_icc_profile (image, profile);
-					g_object_unref (profile);
+		// Keep the memory usage low when loading thumbnails of large
+		// images.
+		if ((image != NULL) && (requested_size > 0)) {
+			guint width = gth_image_get_width (image);
+			guint height = gth_image_get_height (image);
+			if ((MIN (width, height) > requested_size * 2)
+				&& scale_to_cover (&width, &height, requested_size, FALSE))
+			{
+				GthImage *scaled = gth_image_resize_to (image, width, height, GTH_SCALE_FILTER_GOOD, cancellable);
+				if (scaled != NULL) {
+					g_object_unref (image);
+					image = scaled;
 				}
-				icc_data = NULL;
-				g_bytes_unref (bytes);
 			}
-			g_free (icc_data);
 		}
 
-		heif_image_release (img);
-		heif_image_handle_release (handle);
+		if ((image != NULL)
+			&& ((gth_image_get_width (image) != (guint) original_width)
+				|| (gth_image_get_height (image) != (guint) original_height)))
+		{
+			gth_image_set_original_image_size (image, original_width, original_height);
+		}
 	}
 
 stop_loading:
@@ -163,81 +270,240 @@ stop_loading:
 	return image;
 }
 
-struct _heif_reader_data {
-	int64_t position;
-	GInputStream *stream;
-	GCancellable *cancellable;
-};
+// Header parser, reads the ISOBMFF boxes that describe the primary item
+// (ISO/IEC 23008-12) without creating a libheif context.
 
-static int64_t _heif_get_position (void* userdata) {
-	struct _heif_reader_data *reader = userdata;
-	//g_print ("  GET POSITION %ld\n", reader->position);
-	return reader->position;
+#define MAX_HEADER_BOX_SIZE (1024 * 1024)
+#define MAX_TOP_LEVEL_BOXES 64
+
+static guint32 _get_uint32 (const guchar *p) {
+	return ((guint32) p[0] << 24) + ((guint32) p[1] << 16) + ((guint32) p[2] << 8) + (guint32) p[3];
+}
+
+static guint16 _get_uint16 (const guchar *p) {
+	return (guint16) ((p[0] << 8) + p[1]);
 }
 
-static int _heif_read (void* data, size_t size, void* userdata) {
-	//g_print ("  READ %ld, data: %p\n", size, data);
-	if ((data == NULL) || (size == 0))
-		return 0;
-	struct _heif_reader_data *reader = userdata;
-	gboolean success = g_input_stream_read_all (G_INPUT_STREAM (reader->stream), data, size, NULL, reader->cancellable, NULL);
-	if (success) {
-		reader->position += size;
+typedef struct {
+	const guchar *data; // Box content, after the header.
+	gsize size;
+	const guchar *type;
+} Box;
+
+// Returns the box at offset in the given data and moves offset after it.
+static gboolean _next_box (const guchar *data, gsize size, gsize *offset, Box *box) {
+	if (*offset + 8 > size) {
+		return FALSE;
+	}
+	const guchar *p = data + *offset;
+	guint64 box_size = _get_uint32 (p);
+	gsize header_size = 8;
+	if (box_size == 1) {
+		if (*offset + 16 > size) {
+			return FALSE;
+		}
+		box_size = ((guint64) _get_uint32 (p + 8) << 32) + _get_uint32 (p + 12);
+		header_size = 16;
 	}
-	return success ? 0 : 1;
+	else if (box_size == 0) {
+		box_size = size - *offset;
+	}
+	if ((box_size < header_size) || (box_size > size - *offset)) {
+		return FALSE;
+	}
+	box->type = p + 4;
+	box->data = p + header_size;
+	box->size = box_size - header_size;
+	*offset += box_size;
+	return TRUE;
 }
 
-static int _heif_seek (int64_t position, void* userdata) {
-	struct _heif_reader_data *reader = userdata;
-	//g_print ("  SEEK %ld -> %ld\n", reader->position, position);
-	gboolean success = g_seekable_seek (G_SEEKABLE (reader->stream), position, G_SEEK_SET, reader->cancellable, NULL);
-	if (success) {
-		reader->position = position;
+static gboolean _find_box (const guchar *data, gsize size, const char *type, Box *box) {
+	gsize offset = 0;
+	while (_next_box (data, size, &offset, box)) {
+		if (memcmp (box->type, type, 4) == 0) {
+			return TRUE;
+		}
 	}
-	return success ? 0 : 1;
+	return FALSE;
 }
 
-static enum heif_reader_grow_status _heif_wait_for_file_size (int64_t target_size, void* userdata) {
-	//g_print ("  WAIT %ld\n", target_size);
-	struct _heif_reader_data *reader = userdata;
-	gboolean success = g_seekable_seek (G_SEEKABLE (reader->stream), target_size, G_SEEK_SET, reader->cancellable, NULL);
-	if (success) {
-		_heif_seek (reader->position, userdata);
+static gboolean _read_meta_box (const guchar *data, gsize size, GthImageInfo *image_info) {
+	if (size < 4) {
+		return FALSE;
+	}
+	// Skip the full box version and flags.
+	data += 4;
+	size -= 4;
+
+	Box pitm, iprp, ipco, ipma;
+	if (!_find_box (data, size, "pitm", &pitm)
+		|| !_find_box (data, size, "iprp", &iprp)
+		|| !_find_box (iprp.data, iprp.size, "ipco", &ipco)
+		|| !_find_box (iprp.data, iprp.size, "ipma", &ipma))
+	{
+		return FALSE;
+	}
+
+	if (pitm.size < 6) {
+		return FALSE;
 	}
-	return success ? heif_reader_grow_status_size_reached : heif_reader_grow_status_size_beyond_eof;
+	guint32 primary_id = (pitm.data[0] == 0) ? _get_uint16 (pitm.data + 4) : ((pitm.size >= 8) ? _get_uint32 (pitm.data + 4) : 0);
+
+	// Collect the properties in order, the associations use 1-based indexes.
+	GPtrArray *properties = g_ptr_array_new_with_free_func (g_free);
+	gsize offset = 0;
+	Box property;
+	while (_next_box (ipco.data, ipco.size, &offset, &property)) {
+		g_ptr_array_add (properties, g_memdup2 (&property, sizeof (Box)));
+
+		// Auxiliary alpha images can be associated to the primary image only
+		// through references, their presence is enough.
+		if ((memcmp (property.type, "auxC", 4) == 0) && (property.size > 4)) {
+			char *aux_type = g_strndup ((const char *) property.data + 4, property.size - 4);
+			if (g_str_has_suffix (aux_type, ":alpha") || g_str_has_suffix (aux_type, "auxid:1")) {
+				image_info->has_alpha = TRUE;
+			}
+			g_free (aux_type);
+		}
+	}
+
+	gboolean size_found = FALSE;
+	if (ipma.size >= 8) {
+		guchar version = ipma.data[0];
+		gboolean large_index = (ipma.data[3] & 1) != 0;
+		guint32 entries = _get_uint32 (ipma.data + 4);
+		const guchar *p = ipma.data + 8;
+		const guchar *end = ipma.data + ipma.size;
+		for (guint32 i = 0; i < entries; i++) {
+			if (p + ((version < 1) ? 2 : 4) + 1 > end) {
+				break;
+			}
+			guint32 item_id = (version < 1) ? _get_uint16 (p) : _get_uint32 (p);
+			p += (version < 1) ? 2 : 4;
+			int associations = *p++;
+			for (int j = 0; j < associations; j++) {
+				if (p + (large_index ? 2 : 1) > end) {
+					break;
+				}
+				guint index = large_index ? (_get_uint16 (p) & 0x7fff) : (*p & 0x7f);
+				p += large_index ? 2 : 1;
+				if ((item_id != primary_id) || (index == 0) || (index > properties->len)) {
+					continue;
+				}
+				Box *box = g_ptr_array_index (properties, index - 1);
+				if ((memcmp (box->type, "ispe", 4) == 0) && (box->size >= 12)) {
+					image_info->width = _get_uint32 (box->data + 4);
+					image_info->height = _get_uint32 (box->data + 8);
+					size_found = TRUE;
+				}
+				else if ((memcmp (box->type, "irot", 4) == 0) && (box->size >= 1)) {
+					// Anti-clockwise rotation in 90 degrees steps.
+					switch (box->data[0] & 3) {
+					case 1:
+						image_info->orientation = GTH_TRANSFORM_ROTATE_270;
+						break;
+					case 2:
+						image_info->orientation = GTH_TRANSFORM_ROTATE_180;
+						break;
+					case 3:
+						image_info->orientation = GTH_TRANSFORM_ROTATE_90;
+						break;
+					}
+				}
+			}
+		}
+	}
+
+	g_ptr_array_unref (properties);
+	return size_found;
+}
+
+// Reads the size of the first track of an image sequence.
+static gboolean _read_moov_box (const guchar *data, gsize size, GthImageInfo *image_info) {
+	Box trak, tkhd;
+	if (!_find_box (data, size, "trak", &trak)
+		|| !_find_box (trak.data, trak.size, "tkhd", &tkhd)
+		|| (tkhd.size < 1))
+	{
+		return FALSE;
+	}
+	// Width and height are 16.16 fixed point values at the end of the box.
+	gsize size_offset = (tkhd.data[0] == 1) ? 88 : 76;
+	if (tkhd.size < size_offset + 8) {
+		return FALSE;
+	}
+	image_info->width = _get_uint32 (tkhd.data + size_offset) >> 16;
+	image_info->height = _get_uint32 (tkhd.data + size_offset + 4) >> 16;
+	return TRUE;
+}
+
+static guchar * _read_box_content (GInputStream *stream, goffset offset, guint64 size, GCancellable *cancellable) {
+	if (size > MAX_HEADER_BOX_SIZE) {
+		return NULL;
+	}
+	if (!g_seekable_seek (G_SEEKABLE (stream), offset, G_SEEK_SET, cancellable, NULL)) {
+		return NULL;
+	}
+	guchar *content = g_new (guchar, size);
+	gsize bytes_read;
+	if (!g_input_stream_read_all (stream, content, size, &bytes_read, cancellable, NULL)
+		|| (bytes_read != size))
+	{
+		g_free (content);
+		return NULL;
+	}
+	return content;
 }
 
 gboolean load_heif_info (GInputStream *stream, GthImageInfo *image_info, guchar *buffer, gsize size, GCancellable *cancellable) {
 	gboolean format_recognized = FALSE;
-	struct heif_reader reader = {
-		.reader_api_version = 1,
-		.get_position = _heif_get_position,
-		.read = _heif_read,
-		.seek = _heif_seek,
-		.wait_for_file_size = _heif_wait_for_file_size,
-	};
-	struct _heif_reader_data data = {
-		.position = 0,
-		.stream = g_buffered_input_stream_new (G_INPUT_STREAM (stream)),
-		.cancellable = cancellable,
-	};
-	struct heif_context *ctx = heif_context_alloc ();
-	struct heif_error err = heif_context_read_from_reader (ctx, &reader, &data, NULL);
-	if (err.code == heif_error_Ok) {
-		struct heif_image_handle *handle;
-		err = heif_context_get_primary_image_handle (ctx, &handle);
-		if (err.code == heif_error_Ok) {
-			image_info->width = heif_image_handle_get_width (handle);
-			image_info->height = heif_image_handle_get_height (handle);
-			format_recognized = TRUE;
+	gboolean is_sequence = FALSE;
+	goffset offset = 0;
+	for (int i = 0; i < MAX_TOP_LEVEL_BOXES; i++) {
+		guchar header[16];
+		gsize header_read;
+		if (!g_seekable_seek (G_SEEKABLE (stream), offset, G_SEEK_SET, cancellable, NULL)
+			|| !g_input_stream_read_all (stream, header, sizeof (header), &header_read, cancellable, NULL)
+			|| (header_read < 8))
+		{
+			break;
 		}
-		if (handle != NULL) {
-			heif_image_handle_release (handle);
+		guint64 box_size = _get_uint32 (header);
+		gsize header_size = 8;
+		if (box_size == 1) {
+			if (header_read < 16) {
+				break;
+			}
+			box_size = ((guint64) _get_uint32 (header + 8) << 32) + _get_uint32 (header + 12);
+			header_size = 16;
+		}
+		gboolean is_meta = memcmp (header + 4, "meta", 4) == 0;
+		gboolean is_moov = memcmp (header + 4, "moov", 4) == 0;
+		if (is_moov) {
+			is_sequence = TRUE;
 		}
+		if (!format_recognized && (is_meta || is_moov)) {
+			guint64 content_size = (box_size >= header_size) ? box_size - header_size : 0;
+			guchar *content = _read_box_content (stream, offset + header_size, content_size, cancellable);
+			if (content != NULL) {
+				if (is_meta) {
+					format_recognized = _read_meta_box (content, content_size, image_info);
+				}
+				else {
+					format_recognized = _read_moov_box (content, content_size, image_info);
+				}
+				g_free (content);
+			}
+		}
+		if (box_size < header_size) {
+			// A zero size means the box extends to the end of the file.
+			break;
+		}
+		offset += box_size;
 	}
-	if (ctx != NULL) {
-		heif_context_free (ctx);
+	if (is_sequence) {
+		image_info->frames = 0;
 	}
-	g_object_unref (data.stream);
 	return format_recognized;
 }
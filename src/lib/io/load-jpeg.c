@@ -6,6 +6,7 @@
 #include <jpeglib.h>
 #include <lcms2.h>
 #include "lib/jpeg/jmemorysrc.h"
+#include "lib/jpeg/jstreamsrc.h"
 #include "lib/jpeg/jpeg-info.h"
 #include "lib/gth-icc-profile.h"
 #include "load-jpeg.h"
@@ -105,49 +106,168 @@ static void YCbCr_tables_init (void) {
 }
 
 
-GthImage * load_jpeg (GBytes *bytes, guint requested_size, GCancellable *cancellable, GError **error) {
-	gsize in_buffer_size;
-	const void *in_buffer = g_bytes_get_data (bytes, &in_buffer_size);
-	if (in_buffer_size == 0) {
-		g_set_error_literal (error,
-			G_IO_ERROR,
-			G_IO_ERROR_INVALID_DATA,
-			"No data");
-		return NULL;
+// Converts the region from displayed to stored image coordinates and scales
+// it to the output size.
+static void get_output_region (const GthImageRegion *region,
+	GthTransform orientation,
+	int image_width,
+	int image_height,
+	int output_width,
+	int output_height,
+	int *x_p,
+	int *y_p,
+	int *width_p,
+	int *height_p)
+{
+	int x, y, width, height;
+	switch (orientation) {
+	case GTH_TRANSFORM_NONE:
+	default:
+		x = region->x;
+		y = region->y;
+		width = region->width;
+		height = region->height;
+		break;
+	case GTH_TRANSFORM_FLIP_H:
+		x = image_width - region->x - region->width;
+		y = region->y;
+		width = region->width;
+		height = region->height;
+		break;
+	case GTH_TRANSFORM_ROTATE_180:
+		x = image_width - region->x - region->width;
+		y = image_height - region->y - region->height;
+		width = region->width;
+		height = region->height;
+		break;
+	case GTH_TRANSFORM_FLIP_V:
+		x = region->x;
+		y = image_height - region->y - region->height;
+		width = region->width;
+		height = region->height;
+		break;
+	case GTH_TRANSFORM_TRANSPOSE:
+		x = region->y;
+		y = region->x;
+		width = region->height;
+		height = region->width;
+		break;
+	case GTH_TRANSFORM_ROTATE_90:
+		x = region->y;
+		y = image_height - region->x - region->width;
+		width = region->height;
+		height = region->width;
+		break;
+	case GTH_TRANSFORM_TRANSVERSE:
+		x = image_width - region->y - region->height;
+		y = image_height - region->x - region->width;
+		width = region->height;
+		height = region->width;
+		break;
+	case GTH_TRANSFORM_ROTATE_270:
+		x = image_width - region->y - region->height;
+		y = region->x;
+		width = region->height;
+		height = region->width;
+		break;
 	}
 
-	// Read orientation and color profile.
+	int x1 = CLAMP ((gint64) (x + width) * output_width / image_width + 1, 0, output_width);
+	int y1 = CLAMP ((gint64) (y + height) * output_height / image_height + 1, 0, output_height);
+	x = CLAMP ((gint64) x * output_width / image_width, 0, output_width);
+	y = CLAMP ((gint64) y * output_height / image_height, 0, output_height);
+	*x_p = x;
+	*y_p = y;
+	*width_p = x1 - x;
+	*height_p = y1 - y;
+}
 
-	JpegInfoData jpeg_info;
-	_jpeg_info_data_init (&jpeg_info);
 
-	JpegInfoFlags info_flags = _JPEG_INFO_EXIF_ORIENTATION;
-	info_flags |= _JPEG_INFO_EXIF_COLOR_SPACE | _JPEG_INFO_ICC_PROFILE;
-	_jpeg_info_get_from_buffer (in_buffer, in_buffer_size, info_flags, &jpeg_info);
+#define INFO_FLAGS (_JPEG_INFO_EXIF_ORIENTATION | _JPEG_INFO_EXIF_COLOR_SPACE | _JPEG_INFO_ICC_PROFILE)
 
-	GthTransform orientation = GTH_TRANSFORM_NONE;
-	if (jpeg_info.valid & _JPEG_INFO_EXIF_ORIENTATION) {
-		orientation = jpeg_info.orientation;
-	}
 
-	GthIccProfile *profile = NULL;
+// Reads the orientation and the color profile, and disposes jpeg_info.
+static void get_orientation_and_profile (JpegInfoData *jpeg_info,
+	GthTransform *orientation,
+	GthIccProfile **profile)
+{
+	*orientation = GTH_TRANSFORM_NONE;
+	if (jpeg_info->valid & _JPEG_INFO_EXIF_ORIENTATION) {
+		*orientation = jpeg_info->orientation;
+	}
 
-	if (jpeg_info.valid & _JPEG_INFO_ICC_PROFILE) {
-		GBytes *bytes = g_bytes_new_take (jpeg_info.icc_data, jpeg_info.icc_data_size);
-		profile = gth_icc_profile_new_from_bytes (bytes, NULL);
+	*profile = NULL;
+	if (jpeg_info->valid & _JPEG_INFO_ICC_PROFILE) {
+		GBytes *bytes = g_bytes_new_take (jpeg_info->icc_data, jpeg_info->icc_data_size);
+		*profile = gth_icc_profile_new_from_bytes (bytes, NULL);
 		g_bytes_unref (bytes);
-		jpeg_info.icc_data = NULL;
+		jpeg_info->icc_data = NULL;
 	}
-	else if (jpeg_info.valid & _JPEG_INFO_EXIF_COLOR_SPACE) {
-		if (jpeg_info.color_space == GTH_COLOR_SPACE_SRGB) {
-			profile = gth_icc_profile_new_srgb ();
+	else if (jpeg_info->valid & _JPEG_INFO_EXIF_COLOR_SPACE) {
+		if (jpeg_info->color_space == GTH_COLOR_SPACE_SRGB) {
+			*profile = gth_icc_profile_new_srgb ();
 		}
-		else if (jpeg_info.color_space == GTH_COLOR_SPACE_ADOBERGB) {
-			profile = gth_icc_profile_new_adobergb ();
+		else if (jpeg_info->color_space == GTH_COLOR_SPACE_ADOBERGB) {
+			*profile = gth_icc_profile_new_adobergb ();
 		}
 	}
 
-	_jpeg_info_data_dispose (&jpeg_info);
+	_jpeg_info_data_dispose (jpeg_info);
+}
+
+
+// Reads the info from the APP1 and APP2 markers saved by the decoder, used
+// when the data is read from a stream.
+static void get_info_from_saved_markers (j_decompress_ptr cinfo, JpegInfoData *jpeg_info) {
+	GByteArray *header = g_byte_array_new ();
+	guchar marker[4] = { 0xFF, 0xD8, 0, 0 }; // SOI
+	g_byte_array_append (header, marker, 2);
+	for (jpeg_saved_marker_ptr saved = cinfo->marker_list; saved != NULL; saved = saved->next) {
+		guint length = saved->data_length + 2;
+		marker[1] = saved->marker;
+		marker[2] = (length >> 8) & 0xFF;
+		marker[3] = length & 0xFF;
+		g_byte_array_append (header, marker, 4);
+		g_byte_array_append (header, saved->data, saved->data_length);
+	}
+	marker[1] = JPEG_EOI;
+	g_byte_array_append (header, marker, 2);
+	_jpeg_info_get_from_buffer (header->data, header->len, INFO_FLAGS, jpeg_info);
+	g_byte_array_free (header, TRUE);
+}
+
+
+// Decodes the data in bytes or, if bytes is NULL, the data read from
+// stream.
+static GthImage * _load_jpeg (GBytes *bytes,
+	GInputStream *stream,
+	guint requested_size,
+	const GthImageRegion *region,
+	GCancellable *cancellable,
+	GError **error)
+{
+	gsize in_buffer_size = 0;
+	const void *in_buffer = NULL;
+	GthTransform orientation = GTH_TRANSFORM_NONE;
+	GthIccProfile *profile = NULL;
+
+	if (bytes != NULL) {
+		in_buffer = g_bytes_get_data (bytes, &in_buffer_size);
+		if (in_buffer_size == 0) {
+			g_set_error_literal (error,
+				G_IO_ERROR,
+				G_IO_ERROR_INVALID_DATA,
+				"No data");
+			return NULL;
+		}
+
+		// Read orientation and color profile.
+
+		JpegInfoData jpeg_info;
+		_jpeg_info_data_init (&jpeg_info);
+		_jpeg_info_get_from_buffer (in_buffer, in_buffer_size, INFO_FLAGS, &jpeg_info);
+		get_orientation_and_profile (&jpeg_info, &orientation, &profile);
+	}
 
 	// Decompress the image
 
@@ -162,18 +282,43 @@ GthImage * load_jpeg (GBytes *bytes, guint requested_size, GCancellable *cancell
 
 	jpeg_create_decompress (&srcinfo);
 
+	// Declared before sigsetjmp, the read errors of a stream can jump to
+	// stop_loading while reading the header.
+	volatile gboolean read_all_scanlines = FALSE;
+	volatile gboolean finished = FALSE;
+
 	if (sigsetjmp (jsrcerr.setjmp_buffer, 1)) {
 		goto stop_loading;
 	}
 
-	_jpeg_memory_src (&srcinfo, in_buffer, in_buffer_size);
+	if (bytes != NULL) {
+		_jpeg_memory_src (&srcinfo, in_buffer, in_buffer_size);
+	}
+	else {
+		_jpeg_stream_src (&srcinfo, stream, cancellable);
+		jpeg_save_markers (&srcinfo, JPEG_APP0 + 1, 0xFFFF);
+		jpeg_save_markers (&srcinfo, JPEG_APP0 + 2, 0xFFFF);
+	}
 
 	jpeg_read_header (&srcinfo, TRUE);
 
+	if (bytes == NULL) {
+		// Read orientation and color profile.
+
+		JpegInfoData jpeg_info;
+		_jpeg_info_data_init (&jpeg_info);
+		get_info_from_saved_markers (&srcinfo, &jpeg_info);
+		get_orientation_and_profile (&jpeg_info, &orientation, &profile);
+	}
+
 	srcinfo.out_color_space = srcinfo.jpeg_color_space; // Make all the color space conversions manually.
 
-	gboolean load_scaled = (requested_size > 0) && (requested_size < srcinfo.image_width) && (requested_size < srcinfo.image_height);
-	if (load_scaled) {
+	gboolean load_scaled = (region == NULL) && (requested_size > 0) && (requested_size < srcinfo.image_width) && (requested_size < srcinfo.image_height);
+	if (region != NULL) {
+		srcinfo.scale_num = 1;
+		srcinfo.scale_denom = CLAMP (region->scale_denom, 1, 8);
+	}
+	else if (load_scaled) {
 		for (srcinfo.scale_denom = 1; srcinfo.scale_denom <= 16; srcinfo.scale_denom++) {
 			jpeg_calc_output_dimensions (&srcinfo);
 			if ((srcinfo.output_width < requested_size) || (srcinfo.output_height < requested_size)) {
@@ -197,6 +342,48 @@ GthImage * load_jpeg (GBytes *bytes, guint requested_size, GCancellable *cancell
 
 	int output_width = MIN (srcinfo.output_width, GTH_MAX_IMAGE_SIZE);
 	int output_height = MIN (srcinfo.output_height, GTH_MAX_IMAGE_SIZE);
+	int first_column = 0; // Offset of the region in the scanline buffer.
+	JDIMENSION last_scanline = output_height;
+
+	if (region != NULL) {
+		int x, y, width, height;
+		get_output_region (region,
+			orientation,
+			srcinfo.image_width,
+			srcinfo.image_height,
+			srcinfo.output_width,
+			srcinfo.output_height,
+			&x, &y, &width, &height);
+		if ((width <= 0) || (height <= 0)) {
+			g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "Empty region");
+			jpeg_abort_decompress (&srcinfo);
+			jpeg_destroy_decompress (&srcinfo);
+			if (profile != NULL) {
+				g_object_unref (profile);
+			}
+			return NULL;
+		}
+
+#ifdef LIBJPEG_TURBO_VERSION
+		// Only decode the iMCU columns that contain the region and skip
+		// the rows above it without decompressing them.
+		JDIMENSION crop_x = x;
+		JDIMENSION crop_width = width;
+		jpeg_crop_scanline (&srcinfo, &crop_x, &crop_width);
+		first_column = (x - crop_x) * srcinfo.output_components;
+		if (y > 0) {
+			jpeg_skip_scanlines (&srcinfo, y);
+		}
+#else
+		first_column = x * srcinfo.output_components;
+		while (srcinfo.output_scanline < y) {
+			jpeg_read_scanlines (&srcinfo, buffer, 1);
+		}
+#endif
+		output_width = MIN (width, GTH_MAX_IMAGE_SIZE);
+		output_height = MIN (height, GTH_MAX_IMAGE_SIZE);
+		last_scanline = y + output_height;
+	}
 	int destination_width;
 	int destination_height;
 	int line_start;
@@ -243,8 +430,6 @@ GthImage * load_jpeg (GBytes *bytes, guint requested_size, GCancellable *cancell
 	guchar r, g, b;
 	unsigned char *p_buffer;
 	int x;
-	volatile gboolean read_all_scanlines = FALSE;
-	volatile gboolean finished = FALSE;
 
 	switch (srcinfo.out_color_space) {
 	case JCS_CMYK:
@@ -255,7 +440,7 @@ GthImage * load_jpeg (GBytes *bytes, guint requested_size, GCancellable *cancell
 			CMYK_table_init ();
 			cmyk_tab = CMYK_Tab;
 
-			while (srcinfo.output_scanline < output_height) {
+			while (srcinfo.output_scanline < last_scanline) {
 				if (g_cancellable_is_cancelled (cancellable))
 					goto stop_loading;
 
@@ -266,7 +451,7 @@ GthImage * load_jpeg (GBytes *bytes, guint requested_size, GCancellable *cancell
 				buffer_row = buffer;
 				for (l = 0; l < n_lines; l++) {
 					p_surface = surface_row;
-					p_buffer = buffer_row[l];
+					p_buffer = buffer_row[l] + first_column;
 
 					if (g_cancellable_is_cancelled (cancellable))
 						goto stop_loading;
@@ -305,7 +490,7 @@ GthImage * load_jpeg (GBytes *bytes, guint requested_size, GCancellable *cancell
 
 	case JCS_GRAYSCALE:
 		{
-			while (srcinfo.output_scanline < output_height) {
+			while (srcinfo.output_scanline < last_scanline) {
 				if (g_cancellable_is_cancelled (cancellable))
 					goto stop_loading;
 
@@ -316,7 +501,7 @@ GthImage * load_jpeg (GBytes *bytes, guint requested_size, GCancellable *cancell
 				buffer_row = buffer;
 				for (l = 0; l < n_lines; l++) {
 					p_surface = surface_row;
-					p_buffer = buffer_row[l];
+					p_buffer = buffer_row[l] + first_column;
 
 					if (g_cancellable_is_cancelled (cancellable))
 						goto stop_loading;
@@ -339,7 +524,7 @@ GthImage * load_jpeg (GBytes *bytes, guint requested_size, GCancellable *cancell
 
 	case JCS_RGB:
 		{
-			while (srcinfo.output_scanline < output_height) {
+			while (srcinfo.output_scanline < last_scanline) {
 				if (g_cancellable_is_cancelled (cancellable))
 					goto stop_loading;
 
@@ -350,7 +535,7 @@ GthImage * load_jpeg (GBytes *bytes, guint requested_size, GCancellable *cancell
 				buffer_row = buffer;
 				for (l = 0; l < n_lines; l++) {
 					p_surface = surface_row;
-					p_buffer = buffer_row[l];
+					p_buffer = buffer_row[l] + first_column;
 
 					if (g_cancellable_is_cancelled (cancellable))
 						goto stop_loading;
@@ -388,7 +573,7 @@ GthImage * load_jpeg (GBytes *bytes, guint requested_size, GCancellable *cancell
 			g_cr_tab = YCbCr_G_Cr_Tab;
 			b_cb_tab = YCbCr_B_Cb_Tab;
 
-			while (srcinfo.output_scanline < output_height) {
+			while (srcinfo.output_scanline < last_scanline) {
 				if (g_cancellable_is_cancelled (cancellable))
 					goto stop_loading;
 
@@ -399,7 +584,7 @@ GthImage * load_jpeg (GBytes *bytes, guint requested_size, GCancellable *cancell
 				buffer_row = buffer;
 				for (l = 0; l < n_lines; l++) {
 					p_surface = surface_row;
-					p_buffer = buffer_row[l];
+					p_buffer = buffer_row[l] + first_column;
 
 					if (g_cancellable_is_cancelled (cancellable))
 						goto stop_loading;
@@ -445,7 +630,7 @@ GthImage * load_jpeg (GBytes *bytes, guint requested_size, GCancellable *cancell
 			CMYK_table_init ();
 			cmyk_tab = CMYK_Tab;
 
-			while (srcinfo.output_scanline < output_height) {
+			while (srcinfo.output_scanline < last_scanline) {
 				if (g_cancellable_is_cancelled (cancellable))
 					goto stop_loading;
 
@@ -456,7 +641,7 @@ GthImage * load_jpeg (GBytes *bytes, guint requested_size, GCancellable *cancell
 				buffer_row = buffer;
 				for (l = 0; l < n_lines; l++) {
 					p_surface = surface_row;
-					p_buffer = buffer_row[l];
+					p_buffer = buffer_row[l] + first_column;
 
 					if (g_cancellable_is_cancelled (cancellable))
 						goto stop_loading;
@@ -506,17 +691,30 @@ stop_loading:
 
 	if (!finished) {
 		finished = TRUE;
+
+		if (bytes == NULL) {
+			// Report the stream error instead of the decoder error
+			// caused by the missing data.
+			GError *read_error = _jpeg_stream_src_steal_error (&srcinfo);
+			if (read_error != NULL) {
+				if (error != NULL) {
+					g_clear_error (error);
+				}
+				g_propagate_error (error, read_error);
+			}
+		}
+
 		gboolean success = FALSE;
 		if (image != NULL) {
 			if (read_all_scanlines && !g_cancellable_is_cancelled (cancellable)) {
 				success = TRUE;
 			}
-			else {
+			else if ((error == NULL) || (*error == NULL)) {
 				g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_CANCELLED, "Cancelled");
 			}
 		}
 
-		if (read_all_scanlines) {
+		if (read_all_scanlines && (srcinfo.output_scanline >= srcinfo.output_height)) {
 			jpeg_finish_decompress (&srcinfo);
 		}
 		else {
@@ -533,6 +731,20 @@ stop_loading:
 	return image;
 }
 
+GthImage * load_jpeg (GBytes *bytes, guint requested_size, GCancellable *cancellable, GError **error) {
+	return _load_jpeg (bytes, NULL, requested_size, NULL, cancellable, error);
+}
+
+GthImage * load_jpeg_region (GBytes *bytes, const GthImageRegion *region, GCancellable *cancellable, GError **error) {
+	g_return_val_if_fail (region != NULL, NULL);
+	return _load_jpeg (bytes, NULL, 0, region, cancellable, error);
+}
+
+GthImage * load_jpeg_stream (GInputStream *stream, guint requested_size, GCancellable *cancellable, GError **error) {
+	g_return_val_if_fail (stream != NULL, NULL);
+	return _load_jpeg (NULL, stream, requested_size, NULL, cancellable, error);
+}
+
 #undef SCALE_FACTOR
 #undef SCALE_UP
 #undef SCALE_DOWN
@@ -557,15 +769,7 @@ gboolean load_jpeg_info (GInputStream *stream, GthImageInfo *image_info, GCancel
 		image_info->height = jpeg_info.height;
 		format_recognized = TRUE;
 		if (jpeg_info.valid & _JPEG_INFO_EXIF_ORIENTATION) {
-			if ((jpeg_info.orientation == GTH_TRANSFORM_ROTATE_90)
-				|| (jpeg_info.orientation == GTH_TRANSFORM_ROTATE_270)
-				|| (jpeg_info.orientation == GTH_TRANSFORM_TRANSPOSE)
-				|| (jpeg_info.orientation == GTH_TRANSFORM_TRANSVERSE))
-			{
-				int tmp = image_info->width;
-				image_info->width = image_info->height;
-				image_info->height = tmp;
-			}
+			image_info->orientation = jpeg_info.orientation;
 		}
 	}
 	_jpeg_info_data_dispose (&jpeg_info);
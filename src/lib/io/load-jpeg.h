@@ -8,6 +8,8 @@
 G_BEGIN_DECLS
 
 GthImage * load_jpeg (GBytes *bytes, guint requested_size, GCancellable *cancellable, GError **error);
+GthImage * load_jpeg_region (GBytes *bytes, const GthImageRegion *region, GCancellable *cancellable, GError **error);
+GthImage * load_jpeg_stream (GInputStream *stream, guint requested_size, GCancellable *cancellable, GError **error);
 gboolean load_jpeg_info (GInputStream *stream, GthImageInfo *image_info, GCancellable *cancellable);
 
 G_END_DECLS
@@ -1,8 +1,10 @@
 #include <config.h>
+#include <string.h>
 #include <jxl/decode.h>
-#include <jxl/thread_parallel_runner.h>
+#include <jxl/parallel_runner.h>
 #include <lcms2.h>
 #include "lib/gth-icc-profile.h"
+#include "lib/gth-parallel.h"
 #include "image-info.h"
 #include "load-jxl.h"
 
@@ -15,6 +17,41 @@ static void premultiply_alpha (int width, int height, guchar *buffer) {
 	}
 }
 
+typedef struct {
+	void *jpegxl_opaque;
+	JxlParallelRunFunction func;
+	guint start_range;
+} RunnerData;
+
+static void runner_band (guint start, guint end, guint worker, gpointer user_data) {
+	RunnerData *data = user_data;
+	for (guint i = start; i < end; i++) {
+		data->func (data->jpegxl_opaque, data->start_range + i, worker);
+	}
+}
+
+// A JxlParallelRunner that uses the shared thread pool instead of creating
+// new threads for each image.
+static JxlParallelRetCode shared_pool_runner (void *runner_opaque,
+	void *jpegxl_opaque,
+	JxlParallelRunInit init,
+	JxlParallelRunFunction func,
+	uint32_t start_range,
+	uint32_t end_range)
+{
+	guint n_threads = gth_parallel_get_n_threads ();
+	JxlParallelRetCode result = init (jpegxl_opaque, n_threads);
+	if (result != 0) {
+		return result;
+	}
+	RunnerData data;
+	data.jpegxl_opaque = jpegxl_opaque;
+	data.func = func;
+	data.start_range = start_range;
+	gth_parallel_for_workers (end_range - start_range, 1, n_threads, runner_band, &data);
+	return 0;
+}
+
 GthImage* load_jxl (GBytes *bytes, guint requested_size, GCancellable *cancellable, GError **error) {
 	JxlDecoder *dec = JxlDecoderCreate (NULL);
 	if (dec == NULL) {
@@ -31,34 +68,34 @@ GthImage* load_jxl (GBytes *bytes, guint requested_size, GCancellable *cancellab
 		return NULL;
 	}
 
-	void *runner = JxlThreadParallelRunnerCreate (NULL, JxlThreadParallelRunnerDefaultNumWorkerThreads ());
-	if (runner == NULL) {
-		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED, "Could not create threaded parallel runner.");
-		JxlDecoderDestroy (dec);
-		return NULL;
-	}
-
-	if (JxlDecoderSetParallelRunner (dec, JxlThreadParallelRunner, runner) != JXL_DEC_SUCCESS) {
+	if (JxlDecoderSetParallelRunner (dec, shared_pool_runner, NULL) != JXL_DEC_SUCCESS) {
 		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED, "Could not set parallel runner.");
-		JxlThreadParallelRunnerDestroy (runner);
 		JxlDecoderDestroy (dec);
 		return NULL;
 	}
 
-	if (JxlDecoderSubscribeEvents (dec, JXL_DEC_BASIC_INFO
+	// When a reduced size is requested, stop at the first progressive pass
+	// that has enough detail.
+	int events = JXL_DEC_BASIC_INFO
 		| JXL_DEC_COLOR_ENCODING
 		| JXL_DEC_FRAME
-		| JXL_DEC_FULL_IMAGE) != JXL_DEC_SUCCESS)
-	{
+		| JXL_DEC_FULL_IMAGE;
+	if (requested_size > 0) {
+		events |= JXL_DEC_FRAME_PROGRESSION;
+	}
+	if (JxlDecoderSubscribeEvents (dec, events) != JXL_DEC_SUCCESS) {
 		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED, "Could not subscribe to decoder events.");
-		JxlThreadParallelRunnerDestroy (runner);
+		JxlDecoderDestroy (dec);
+		return NULL;
+	}
+	if ((requested_size > 0) && (JxlDecoderSetProgressiveDetail (dec, kDC) != JXL_DEC_SUCCESS)) {
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED, "Could not set the progressive detail.");
 		JxlDecoderDestroy (dec);
 		return NULL;
 	}
 
 	if (JxlDecoderSetInput (dec, buffer, buffer_size) != JXL_DEC_SUCCESS) {
 		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED, "Could not set decoder input.");
-		JxlThreadParallelRunnerDestroy (runner);
 		JxlDecoderDestroy (dec);
 		return NULL;
 	}
@@ -177,6 +214,19 @@ GthImage* load_jxl (GBytes *bytes, guint requested_size, GCancellable *cancellab
 			}
 			break;
 
+		case JXL_DEC_FRAME_PROGRESSION:
+			if (!info.have_animation && frame_header.is_last && (surface_data != NULL)) {
+				size_t ratio = JxlDecoderGetIntendedDownsamplingRatio (dec);
+				if ((ratio > 1)
+					&& ((guint) MIN (width, height) / ratio >= requested_size)
+					&& (JxlDecoderFlushImage (dec) == JXL_DEC_SUCCESS))
+				{
+					premultiply_alpha (width, height, surface_data);
+					status = JXL_DEC_SUCCESS;
+				}
+			}
+			break;
+
 		case JXL_DEC_FULL_IMAGE:
 			// g_print ("> JXL_DEC_FULL_IMAGE\n");
 			if (surface_data != NULL) {
@@ -199,96 +249,211 @@ GthImage* load_jxl (GBytes *bytes, guint requested_size, GCancellable *cancellab
 			image = NULL;
 		}
 	}
-	JxlThreadParallelRunnerDestroy (runner);
 	JxlDecoderDestroy (dec);
+
+	// A progressive pass is upsampled to the full size, scale it down to
+	// the requested size.
+	if ((image != NULL) && (requested_size > 0) && (gth_image_get_frames (image) == 0)) {
+		guint scaled_width = (guint) width;
+		guint scaled_height = (guint) height;
+		if ((MIN (scaled_width, scaled_height) > requested_size * 2)
+			&& scale_to_cover (&scaled_width, &scaled_height, requested_size, FALSE))
+		{
+			GthImage *scaled = gth_image_resize_to (image, scaled_width, scaled_height, GTH_SCALE_FILTER_GOOD, cancellable);
+			if (scaled != NULL) {
+				g_object_unref (image);
+				image = scaled;
+			}
+		}
+	}
+
 	return image;
 }
 
-gboolean load_jxl_info (GInputStream *stream, GthImageInfo *image_info, guchar *buffer, gsize buffer_size, GCancellable *cancellable) {
-	JxlSignature sig = JxlSignatureCheck (buffer, buffer_size);
-	if (sig <= JXL_SIG_INVALID) {
-		return FALSE;
+// Header parser, reads the size header and the beginning of the image
+// metadata as defined in ISO/IEC 18181-1, without creating a decoder.
+
+typedef struct {
+	const guchar *data;
+	gsize size;
+	gsize pos; // In bits.
+	gboolean error;
+} BitReader;
+
+static guint32 _read_bits (BitReader *reader, int n_bits) {
+	guint32 value = 0;
+	for (int i = 0; i < n_bits; i++) {
+		gsize byte = reader->pos >> 3;
+		if (byte >= reader->size) {
+			reader->error = TRUE;
+			return 0;
+		}
+		value |= (guint32) ((reader->data[byte] >> (reader->pos & 7)) & 1) << i;
+		reader->pos++;
 	}
+	return value;
+}
 
-	JxlDecoder *dec = JxlDecoderCreate (NULL);
-	if (dec == NULL) {
+// Each distribution is a list of { bits, offset }, a plain value is { 0, value }.
+static guint32 _read_u32 (BitReader *reader, const guint32 dist[4][2]) {
+	guint32 selector = _read_bits (reader, 2);
+	return dist[selector][1] + _read_bits (reader, dist[selector][0]);
+}
+
+static void _read_size (BitReader *reader, guint32 *width, guint32 *height) {
+	static const guint32 size_dist[4][2] = { { 9, 1 }, { 13, 1 }, { 18, 1 }, { 30, 1 } };
+	static const guint32 ratios[8][2] = { { 1, 1 }, { 1, 1 }, { 12, 10 }, { 4, 3 }, { 3, 2 }, { 16, 9 }, { 5, 4 }, { 2, 1 } };
+	gboolean small = _read_bits (reader, 1);
+	*height = small ? (_read_bits (reader, 5) + 1) * 8 : _read_u32 (reader, size_dist);
+	guint32 ratio = _read_bits (reader, 3);
+	if (ratio == 0) {
+		*width = small ? (_read_bits (reader, 5) + 1) * 8 : _read_u32 (reader, size_dist);
+	}
+	else {
+		*width = (guint32) ((guint64) *height * ratios[ratio][0] / ratios[ratio][1]);
+	}
+}
+
+static void _skip_preview_header (BitReader *reader) {
+	static const guint32 div8_dist[4][2] = { { 0, 16 }, { 0, 32 }, { 5, 1 }, { 9, 33 } };
+	static const guint32 size_dist[4][2] = { { 6, 1 }, { 8, 65 }, { 10, 321 }, { 12, 1345 } };
+	gboolean div8 = _read_bits (reader, 1);
+	_read_u32 (reader, div8 ? div8_dist : size_dist);
+	if (_read_bits (reader, 3) == 0) {
+		_read_u32 (reader, div8 ? div8_dist : size_dist);
+	}
+}
+
+static void _skip_animation_header (BitReader *reader) {
+	static const guint32 numerator_dist[4][2] = { { 0, 100 }, { 0, 1000 }, { 10, 1 }, { 30, 1 } };
+	static const guint32 denominator_dist[4][2] = { { 0, 1 }, { 0, 1001 }, { 8, 1 }, { 10, 1 } };
+	static const guint32 loops_dist[4][2] = { { 0, 0 }, { 3, 0 }, { 16, 0 }, { 32, 0 } };
+	_read_u32 (reader, numerator_dist);
+	_read_u32 (reader, denominator_dist);
+	_read_u32 (reader, loops_dist);
+	_read_bits (reader, 1); // have_timecodes
+}
+
+static gboolean _read_codestream_header (const guchar *data, gsize size, GthImageInfo *image_info) {
+	if ((size < 2) || (data[0] != 0xFF) || (data[1] != 0x0A)) {
 		return FALSE;
 	}
+	BitReader reader = {
+		.data = data + 2,
+		.size = size - 2,
+		.pos = 0,
+		.error = FALSE,
+	};
+
+	guint32 width, height;
+	_read_size (&reader, &width, &height);
+	if (reader.error) {
+		return FALSE;
+	}
+	image_info->width = width;
+	image_info->height = height;
+
+	gboolean all_default = _read_bits (&reader, 1);
+	if (!all_default) {
+		gboolean extra_fields = _read_bits (&reader, 1);
+		if (extra_fields) {
+			image_info->orientation = (GthTransform) (_read_bits (&reader, 3) + 1);
+			if (_read_bits (&reader, 1)) {
+				guint32 intrinsic_width, intrinsic_height;
+				_read_size (&reader, &intrinsic_width, &intrinsic_height);
+			}
+			if (_read_bits (&reader, 1)) {
+				_skip_preview_header (&reader);
+			}
+			if (_read_bits (&reader, 1)) {
+				_skip_animation_header (&reader);
+				image_info->frames = 0;
+			}
+		}
 
-	if (JxlDecoderSubscribeEvents (dec, JXL_DEC_BASIC_INFO) != JXL_DEC_SUCCESS) {
-		JxlDecoderDestroy (dec);
+		// Bit depth
+		static const guint32 int_depth_dist[4][2] = { { 0, 8 }, { 0, 10 }, { 0, 12 }, { 6, 1 } };
+		static const guint32 float_depth_dist[4][2] = { { 0, 32 }, { 0, 16 }, { 0, 24 }, { 6, 1 } };
+		gboolean float_sample = _read_bits (&reader, 1);
+		_read_u32 (&reader, float_sample ? float_depth_dist : int_depth_dist);
+		if (float_sample) {
+			_read_bits (&reader, 4);
+		}
+
+		_read_bits (&reader, 1); // modular_16bit_buffers
+
+		static const guint32 extra_channels_dist[4][2] = { { 0, 0 }, { 0, 1 }, { 4, 2 }, { 12, 1 } };
+		guint32 extra_channels = _read_u32 (&reader, extra_channels_dist);
+		if (extra_channels > 0) {
+			// Only the type of the first extra channel is checked.
+			static const guint32 type_dist[4][2] = { { 0, 0 }, { 0, 1 }, { 4, 2 }, { 6, 18 } };
+			gboolean default_alpha = _read_bits (&reader, 1);
+			image_info->has_alpha = default_alpha || (_read_u32 (&reader, type_dist) == 0);
+		}
+	}
+
+	if (reader.error) {
+		// The size is valid, ignore the rest.
+		image_info->orientation = GTH_TRANSFORM_NONE;
+		image_info->has_alpha = FALSE;
+		image_info->frames = 1;
+	}
+	return TRUE;
+}
+
+#define MAX_HEADER_SIZE 256
+#define MAX_BOXES 64
+
+static gboolean _read_at (GInputStream *stream, goffset offset, guchar *buffer, gsize size, gsize *bytes_read, GCancellable *cancellable) {
+	if (!g_seekable_seek (G_SEEKABLE (stream), offset, G_SEEK_SET, cancellable, NULL)) {
 		return FALSE;
 	}
+	return g_input_stream_read_all (stream, buffer, size, bytes_read, cancellable, NULL);
+}
 
-	if (JxlDecoderSetInput (dec, buffer, buffer_size) != JXL_DEC_SUCCESS) {
-		JxlDecoderDestroy (dec);
+gboolean load_jxl_info (GInputStream *stream, GthImageInfo *image_info, guchar *buffer, gsize buffer_size, GCancellable *cancellable) {
+	JxlSignature sig = JxlSignatureCheck (buffer, buffer_size);
+	if (sig == JXL_SIG_CODESTREAM) {
+		return _read_codestream_header (buffer, buffer_size, image_info);
+	}
+	if (sig != JXL_SIG_CONTAINER) {
 		return FALSE;
 	}
 
-	gboolean success = FALSE;
-	JxlDecoderStatus status = JXL_DEC_NEED_MORE_INPUT;
-	guchar *bigger_buffer = NULL;
-	size_t bigger_size;
-	while (status != JXL_DEC_SUCCESS) {
-		status = JxlDecoderProcessInput (dec);
-		if (status == JXL_DEC_ERROR) {
-			break;
+	// Find the first codestream box, skipping the others (Exif, xml, etc.).
+	goffset offset = 12;
+	guchar header[MAX_HEADER_SIZE];
+	for (int i = 0; i < MAX_BOXES; i++) {
+		gsize size;
+		if (!_read_at (stream, offset, header, 16, &size, cancellable) || (size < 8)) {
+			return FALSE;
 		}
-		else if (status == JXL_DEC_NEED_MORE_INPUT) {
-			size_t unprocessed = JxlDecoderReleaseInput (dec);
-			if (unprocessed > 0) {
-				guchar *prev_buffer;
-				size_t prev_size;
-				if (bigger_buffer != NULL) {
-					prev_buffer = bigger_buffer;
-					prev_size = bigger_size;
-				}
-				else {
-					prev_buffer = buffer;
-					prev_size = buffer_size;
-				}
-				bigger_size = unprocessed + prev_size;
-				bigger_buffer = g_new (guchar, bigger_size);
-				size_t processed = prev_size - unprocessed;
-				memcpy (bigger_buffer, prev_buffer + processed, unprocessed);
-				if (prev_buffer != buffer) {
-					g_free (prev_buffer);
-				}
-			}
-			else {
-				if (bigger_buffer == NULL) {
-					bigger_size = buffer_size;
-					bigger_buffer = g_new (guchar, bigger_size);
-				}
+		guint64 box_size = ((guint64) header[0] << 24) + (header[1] << 16) + (header[2] << 8) + header[3];
+		gsize header_size = 8;
+		if (box_size == 1) {
+			if (size < 16) {
+				return FALSE;
 			}
-			gsize read_bytes;
-			if (!g_input_stream_read_all (G_INPUT_STREAM (stream),
-				bigger_buffer + unprocessed,
-				bigger_size - unprocessed,
-				&read_bytes,
-				cancellable, NULL))
-			{
-				break;
-			}
-			read_bytes += unprocessed;
-			if (JxlDecoderSetInput (dec, bigger_buffer, read_bytes) != JXL_DEC_SUCCESS) {
-				break;
+			box_size = 0;
+			for (int j = 8; j < 16; j++) {
+				box_size = (box_size << 8) + header[j];
 			}
+			header_size = 16;
 		}
-		else if (status == JXL_DEC_BASIC_INFO) {
-			JxlBasicInfo info;
-			if (JxlDecoderGetBasicInfo (dec, &info) == JXL_DEC_SUCCESS) {
-				image_info->width = info.xsize;
-				image_info->height = info.ysize;
-				success = TRUE;
-			}
-			break;
+		if (memcmp (header + 4, "jxlc", 4) == 0) {
+			return _read_at (stream, offset + header_size, header, MAX_HEADER_SIZE, &size, cancellable)
+				&& _read_codestream_header (header, size, image_info);
 		}
+		if (memcmp (header + 4, "jxlp", 4) == 0) {
+			// Skip the part index.
+			return _read_at (stream, offset + header_size + 4, header, MAX_HEADER_SIZE, &size, cancellable)
+				&& _read_codestream_header (header, size, image_info);
+		}
+		if (box_size < header_size) {
+			// A zero size means the box extends to the end of the file.
+			return FALSE;
+		}
+		offset += box_size;
 	}
-	if (bigger_buffer != NULL) {
-		g_free (bigger_buffer);
-	}
-	JxlDecoderDestroy (dec);
-
-	return success;
+	return FALSE;
 }
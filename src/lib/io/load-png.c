@@ -3,6 +3,7 @@
 #include <lcms2.h>
 #include "lib/jpeg/jpeg-info.h" // For reading the color profile in EXIF data
 #include "lib/gth-icc-profile.h"
+#include "lib/gth-row-scaler.h"
 #include "load-png.h"
 
 #define PNG_SETJMP(ptr) setjmp(png_jmpbuf(ptr))
@@ -51,6 +52,8 @@ typedef struct {
 	png_struct *png_ptr;
 	png_info *png_info_ptr;
 	GthImage *image;
+	GthRowScaler *scaler;
+	guchar *row_buffer;
 	Animation animation;
 } LoaderData;
 
@@ -98,6 +101,8 @@ static void loader_data_destroy (LoaderData *loader_data) {
 	if (loader_data->image != NULL) {
 		g_object_unref (loader_data->image);
 	}
+	gth_row_scaler_free (loader_data->scaler);
+	g_free (loader_data->row_buffer);
 	if (loader_data->animation.frames != NULL) {
 		g_ptr_array_unref (loader_data->animation.frames);
 	}
@@ -197,7 +202,7 @@ static void transform_to_argb32_format_func (png_structp png, png_row_infop row_
 	rgba_big_endian_line_to_pixel (data, data, row_info->rowbytes / 4);
 }
 
-static GthImage* _load_png (GBytes *bytes, gboolean animation_frame, GCancellable *cancellable, GError **error);
+static GthImage* _load_png (GBytes *bytes, guint requested_size, gboolean animation_frame, GCancellable *cancellable, GError **error);
 
 // CRC implementation: https://www.w3.org/TR/png-3/#D-CRCAppendix
 
@@ -265,6 +270,126 @@ unsigned long crc(unsigned char *buf, int len) {
 	}
 }*/
 
+// Animation frames are decoded on demand.
+
+typedef struct {
+	GBytes *metadata; // The chunks before the first IDAT.
+	GPtrArray *frames;
+	GthImage *first_frame; // The static image, if part of the animation.
+	guint canvas_width;
+	guint canvas_height;
+} PngAnimation;
+
+static void png_animation_free (PngAnimation *animation) {
+	g_bytes_unref (animation->metadata);
+	g_ptr_array_unref (animation->frames);
+	_g_object_unref (animation->first_frame);
+	g_free (animation);
+}
+
+// Build a png image with the animation metadata, the frame data chunks and
+// the end chunk, and load it with _load_png.
+static GthImage * _load_frame (PngAnimation *animation, Frame *frame, GError **error) {
+	GByteArray* frame_data = g_byte_array_new ();
+
+	// Copy the main animation metadata
+	gsize metadata_len;
+	const uint8_t *metadata = g_bytes_get_data (animation->metadata, &metadata_len);
+	g_byte_array_append (frame_data, metadata, metadata_len);
+
+	// Update width and height
+	uint8_t *IHDR_chunk = frame_data->data + 8;
+	uint8_t *IHDR_data = IHDR_chunk + 4 + 4;
+	png_save_uint_32 (IHDR_data, frame->width);
+	png_save_uint_32 (IHDR_data + 4, frame->height);
+	// Update the IHDR chunk CRC
+	uint8_t chunk_field[4];
+	long chunk_crc = crc (IHDR_chunk + 4, 4 + 13);
+	png_save_uint_32 (IHDR_chunk + 21, chunk_crc);
+
+	// Add the IDAT chunks
+	// TODO: sort the data chunks if required
+	guint chunk_offset;
+	for (int j = 0; j < frame->data_chunks->len; j++) {
+		chunk_offset = frame_data->len;
+		DataChunk *chunk = g_ptr_array_index (frame->data_chunks, j);
+		// fdAT -> IDAT
+		gsize chunk_size;
+		const uint8_t *chunk_data = g_bytes_get_data (chunk->bytes, &chunk_size);
+		png_save_uint_32 (chunk_field, chunk_size);
+		g_byte_array_append (frame_data, chunk_field, 4);
+		g_byte_array_append (frame_data, (const uint8_t *) PNG_IDAT, 4);
+		g_byte_array_append (frame_data, chunk_data, chunk_size);
+		// CRC of type and data (not length)
+		chunk_crc = crc (frame_data->data + chunk_offset + 4, 4 + chunk_size);
+		png_save_uint_32 (chunk_field, chunk_crc);
+		g_byte_array_append (frame_data, chunk_field, 4);
+	}
+
+	// Add IEND
+	chunk_offset = frame_data->len;
+	png_save_uint_32 (chunk_field, 0); // length
+	g_byte_array_append (frame_data, chunk_field, 4);
+	g_byte_array_append (frame_data, (const uint8_t *) PNG_IEND, 4);
+	chunk_crc = crc (frame_data->data + chunk_offset + 4, 4);
+	png_save_uint_32 (chunk_field, chunk_crc);
+	g_byte_array_append (frame_data, chunk_field, 4);
+
+	GBytes *frame_bytes = g_byte_array_free_to_bytes (frame_data);
+	//inspect_content (frame_bytes);
+
+	GthImage *foreground = _load_png (frame_bytes, 0, true, NULL, error);
+	g_bytes_unref (frame_bytes);
+
+	return foreground;
+}
+
+static GthImage * _render_frame (guint frame_index, GthImage **background, gpointer user_data, GError **error) {
+	PngAnimation *animation = user_data;
+	Frame *frame = g_ptr_array_index (animation->frames, frame_index);
+
+	GthImage *canvas = NULL;
+	if (frame->data_chunks->len == 0) {
+		if ((frame_index > 0) || (animation->first_frame == NULL)) {
+			// Error: frame without data
+			g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+				"Frame %u has no data.", frame_index);
+			return NULL;
+		}
+		// Use the static image as first frame.
+		canvas = g_object_ref (animation->first_frame);
+	}
+	else {
+		GthImage *foreground = _load_frame (animation, frame, error);
+		if (foreground == NULL) {
+			if ((error != NULL) && (*error == NULL)) {
+				g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+					"Cannot allocate memory for frame %u.", frame_index);
+			}
+			return NULL;
+		}
+
+		canvas = gth_image_new (animation->canvas_width, animation->canvas_height);
+		if (canvas == NULL) {
+			g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+				"Cannot allocate memory for frame %u.", frame_index);
+			g_object_unref (foreground);
+			return NULL;
+		}
+		gth_image_render_frame (canvas, *background, 0,
+			foreground, frame->x_offset, frame->y_offset,
+			(frame->blend_op == APNG_BLEND_OP_OVER));
+		g_object_unref (foreground);
+	}
+
+	if (frame->dispose_op != APNG_DISPOSE_OP_PREVIOUS) {
+		_g_object_unref (*background);
+		*background = (frame->dispose_op == APNG_DISPOSE_OP_NONE) ? g_object_ref (canvas) : NULL;
+	}
+
+	return canvas;
+}
+
 static bool _compose_animation (LoaderData *loader_data, GCancellable *cancellable, GError **error) {
 	Animation *animation = &loader_data->animation;
 
@@ -310,16 +435,12 @@ static bool _compose_animation (LoaderData *loader_data, GCancellable *cancellab
 
 	guint canvas_width = gth_image_get_width (loader_data->image);
 	guint canvas_height = gth_image_get_height (loader_data->image);
-	GthImage *background = NULL;
 
-	// For each frame build the png image appending to the
-	// animation metadata the frame data chunks and the end chunk.
-	// Load the frame png with _load_png
+	// Check the size and position of the frames.
 	// TODO: sort frames if required.
 	for (int i = 0; i < animation->frames->len; i++) {
 		Frame *frame = g_ptr_array_index (animation->frames, i);
 
-		// Check frame size and position
 		if ((frame->x_offset + frame->width > canvas_width)
 			|| (frame->y_offset + frame->height > canvas_height))
 		{
@@ -328,7 +449,6 @@ static bool _compose_animation (LoaderData *loader_data, GCancellable *cancellab
 			return FALSE;
 		}
 
-		// Check first frame size and position.
 		if (i == 0) {
 			if ((frame->x_offset != 0)
 				|| (frame->y_offset != 0))
@@ -346,132 +466,64 @@ static bool _compose_animation (LoaderData *loader_data, GCancellable *cancellab
 				return FALSE;
 			}
 		}
-
-		if (frame->data_chunks->len == 0) {
-			if (i == 0) {
-				// Use the static image as first frame.
-				GthImage *first_frame = gth_image_new_as_frame (loader_data->image);
-				gth_image_add_frame (loader_data->image, first_frame, frame->delay);
-				if (frame->dispose_op == APNG_DISPOSE_OP_NONE) {
-					background = g_object_ref (first_frame);
-				}
-				g_object_unref (first_frame);
-				continue;
-			}
-
-			// Error: frame without data
+		else if (frame->data_chunks->len == 0) {
 			g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
 				"Frame %d has no data.", i);
 			return FALSE;
 		}
+	}
 
-		//g_print ("> BUILD FRAME %d (DATA CHUNKS: %d)\n", i, frame->data_chunks->len);
-
-		GByteArray* frame_data = g_byte_array_new ();
-
-		// Copy the main animation metadata
-		g_byte_array_append (frame_data, animation_data, metadata_len);
-
-		// Update width and height
-		uint8_t *IHDR_chunk = frame_data->data + 8;
-		uint8_t *IHDR_data = IHDR_chunk + 4 + 4;
-		png_save_uint_32 (IHDR_data, frame->width);
-		png_save_uint_32 (IHDR_data + 4, frame->height);
-		// Update the IHDR chunk CRC
-		uint8_t chunk_field[4];
-		long chunk_crc = crc (IHDR_chunk + 4, 4 + 13);
-		png_save_uint_32 (IHDR_chunk + 21, chunk_crc);
-
-		// Add the IDAT chunks
-		// TODO: sort the data chunks if required
-		guint chunk_offset;
-		for (int j = 0; j < frame->data_chunks->len; j++) {
-			chunk_offset = frame_data->len;
-			DataChunk *chunk = g_ptr_array_index (frame->data_chunks, j);
-			// fdAT -> IDAT
-			gsize chunk_size;
-			const uint8_t *chunk_data = g_bytes_get_data (chunk->bytes, &chunk_size);
-			png_save_uint_32 (chunk_field, chunk_size);
-			g_byte_array_append (frame_data, chunk_field, 4);
-			g_byte_array_append (frame_data, (const uint8_t *) PNG_IDAT, 4);
-			g_byte_array_append (frame_data, chunk_data, chunk_size);
-			// CRC of type and data (not length)
-			chunk_crc = crc (frame_data->data + chunk_offset + 4, 4 + chunk_size);
-			png_save_uint_32 (chunk_field, chunk_crc);
-			g_byte_array_append (frame_data, chunk_field, 4);
-		}
-
-		// Add IEND
-		chunk_offset = frame_data->len;
-		png_save_uint_32 (chunk_field, 0); // length
-		g_byte_array_append (frame_data, chunk_field, 4);
-		g_byte_array_append (frame_data, (const uint8_t *) PNG_IEND, 4);
-		chunk_crc = crc (frame_data->data + chunk_offset + 4, 4);
-		png_save_uint_32 (chunk_field, chunk_crc);
-		g_byte_array_append (frame_data, chunk_field, 4);
-
-		GBytes *frame_bytes = g_byte_array_free_to_bytes (frame_data);
-		//inspect_content (frame_bytes);
-
-		GthImage *foreground = _load_png (frame_bytes, true, cancellable, error);
-		g_bytes_unref (frame_bytes);
-
-		if ((error != NULL) && (*error != NULL)) {
-			return FALSE;
-		}
-
-		if (g_cancellable_is_cancelled (cancellable)) {
-			if (foreground != NULL) {
-				g_object_unref (foreground);
-			}
-			g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_CANCELLED, "Cancelled");
-			return FALSE;
-		}
+	PngAnimation *png_animation = g_new0 (PngAnimation, 1);
+	// A copy, not a slice: bytes can be a mapping of a file that may change
+	// while the frames are rendered.
+	png_animation->metadata = g_bytes_new (g_bytes_get_data (loader_data->bytes, NULL), metadata_len);
+	png_animation->frames = g_ptr_array_ref (animation->frames);
+	png_animation->first_frame = gth_image_new_as_frame (loader_data->image);
+	png_animation->canvas_width = canvas_width;
+	png_animation->canvas_height = canvas_height;
 
-		if (foreground == NULL) {
-			g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
-				"Cannot allocate memory for frame %d.", i);
-			return FALSE;
-		}
+	// Decode the first frame now, the others when requested.
+	GthImage *background = NULL;
+	GthImage *first_frame = _render_frame (0, &background, png_animation, error);
+	_g_object_unref (background);
+	if (first_frame == NULL) {
+		png_animation_free (png_animation);
+		return FALSE;
+	}
+	if ((cancellable != NULL) && g_cancellable_is_cancelled (cancellable)) {
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_CANCELLED, "Cancelled");
+		g_object_unref (first_frame);
+		png_animation_free (png_animation);
+		return FALSE;
+	}
 
-		// Render the new frame and add to loader_data.image
+	Frame *frame = g_ptr_array_index (animation->frames, 0);
+	gth_image_add_frame (loader_data->image, first_frame, frame->delay);
+	g_object_unref (first_frame);
+	for (int i = 1; i < animation->frames->len; i++) {
+		frame = g_ptr_array_index (animation->frames, i);
+		gth_image_add_lazy_frame (loader_data->image, frame->delay);
+	}
 
-		GthImage *canvas = gth_image_new (canvas_width, canvas_height);
-		if (canvas == NULL) {
-			g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
-				"Cannot allocate memory for frame %d.", i);
-			return FALSE;
-		}
-		gth_image_render_frame (canvas, background, 0,
-			foreground, frame->x_offset, frame->y_offset,
-			(frame->blend_op == APNG_BLEND_OP_OVER));
-		gth_image_add_frame (loader_data->image, canvas, frame->delay);
+	// The static image is not needed if it's not part of the animation.
+	frame = g_ptr_array_index (animation->frames, 0);
+	if (frame->data_chunks->len > 0) {
+		g_clear_object (&png_animation->first_frame);
+	}
 
-		if (frame->dispose_op != APNG_DISPOSE_OP_PREVIOUS) {
-			if (background != NULL) {
-				g_object_unref (background);
-				background = NULL;
-			}
-			if (frame->dispose_op == APNG_DISPOSE_OP_NONE) {
-				background = g_object_ref (canvas);
-			}
-		}
+	gth_image_set_frame_renderer (loader_data->image, _render_frame, png_animation, (GDestroyNotify) png_animation_free);
 
-		g_object_unref (canvas);
-		g_object_unref (foreground);
-	}
-	if (background != NULL) {
-		g_object_unref (background);
-	}
 	return true;
 }
 
-static GthImage* _load_png (GBytes *bytes, gboolean animation_frame, GCancellable *cancellable, GError **error) {
+static GthImage* _load_png (GBytes *bytes, guint requested_size, gboolean animation_frame, GCancellable *cancellable, GError **error) {
 	LoaderData loader_data;
 	loader_data.bytes = g_bytes_ref (bytes);
 	loader_data.cancellable = cancellable;
 	loader_data.bytes_offset = 0;
 	loader_data.image = NULL;
+	loader_data.scaler = NULL;
+	loader_data.row_buffer = NULL;
 	loader_data.error = error;
 	loader_data.png_ptr = png_create_read_struct (PNG_LIBPNG_VER_STRING,
 		&loader_data.error, error_func, warning_func);
@@ -515,7 +567,25 @@ static GthImage* _load_png (GBytes *bytes, gboolean animation_frame, GCancellabl
 		&width, &height, &bit_depth, &color_type, &interlace_type,
 		NULL, NULL);
 
-	loader_data.image = gth_image_new (width, height);
+	// Large images are reduced while reading the rows if a smaller size is
+	// requested.  Interlaced images and animations are loaded at full size.
+	guint scaled_width = width;
+	guint scaled_height = height;
+	if ((requested_size > 0)
+		&& !animation_frame
+		&& (loader_data.animation.n_frames == 0)
+		&& (interlace_type == PNG_INTERLACE_NONE)
+		&& (MIN (width, height) > requested_size * 2)
+		&& scale_to_cover (&scaled_width, &scaled_height, requested_size, FALSE))
+	{
+		loader_data.scaler = gth_row_scaler_new (width, height, scaled_width, scaled_height);
+		if (loader_data.scaler != NULL) {
+			loader_data.image = gth_row_scaler_get_image (loader_data.scaler);
+		}
+	}
+	else {
+		loader_data.image = gth_image_new (width, height);
+	}
 	if (loader_data.image == NULL) {
 		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
 			"Failed to allocate memory");
@@ -549,14 +619,25 @@ static GthImage* _load_png (GBytes *bytes, gboolean animation_frame, GCancellabl
 
 	// Read the image.
 
-	int row_stride;
-	guchar *surface_row = gth_image_prepare_edit (loader_data.image, &row_stride, NULL, NULL);
-	png_bytep *row_pointers = g_new (png_bytep, height);
-	for (int row = 0; row < height; row++) {
-		row_pointers[row] = surface_row;
-		surface_row += row_stride;
+	png_bytep *row_pointers = NULL;
+	if (loader_data.scaler != NULL) {
+		loader_data.row_buffer = g_malloc (png_get_rowbytes (loader_data.png_ptr, loader_data.png_info_ptr));
+		for (png_uint_32 row = 0; row < height; row++) {
+			png_read_row (loader_data.png_ptr, loader_data.row_buffer, NULL);
+			gth_row_scaler_add_row (loader_data.scaler, loader_data.row_buffer);
+		}
+		gth_image_set_original_size (loader_data.image, width, height);
+	}
+	else {
+		int row_stride;
+		guchar *surface_row = gth_image_prepare_edit (loader_data.image, &row_stride, NULL, NULL);
+		row_pointers = g_new (png_bytep, height);
+		for (int row = 0; row < height; row++) {
+			row_pointers[row] = surface_row;
+			surface_row += row_stride;
+		}
+		png_read_image (loader_data.png_ptr, row_pointers);
 	}
-	png_read_image (loader_data.png_ptr, row_pointers);
 	png_read_end (loader_data.png_ptr, loader_data.png_info_ptr);
 
 	// Read some metadata.
@@ -678,7 +759,7 @@ static GthImage* _load_png (GBytes *bytes, gboolean animation_frame, GCancellabl
 
 GthImage* load_png (GBytes *bytes, guint requested_size, GCancellable *cancellable, GError **error) {
 	//inspect_content (bytes);
-	return _load_png (bytes, FALSE, cancellable, error);
+	return _load_png (bytes, requested_size, FALSE, cancellable, error);
 }
 
 GHashTable* load_png_attributes (GBytes *bytes, GError **error) {
@@ -687,6 +768,8 @@ GHashTable* load_png_attributes (GBytes *bytes, GError **error) {
 	loader_data.cancellable = NULL;
 	loader_data.bytes_offset = 0;
 	loader_data.image = NULL;
+	loader_data.scaler = NULL;
+	loader_data.row_buffer = NULL;
 	loader_data.error = error;
 	loader_data.png_ptr = png_create_read_struct (
 		PNG_LIBPNG_VER_STRING,
@@ -1,6 +1,10 @@
 #include <config.h>
 #include <glib.h>
 #include <libraw/libraw.h>
+extern "C" {
+#include "lib/jpeg/jpeg-info.h"
+}
+#include "load-jpeg.h"
 #include "load-raw.h"
 
 class GInputStream_datastream : public LibRaw_abstract_datastream {
@@ -187,6 +191,91 @@ static GthImage * _libraw_read_bitmap_data (int width, int height, int colors,
 	return image;
 }
 
+static GthTransform _libraw_get_orientation (LibRaw *raw_proc) {
+	switch (raw_proc->imgdata.sizes.flip) {
+	case 3:
+		return GTH_TRANSFORM_ROTATE_180;
+	case 5:
+		return GTH_TRANSFORM_ROTATE_270;
+	case 6:
+		return GTH_TRANSFORM_ROTATE_90;
+	default:
+		return GTH_TRANSFORM_NONE;
+	}
+}
+
+// Returns the preview image embedded by the camera if it is at least
+// requested_size pixels large, NULL otherwise.
+static GthImage * _libraw_load_embedded_preview (LibRaw *raw_proc, guint requested_size,
+	GCancellable *cancellable)
+{
+	if (raw_proc->unpack_thumb () != LIBRAW_SUCCESS) {
+		return NULL;
+	}
+
+	auto thumbnail = &raw_proc->imgdata.thumbnail;
+	if (MAX (thumbnail->twidth, thumbnail->theight) < requested_size) {
+		return NULL;
+	}
+
+	int result;
+	auto processed_image = raw_proc->dcraw_make_mem_thumb (&result);
+	if (processed_image == NULL) {
+		return NULL;
+	}
+
+	GthImage *image = NULL;
+	gboolean oriented = FALSE;
+
+	switch (processed_image->type) {
+	case LIBRAW_IMAGE_JPEG: {
+		// The preview can have its own orientation tag, applied by load_jpeg.
+		JpegInfoData jpeg_info;
+		_jpeg_info_data_init (&jpeg_info);
+		_jpeg_info_get_from_buffer (processed_image->data, processed_image->data_size,
+			_JPEG_INFO_EXIF_ORIENTATION, &jpeg_info);
+		oriented = (jpeg_info.valid & _JPEG_INFO_EXIF_ORIENTATION)
+			&& (jpeg_info.orientation != GTH_TRANSFORM_NONE);
+		_jpeg_info_data_dispose (&jpeg_info);
+
+		GBytes *bytes = g_bytes_new_static (processed_image->data, processed_image->data_size);
+		image = load_jpeg (bytes, requested_size, cancellable, NULL);
+		g_bytes_unref (bytes);
+		break;
+	}
+
+	case LIBRAW_IMAGE_BITMAP:
+		if ((processed_image->bits == 8)
+			&& ((processed_image->colors == 1) || (processed_image->colors == 3)))
+		{
+			image = _libraw_read_bitmap_data (
+				processed_image->width,
+				processed_image->height,
+				processed_image->colors,
+				processed_image->bits,
+				processed_image->data,
+				processed_image->data_size);
+		}
+		break;
+
+	default:
+		break;
+	}
+
+	LibRaw::dcraw_clear_mem (processed_image);
+
+	if ((image != NULL) && !oriented) {
+		GthTransform orientation = _libraw_get_orientation (raw_proc);
+		if (orientation != GTH_TRANSFORM_NONE) {
+			GthImage *rotated = gth_image_apply_transform (image, orientation, cancellable);
+			g_object_unref (image);
+			image = rotated;
+		}
+	}
+
+	return image;
+}
+
 typedef enum {
 	RAW_OUTPUT_COLOR_RAW = 0,
 	RAW_OUTPUT_COLOR_SRGB = 1,
@@ -208,26 +297,40 @@ GthImage* load_raw (GBytes *bytes, guint requested_size, GCancellable *cancellab
 	raw_proc->imgdata.params.use_camera_matrix = TRUE;
 	raw_proc->imgdata.params.output_color = RAW_OUTPUT_COLOR_SRGB;
 	raw_proc->imgdata.params.output_bps = 8;
-	// raw_proc->imgdata.params.half_size = (requested_size > 0);
 	if (cancellable != NULL) {
 		raw_proc->set_progress_handler (_libraw_progress_cb, cancellable);
 	}
 
 	gsize buffer_size;
 	gconstpointer buffer = g_bytes_get_data (bytes, &buffer_size);
+	GthImage *image = NULL;
 	int result;
 
 	result = raw_proc->open_buffer (buffer, buffer_size);
 	if (result != LIBRAW_SUCCESS) {
 		g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
 			"open_buffer failed: %s", libraw_strerror (result));
+		delete raw_proc;
 		return NULL;
 	}
 
+	if (requested_size > 0) {
+		// Use the preview embedded by the camera when it's large enough,
+		// otherwise demosaic at half resolution if that is still enough.
+		image = _libraw_load_embedded_preview (raw_proc, requested_size, cancellable);
+		if (image != NULL) {
+			delete raw_proc;
+			return image;
+		}
+		auto sizes = &raw_proc->imgdata.sizes;
+		raw_proc->imgdata.params.half_size = (MAX (sizes->width, sizes->height) / 2 >= requested_size);
+	}
+
 	result = raw_proc->unpack ();
 	if (result != LIBRAW_SUCCESS) {
 		g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
 			"unpack failed: %s", libraw_strerror (result));
+		delete raw_proc;
 		return NULL;
 	}
 
@@ -235,6 +338,7 @@ GthImage* load_raw (GBytes *bytes, guint requested_size, GCancellable *cancellab
 	if (result != LIBRAW_SUCCESS) {
 		g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
 			"dcraw_process failed: %s", libraw_strerror (result));
+		delete raw_proc;
 		return NULL;
 	}
 
@@ -242,11 +346,10 @@ GthImage* load_raw (GBytes *bytes, guint requested_size, GCancellable *cancellab
 	if (result != LIBRAW_SUCCESS) {
 		g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
 			"dcraw_make_mem_image failed: %s", libraw_strerror (result));
+		delete raw_proc;
 		return NULL;
 	}
 
-	GthImage *image = NULL;
-
 	switch (processed_image->type) {
 	case LIBRAW_IMAGE_BITMAP:
 		image = _libraw_read_bitmap_data (
@@ -264,6 +367,7 @@ GthImage* load_raw (GBytes *bytes, guint requested_size, GCancellable *cancellab
 	}
 
 	LibRaw::dcraw_clear_mem (processed_image);
+	delete raw_proc;
 
 	return image;
 }
@@ -275,21 +379,26 @@ gboolean load_raw_info (GInputStream *stream, GthImageInfo *image_info,
 	if (!g_seekable_seek (G_SEEKABLE (stream), 0, G_SEEK_SET, cancellable, NULL)) {
 		return FALSE;
 	}
+
+	// Only the metadata is parsed, no pixel data is read.
 	auto raw_proc = new LibRaw (LIBRAW_OPTIONS_NO_DATAERR_CALLBACK);
 	auto data_stream = new GInputStream_datastream (stream);
 	if (cancellable != NULL) {
 		raw_proc->set_progress_handler (_libraw_progress_cb, cancellable);
 	}
-	int result = raw_proc->open_datastream (data_stream);
-	if (result != LIBRAW_SUCCESS) {
-		return FALSE;
-	}
-	result = raw_proc->adjust_sizes_info_only ();
-	if (result != LIBRAW_SUCCESS) {
-		return FALSE;
+	gboolean success = FALSE;
+	if ((raw_proc->open_datastream (data_stream) == LIBRAW_SUCCESS)
+		&& (raw_proc->adjust_sizes_info_only () == LIBRAW_SUCCESS))
+	{
+		// iwidth and iheight already take the orientation into account.
+		auto sizes = &raw_proc->imgdata.sizes;
+		gboolean swapped = (sizes->flip & 4) != 0;
+		image_info->width = swapped ? sizes->iheight : sizes->iwidth;
+		image_info->height = swapped ? sizes->iwidth : sizes->iheight;
+		image_info->orientation = _libraw_get_orientation (raw_proc);
+		success = TRUE;
 	}
-	image_info->width = raw_proc->imgdata.sizes.iwidth;
-	image_info->height = raw_proc->imgdata.sizes.iheight;
-	// g_print ("> load_raw_info: %dx%d\n", image_info->width, image_info->height);
-	return TRUE;
+	delete raw_proc;
+	delete data_stream;
+	return success;
 }
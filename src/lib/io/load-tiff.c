@@ -2,6 +2,7 @@
 #include <lcms2.h>
 #include <tiff.h>
 #include <tiffio.h>
+#include "lib/gth-row-scaler.h"
 #include "load-tiff.h"
 
 #define HANDLE(x) ((Handle *) (x))
@@ -63,7 +64,108 @@ static void tiff_error_handler (const char *module, const char *fmt, va_list ap)
 }
 
 
-GthImage * load_tiff (GBytes *bytes, guint requested_size, GCancellable *cancellable, GError **error) {
+// Returns the number of rows to decode at once when reducing the image, or
+// 0 if the image is stored in a single strip, which would be decoded again
+// for each band.
+static uint32_t get_band_height (TIFF *tif, uint32_t image_height) {
+	uint32_t band_height = 0;
+	if (TIFFIsTiled (tif)) {
+		if (TIFFGetField (tif, TIFFTAG_TILELENGTH, &band_height) != 1) {
+			band_height = 0;
+		}
+	}
+	else if (TIFFGetFieldDefaulted (tif, TIFFTAG_ROWSPERSTRIP, &band_height) != 1) {
+		band_height = 0;
+	}
+	if (band_height >= image_height) {
+		band_height = 0;
+	}
+	return band_height;
+}
+
+
+// Reads the current directory one band at a time and reduces each row to
+// the scaled size, without allocating the full size image.  The rows are
+// read as stored, the orientation is applied by the caller.
+static GthImage * load_scaled_image (TIFF *tif,
+	uint32_t image_width,
+	uint32_t image_height,
+	uint32_t band_height,
+	guint scaled_width,
+	guint scaled_height,
+	GCancellable *cancellable,
+	GError **error)
+{
+	char emsg[1024];
+	TIFFRGBAImage rgba_image;
+	if (!TIFFRGBAImageBegin (&rgba_image, tif, 0, emsg)) {
+		g_set_error_literal (error,
+			G_IO_ERROR,
+			G_IO_ERROR_INVALID_DATA,
+			emsg);
+		return NULL;
+	}
+	rgba_image.req_orientation = rgba_image.orientation;
+
+	GthRowScaler *scaler = gth_row_scaler_new (image_width, image_height, scaled_width, scaled_height);
+	uint32_t *raster = (uint32_t*) _TIFFmalloc (image_width * band_height * sizeof (uint32_t));
+	if ((scaler == NULL) || (raster == NULL)) {
+		if (raster != NULL) {
+			_TIFFfree (raster);
+		}
+		gth_row_scaler_free (scaler);
+		TIFFRGBAImageEnd (&rgba_image);
+		g_set_error_literal (error,
+			G_IO_ERROR,
+			G_IO_ERROR_INVALID_DATA,
+			"Could not allocate memory to load the image");
+		return NULL;
+	}
+
+	guchar *row = g_malloc (image_width * PIXEL_BYTES);
+	int src_row_stride = image_width * 4;
+	gboolean success = TRUE;
+	for (uint32_t y = 0; y < image_height; y += band_height) {
+		if (g_cancellable_is_cancelled (cancellable)) {
+			g_set_error_literal (error,
+				G_IO_ERROR,
+				G_IO_ERROR_CANCELLED,
+				"Cancelled");
+			success = FALSE;
+			break;
+		}
+		uint32_t rows = MIN (band_height, image_height - y);
+		rgba_image.row_offset = y;
+		if (!TIFFRGBAImageGet (&rgba_image, raster, image_width, rows)) {
+			g_set_error_literal (error,
+				G_IO_ERROR,
+				G_IO_ERROR_INVALID_DATA,
+				"Could not read the image");
+			success = FALSE;
+			break;
+		}
+		guchar *src_row = (guchar *) raster;
+		for (uint32_t i = 0; i < rows; i++) {
+			abgr_line_to_pixel (row, src_row, image_width);
+			gth_row_scaler_add_row (scaler, row);
+			src_row += src_row_stride;
+		}
+	}
+
+	GthImage *image = success ? gth_row_scaler_get_image (scaler) : NULL;
+
+	g_free (row);
+	_TIFFfree (raster);
+	gth_row_scaler_free (scaler);
+	TIFFRGBAImageEnd (&rgba_image);
+
+	return image;
+}
+
+
+// If scale_while_reading is FALSE only the reduced resolution directories
+// are used to reduce the image.
+static GthImage * _load_tiff (GBytes *bytes, guint requested_size, gboolean scale_while_reading, GCancellable *cancellable, GError **error) {
 	gsize in_buffer_size;
 	const void *in_buffer = g_bytes_get_data (bytes, &in_buffer_size);
 	if (in_buffer_size == 0) {
@@ -209,6 +311,55 @@ GthImage * load_tiff (GBytes *bytes, guint requested_size, GCancellable *cancell
 
 	TIFFSetDirectory (tif, best_directory);
 
+	// Reduce large images while reading if no directory has a size close
+	// to the requested size.
+	guint scaled_width = image_width;
+	guint scaled_height = image_height;
+	uint32_t band_height = 0;
+	if (scale_while_reading
+		&& (requested_size > 0)
+		&& (MIN (image_width, image_height) > requested_size * 2)
+		&& scale_to_cover (&scaled_width, &scaled_height, requested_size, FALSE))
+	{
+		band_height = get_band_height (tif, image_height);
+	}
+	if (band_height > 0) {
+		GthImage *image = load_scaled_image (tif,
+			image_width,
+			image_height,
+			band_height,
+			scaled_width,
+			scaled_height,
+			cancellable,
+			error);
+		TIFFClose (tif);
+		g_object_unref (handle.istream);
+		if (image == NULL) {
+			_g_object_unref (profile);
+			return NULL;
+		}
+
+		gth_image_set_has_alpha (image, (extrasamples == 1) || (spp == 4));
+		if (profile != NULL) {
+			gth_image_set_icc_profile (image, profile);
+			g_object_unref (profile);
+		}
+		if (orientation != GTH_TRANSFORM_NONE) {
+			GthImage *rotated = gth_image_apply_transform (image, orientation, cancellable);
+			g_object_unref (image);
+			image = rotated;
+		}
+		if (image != NULL) {
+			if ((orientation >= GTH_TRANSFORM_TRANSPOSE) && (orientation <= GTH_TRANSFORM_ROTATE_270)) {
+				gth_image_set_original_size (image, image_height, image_width);
+			}
+			else {
+				gth_image_set_original_size (image, image_width, image_height);
+			}
+		}
+		return image;
+	}
+
 	GthImage *image = gth_image_new (image_width, image_height);
 	if (image == NULL) {
 		TIFFClose (tif);
@@ -363,6 +514,18 @@ static bool _skip (Reader *reader, guint32 offset) {
 }
 
 
+GthImage * load_tiff (GBytes *bytes, guint requested_size, GCancellable *cancellable, GError **error) {
+	return _load_tiff (bytes, requested_size, TRUE, cancellable, error);
+}
+
+
+// Returns the full size image if the file has no reduced resolution
+// directories.
+GthImage * load_tiff_preview (GBytes *bytes, guint requested_size, GCancellable *cancellable, GError **error) {
+	return _load_tiff (bytes, requested_size, FALSE, cancellable, error);
+}
+
+
 gboolean load_tiff_info (GInputStream *stream, GthImageInfo *image_info, GCancellable *cancellable) {
 	Reader reader = {
 		.stream = stream,
@@ -403,7 +566,7 @@ gboolean load_tiff_info (GInputStream *stream, GthImageInfo *image_info, GCancel
 		return FALSE;
 	}
 
-	int remaining_tags = 3;
+	int remaining_tags = 4;
 	int remaining_dimensions = 2;
 	int orientation = ORIENTATION_TOPLEFT;
 
@@ -439,7 +602,8 @@ gboolean load_tiff_info (GInputStream *stream, GthImageInfo *image_info, GCancel
 
 			if ((entry_tag == TIFFTAG_IMAGEWIDTH)
 				|| (entry_tag == TIFFTAG_IMAGELENGTH)
-				|| (entry_tag == TIFFTAG_ORIENTATION))
+				|| (entry_tag == TIFFTAG_ORIENTATION)
+				|| (entry_tag == TIFFTAG_EXTRASAMPLES))
 			{
 				guint16 entry_type;
 				if (!_read_uint16_t (&reader, &entry_type)) {
@@ -456,6 +620,13 @@ gboolean load_tiff_info (GInputStream *stream, GthImageInfo *image_info, GCancel
 					return FALSE;
 				}
 
+				if (entry_tag == TIFFTAG_EXTRASAMPLES) {
+					// Only the presence of an extra sample matters.
+					image_info->has_alpha = (count > 0);
+					remaining_tags--;
+					continue;
+				}
+
 				if (count != 1) {
 					return FALSE;
 				}
@@ -519,7 +690,8 @@ gboolean load_tiff_info (GInputStream *stream, GthImageInfo *image_info, GCancel
 			}
 		}
 
-		if (remaining_tags == 0) {
+		// Stop at the first directory that contains the image size.
+		if (remaining_dimensions == 0) {
 			break;
 		}
 
@@ -534,10 +706,8 @@ gboolean load_tiff_info (GInputStream *stream, GthImageInfo *image_info, GCancel
 		return FALSE;
 	}
 
-	if (orientation >= ORIENTATION_LEFTTOP) {
-		uint tmp = image_info->width;
-		image_info->width = image_info->height;
-		image_info->height = tmp;
+	if ((orientation >= ORIENTATION_TOPLEFT) && (orientation <= ORIENTATION_LEFTBOT)) {
+		image_info->orientation = (GthTransform) orientation;
 	}
 
 	return TRUE;
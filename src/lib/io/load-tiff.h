@@ -8,6 +8,7 @@
 G_BEGIN_DECLS
 
 GthImage * load_tiff (GBytes *bytes, guint requested_size, GCancellable *cancellable, GError **error);
+GthImage * load_tiff_preview (GBytes *bytes, guint requested_size, GCancellable *cancellable, GError **error);
 gboolean load_tiff_info (GInputStream *stream, GthImageInfo *image_info, GCancellable *cancellable);
 
 G_END_DECLS
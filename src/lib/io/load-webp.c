@@ -7,145 +7,195 @@
 #include "lib/gth-icc-profile.h"
 #include "load-webp.h"
 
-GthImage* load_webp (GBytes *bytes, guint requested_size, GCancellable *cancellable, GError **error) {
+// Decodes the frame in image, scaling it if the image size is not the frame
+// size.
+static gboolean decode_frame (WebPIterator *iter, GthImage *image, GError **error) {
 	WebPDecoderConfig config;
 	if (!WebPInitDecoderConfig (&config)) {
 		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED, "WebPInitDecoderConfig failed");
+		return FALSE;
+	}
+
+	guint width = gth_image_get_width (image);
+	guint height = gth_image_get_height (image);
+	config.options.no_fancy_upsampling = 1;
+	if ((width != iter->width) || (height != iter->height)) {
+		config.options.use_scaling = 1;
+		config.options.scaled_width = width;
+		config.options.scaled_height = height;
+	}
+#if G_BYTE_ORDER == G_LITTLE_ENDIAN
+	config.output.colorspace = MODE_bgrA;
+#elif G_BYTE_ORDER == G_BIG_ENDIAN
+	config.output.colorspace = MODE_Argb;
+#endif
+	gsize image_size;
+	config.output.u.RGBA.rgba = (uint8_t *) gth_image_get_pixels (image, &image_size);
+	config.output.u.RGBA.stride = (int) gth_image_get_row_stride (image);
+	config.output.u.RGBA.size = (size_t) image_size;
+	config.output.is_external_memory = 1;
+	config.output.width = width;
+	config.output.height = height;
+
+	gboolean success = WebPDecode (iter->fragment.bytes, iter->fragment.size, &config) == VP8_STATUS_OK;
+	if (!success) {
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED, "WebPDecode failed");
+	}
+	WebPFreeDecBuffer (&config.output);
+
+	return success;
+}
+
+// Animation frames are decoded on demand.
+
+typedef struct {
+	GBytes *bytes;
+	WebPDemuxer *demux;
+	guint canvas_width;
+	guint canvas_height;
+	uint32_t background_color;
+} WebPAnimation;
+
+static void webp_animation_free (WebPAnimation *animation) {
+	WebPDemuxDelete (animation->demux);
+	g_bytes_unref (animation->bytes);
+	g_free (animation);
+}
+
+static GthImage * render_frame (guint frame_index, GthImage **background, gpointer user_data, GError **error) {
+	WebPAnimation *animation = user_data;
+
+	WebPIterator iter;
+	if (!WebPDemuxGetFrame (animation->demux, (int) frame_index + 1, &iter)) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED, "Cannot read frame %u.", frame_index);
+		return NULL;
+	}
+
+	GthImage *foreground = gth_image_new (iter.width, iter.height);
+	GthImage *canvas = gth_image_new (animation->canvas_width, animation->canvas_height);
+	if ((foreground == NULL) || (canvas == NULL)) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+			"Cannot allocate memory for frame %u.", frame_index);
+		_g_object_unref (foreground);
+		_g_object_unref (canvas);
+		WebPDemuxReleaseIterator (&iter);
 		return NULL;
 	}
 
+	if (!decode_frame (&iter, foreground, error)) {
+		g_object_unref (foreground);
+		g_object_unref (canvas);
+		WebPDemuxReleaseIterator (&iter);
+		return NULL;
+	}
+
+	gth_image_render_frame (canvas, *background, animation->background_color,
+		foreground, iter.x_offset, iter.y_offset,
+		(iter.blend_method == WEBP_MUX_BLEND));
+
+	_g_object_unref (*background);
+	*background = (iter.dispose_method == WEBP_MUX_DISPOSE_NONE) ? g_object_ref (canvas) : NULL;
+
+	g_object_unref (foreground);
+	WebPDemuxReleaseIterator (&iter);
+
+	return canvas;
+}
+
+static GthImage * load_animation (GBytes *bytes, GError **error) {
+	WebPAnimation *animation = g_new0 (WebPAnimation, 1);
+	// The frames are decoded after the loader returns, keep a private copy
+	// of the data because bytes can be a mapping of a file that may change.
+	gsize buffer_size;
+	gconstpointer buffer = g_bytes_get_data (bytes, &buffer_size);
+	animation->bytes = g_bytes_new (buffer, buffer_size);
+	buffer = g_bytes_get_data (animation->bytes, NULL);
+	WebPData webp_data = { .bytes = (uint8_t*) buffer, .size = (size_t) buffer_size };
+	animation->demux = WebPDemux (&webp_data);
+	animation->canvas_width = WebPDemuxGetI (animation->demux, WEBP_FF_CANVAS_WIDTH);
+	animation->canvas_height = WebPDemuxGetI (animation->demux, WEBP_FF_CANVAS_HEIGHT);
+	animation->background_color = WebPDemuxGetI (animation->demux, WEBP_FF_BACKGROUND_COLOR);
+
+	// Decode the first frame now, the others when requested.
+	GthImage *background = NULL;
+	GthImage *first_frame = render_frame (0, &background, animation, error);
+	_g_object_unref (background);
+	if (first_frame == NULL) {
+		webp_animation_free (animation);
+		return NULL;
+	}
+
+	GthImage *image = (GthImage *) g_object_new (GTH_TYPE_IMAGE, NULL);
+	WebPIterator iter;
+	WebPDemuxGetFrame (animation->demux, 1, &iter);
+	gth_image_set_has_alpha (image, iter.has_alpha);
+	gth_image_add_frame (image, first_frame, iter.duration);
+	while (WebPDemuxNextFrame (&iter)) {
+		gth_image_add_lazy_frame (image, iter.duration);
+	}
+	WebPDemuxReleaseIterator (&iter);
+	g_object_unref (first_frame);
+
+	gth_image_set_frame_renderer (image, render_frame, animation, (GDestroyNotify) webp_animation_free);
+
+	return image;
+}
+
+GthImage* load_webp (GBytes *bytes, guint requested_size, GCancellable *cancellable, GError **error) {
 	gsize buffer_size;
 	gconstpointer buffer = g_bytes_get_data (bytes, &buffer_size);
 	WebPData webp_data = { .bytes = (uint8_t*) buffer, .size = (size_t) buffer_size };
 	WebPDemuxer *demux = WebPDemux (&webp_data);
+	if (demux == NULL) {
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED, _("Invalid file format"));
+		return NULL;
+	}
 
 	guint natural_width = WebPDemuxGetI (demux, WEBP_FF_CANVAS_WIDTH);
 	guint natural_height = WebPDemuxGetI (demux, WEBP_FF_CANVAS_HEIGHT);
 	guint frames = WebPDemuxGetI (demux, WEBP_FF_FRAME_COUNT);
-	uint32_t background_color = WebPDemuxGetI (demux, WEBP_FF_BACKGROUND_COLOR);
-	gboolean is_animated = frames > 1;
 	//guint loops = WebPDemuxGetI (demux, WEBP_FF_LOOP_COUNT);
 
-	WebPIterator iter;
-	if (!WebPDemuxGetFrame (demux, 1, &iter)) {
-		WebPDemuxDelete (demux);
-		return NULL;
-	}
-
-	guint canvas_width = natural_width;
-	guint canvas_height = natural_height;
-#if SCALING_WORKS
-	double scale_factor = 1.0;
-	if (requested_size > 0) {
-		scale_if_larger (&canvas_width, &canvas_height, requested_size);
-		scale_factor = (double) canvas_width / natural_width;
+	GthImage *image = NULL;
+	if (frames > 1) {
+		image = load_animation (bytes, error);
+		if (image == NULL) {
+			WebPDemuxDelete (demux);
+			return NULL;
+		}
 	}
-#endif
+	else {
+		WebPIterator iter;
+		if (!WebPDemuxGetFrame (demux, 1, &iter)) {
+			WebPDemuxDelete (demux);
+			return NULL;
+		}
 
-	GthImage *image = is_animated ? (GthImage *) g_object_new (GTH_TYPE_IMAGE, NULL) : gth_image_new (canvas_width, canvas_height);
-	gth_image_set_has_alpha (image, iter.has_alpha);
-	guint frame_idx = 0;
-	GthImage *background = NULL;
-	do {
-		guint width = iter.width;
-		guint height = iter.height;
+		guint width = natural_width;
+		guint height = natural_height;
 #if SCALING_WORKS
-		if (scale_factor < 1.0) {
-			width = (guint) (scale_factor * width);
-			height = (guint) (scale_factor * height);
+		if (requested_size > 0) {
+			scale_if_larger (&width, &height, requested_size);
 		}
 #endif
-		if (!is_animated && ((width != canvas_width) || (height != canvas_height))) {
+
+		if ((iter.width != natural_width) || (iter.height != natural_height)) {
 			g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED, "Wrong image size");
 			WebPDemuxReleaseIterator (&iter);
-			WebPFreeDecBuffer (&config.output);
 			WebPDemuxDelete (demux);
-			g_object_unref (image);
 			return NULL;
 		}
 
-		GthImage *foreground = (frames > 1) ? gth_image_new (width, height) : g_object_ref (image);
-
-		config.options.no_fancy_upsampling = 1;
-#if SCALING_WORKS
-		if (requested_size > 0) {
-			config.options.use_scaling = 1;
-			config.options.scaled_width = width;
-			config.options.scaled_height = height;
-		}
-#endif
-#if G_BYTE_ORDER == G_LITTLE_ENDIAN
-		config.output.colorspace = MODE_bgrA;
-#elif G_BYTE_ORDER == G_BIG_ENDIAN
-		config.output.colorspace = MODE_Argb;
-#endif
-		gsize foreground_size;
-		config.output.u.RGBA.rgba = (uint8_t *) gth_image_get_pixels (foreground, &foreground_size);
-		config.output.u.RGBA.stride = (int) gth_image_get_row_stride (foreground);
-		config.output.u.RGBA.size = (size_t) foreground_size;
-		config.output.is_external_memory = 1;
-		config.output.width = width;
-		config.output.height = height;
-
-		if (WebPDecode (iter.fragment.bytes, iter.fragment.size, &config) != VP8_STATUS_OK) {
-			g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED, "WebPDecode failed");
-			g_object_unref (foreground);
+		image = gth_image_new (width, height);
+		gth_image_set_has_alpha (image, iter.has_alpha);
+		if (!decode_frame (&iter, image, error)) {
 			WebPDemuxReleaseIterator (&iter);
-			WebPFreeDecBuffer (&config.output);
 			WebPDemuxDelete (demux);
 			g_object_unref (image);
 			return NULL;
 		}
-
-		if (is_animated) {
-			GthImage *canvas = gth_image_new (canvas_width, canvas_height);
-			if (canvas == NULL) {
-				g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
-					"Cannot allocate memory for frame %d.", frame_idx);
-				g_object_unref (foreground);
-				WebPDemuxReleaseIterator (&iter);
-				WebPFreeDecBuffer (&config.output);
-				WebPDemuxDelete (demux);
-				g_object_unref (image);
-				return NULL;
-			}
-			guint x_offset = iter.x_offset;
-			guint y_offset = iter.y_offset;
-#if SCALING_WORKS
-			if (scale_factor < 1.0) {
-				x_offset = (guint) (scale_factor * x_offset);
-				y_offset = (guint) (scale_factor * y_offset);
-			}
-#endif
-			gth_image_render_frame (canvas, background, background_color,
-				foreground, x_offset, y_offset,
-				(iter.blend_method == WEBP_MUX_BLEND));
-			gth_image_add_frame (image, canvas, iter.duration);
-
-			if (background != NULL) {
-				g_object_unref (background);
-				background = NULL;
-			}
-			if (iter.dispose_method == WEBP_MUX_DISPOSE_NONE) {
-				background = g_object_ref (canvas);
-			}
-
-			g_object_unref (canvas);
-		}
-		g_object_unref (foreground);
-		frame_idx++;
-		if (!is_animated) {
-			break;
-		}
-	}
-	while (WebPDemuxNextFrame (&iter));
-
-	if (background != NULL) {
-		g_object_unref (background);
-		background = NULL;
+		WebPDemuxReleaseIterator (&iter);
 	}
-	WebPDemuxReleaseIterator (&iter);
-	WebPFreeDecBuffer (&config.output);
 
 	// Read orientation and ICC profile.
 
@@ -566,11 +566,12 @@ _jpeg_get_icc_profile_chunk_from_app2_segment (guchar *in_buffer,
 }
 
 
-#define _JPEG_MARKER_SOF0 0xc0
-#define _JPEG_MARKER_SOF1 0xc2
 #define _JPEG_MARKER_APP1 0xe1
 #define _JPEG_MARKER_APP2 0xe2
 
+/* Any start of frame marker: 0xc0-0xcf except DHT, JPG and DAC. */
+#define _JPEG_MARKER_IS_SOF(id) (((id) >= 0xc0) && ((id) <= 0xcf) && ((id) != 0xc4) && ((id) != 0xc8) && ((id) != 0xcc))
+
 
 gboolean
 _jpeg_info_get_from_stream (GInputStream	 *stream,
@@ -589,7 +590,7 @@ _jpeg_info_get_from_stream (GInputStream	 *stream,
 		gboolean segment_data_consumed = FALSE;
 
 		if (((flags & _JPEG_INFO_IMAGE_SIZE) && ! (data->valid & _JPEG_INFO_IMAGE_SIZE))
-		    && ((marker_id == _JPEG_MARKER_SOF0) || (marker_id == _JPEG_MARKER_SOF1)))
+		    && _JPEG_MARKER_IS_SOF (marker_id))
 		{
 			guint h, l;
 			guint size;
@@ -0,0 +1,124 @@
+#include <config.h>
+#include <stdio.h>
+#include <jpeglib.h>
+#include <jerror.h>
+#include <glib.h>
+#include <gio/gio.h>
+#include "jstreamsrc.h"
+
+
+#define INPUT_BUFFER_SIZE (64 * 1024)
+
+
+typedef struct {
+	struct jpeg_source_mgr pub;
+	GInputStream *stream;
+	GCancellable *cancellable;
+	JOCTET *buffer;
+	gboolean start_of_file;
+	GError *error;
+} StreamSourceMgr;
+
+
+static void init_source (j_decompress_ptr cinfo) {
+	StreamSourceMgr *src = (StreamSourceMgr *) cinfo->src;
+	src->start_of_file = TRUE;
+}
+
+
+static boolean fill_input_buffer (j_decompress_ptr cinfo) {
+	StreamSourceMgr *src = (StreamSourceMgr *) cinfo->src;
+	gssize n_bytes = g_input_stream_read (src->stream,
+		src->buffer,
+		INPUT_BUFFER_SIZE,
+		src->cancellable,
+		&src->error);
+
+	if (n_bytes <= 0) {
+		// Read errors and empty files are fatal, the read error is
+		// returned by _jpeg_stream_src_steal_error.
+		if ((n_bytes < 0) || src->start_of_file) {
+			ERREXIT (cinfo, JERR_INPUT_EMPTY);
+		}
+
+		// Truncated file: insert a fake EOI marker to show the data
+		// read so far.
+		WARNMS (cinfo, JWRN_JPEG_EOF);
+		src->buffer[0] = (JOCTET) 0xFF;
+		src->buffer[1] = (JOCTET) JPEG_EOI;
+		n_bytes = 2;
+	}
+
+	src->pub.next_input_byte = src->buffer;
+	src->pub.bytes_in_buffer = (size_t) n_bytes;
+	src->start_of_file = FALSE;
+
+	return TRUE;
+}
+
+
+static void skip_input_data (j_decompress_ptr cinfo, long num_bytes) {
+	struct jpeg_source_mgr *src = cinfo->src;
+
+	if (num_bytes > 0) {
+		while (num_bytes > (long) src->bytes_in_buffer) {
+			num_bytes -= (long) src->bytes_in_buffer;
+			(void) (*src->fill_input_buffer) (cinfo);
+			// fill_input_buffer never returns FALSE, suspension need
+			// not be handled.
+		}
+		src->next_input_byte += (size_t) num_bytes;
+		src->bytes_in_buffer -= (size_t) num_bytes;
+	}
+}
+
+
+static void term_source (j_decompress_ptr cinfo) {
+	//
+}
+
+
+// Reads the compressed data from stream as the decoder needs it, the stream
+// must be kept alive until the decompression is finished.
+void _jpeg_stream_src (j_decompress_ptr cinfo, GInputStream *stream, GCancellable *cancellable) {
+	StreamSourceMgr *src;
+
+	if (cinfo->src == NULL) {
+		cinfo->src = (struct jpeg_source_mgr *) (*cinfo->mem->alloc_small) (
+			(j_common_ptr) cinfo,
+			JPOOL_PERMANENT,
+			sizeof (StreamSourceMgr)
+		);
+		src = (StreamSourceMgr *) cinfo->src;
+		src->buffer = (JOCTET *) (*cinfo->mem->alloc_small) (
+			(j_common_ptr) cinfo,
+			JPOOL_PERMANENT,
+			INPUT_BUFFER_SIZE * sizeof (JOCTET)
+		);
+	}
+
+	src = (StreamSourceMgr *) cinfo->src;
+	src->pub.init_source = init_source;
+	src->pub.fill_input_buffer = fill_input_buffer;
+	src->pub.skip_input_data = skip_input_data;
+	src->pub.resync_to_restart = jpeg_resync_to_restart;
+	src->pub.term_source = term_source;
+	src->pub.bytes_in_buffer = 0;
+	src->pub.next_input_byte = NULL;
+	src->stream = stream;
+	src->cancellable = cancellable;
+	src->error = NULL;
+}
+
+
+// Returns the error of the last read operation, if any.  Must be called
+// before destroying the decompressor.
+GError * _jpeg_stream_src_steal_error (j_decompress_ptr cinfo) {
+	StreamSourceMgr *src = (StreamSourceMgr *) cinfo->src;
+	if (src == NULL) {
+		return NULL;
+	}
+	GError *error = src->error;
+	src->error = NULL;
+	return error;
+}
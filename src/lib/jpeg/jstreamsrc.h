@@ -0,0 +1,13 @@
+#ifndef JSTREAMSRC_H
+#define JSTREAMSRC_H
+
+#include <jpeglib.h>
+#include <glib.h>
+#include <gio/gio.h>
+
+void _jpeg_stream_src (j_decompress_ptr cinfo,
+		       GInputStream *stream,
+		       GCancellable *cancellable);
+GError * _jpeg_stream_src_steal_error (j_decompress_ptr cinfo);
+
+#endif /* JSTREAMSRC_H */
@@ -59,6 +59,17 @@ typedef enum {
 
 #define GTH_MAX_IMAGE_SIZE 32767
 
+// A rectangle in displayed image coordinates (after applying the
+// orientation) at full size, to be decoded at 1/scale_denom of the
+// original size.
+typedef struct {
+	int x;
+	int y;
+	int width;
+	int height;
+	int scale_denom;
+} GthImageRegion;
+
 typedef enum {
 	GTH_RESIZE_DEFAULT = 0, // NO UPSCALE, NOT SQUARED
 	GTH_RESIZE_UPSCALE = 1 << 1,